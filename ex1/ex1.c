@@ -5,6 +5,11 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <stdlib.h>
+#include "perfctr.h"
+
+// Build: gcc -Wall -O2 -pthread -I../ex3 -o fconc ex1.c ../ex3/perfctr.c
+// With PERFCTR=1 in the environment, hardware/software counters of the open
+// and copy phases are reported on stderr (see ex3/perfctr.h).
 
 // Writes up to len bytes from the buffer starting at buff 
 // to the file referred to by the file descriptor fd.
@@ -53,6 +58,8 @@ void write_file(int fd, const char *infile) {
 }
 
 int main(int argc, char **argv) {
+    struct perfctr *perf = perfctr_start();  // NULL (and no-ops) without PERFCTR
+
     if (argc != 3 && argc != 4) {  // Checks for the right amount of arguments
         printf("Usage: ./fconc infile1 infile2 [outfile (default:fconc.out)]\n");
         exit(1);
@@ -89,14 +96,17 @@ int main(int argc, char **argv) {
         close(fd_B);
         exit(1);
     }
+    perfctr_phase(perf, "open");
 
     // Write the two given files to the final file
     write_file(fd_C, argv[1]);
     write_file(fd_C, argv[2]);
+    perfctr_phase(perf, "copy");
 
     close(fd_A);
     close(fd_B);
     close(fd_C);  // Close all file descriptors
+    perfctr_stop(perf, "fconc");
 
     return 0;
 }
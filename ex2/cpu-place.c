@@ -0,0 +1,197 @@
+/*
+ * cpu-place.c
+ *
+ * Topology-aware CPU placement for the process trees of ex2.
+ * See cpu-place.h for the policy.
+ */
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include "cpu-place.h"
+
+int cpu_place_enabled = 0;
+
+struct cpu_desc {
+    int cpu;
+    int package;
+    int l3;
+    int core;
+};
+
+/* Usable CPUs, in topology order */
+static int *cpu_order;
+static int nr_cpus;
+
+/* Subtree sizes, hashed by node address (computed once, before forking) */
+struct size_entry {
+    struct tree_node *node;
+    int size;
+};
+static struct size_entry *size_table;
+static size_t size_table_len;
+
+static int read_sysfs_int(int cpu, const char *file, int dflt) {
+    char path[256];
+    FILE *f;
+    int val;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/%s", cpu, file);
+    if ((f = fopen(path, "r")) == NULL)
+        return dflt;
+    if (fscanf(f, "%d", &val) != 1)
+        val = dflt;
+    fclose(f);
+    return val;
+}
+
+static int cpu_desc_cmp(const void *a, const void *b) {
+    const struct cpu_desc *x = a, *y = b;
+
+    if (x->package != y->package)
+        return x->package - y->package;
+    if (x->l3 != y->l3)
+        return x->l3 - y->l3;
+    if (x->core != y->core)
+        return x->core - y->core;
+    return x->cpu - y->cpu;
+}
+
+static size_t size_slot(struct tree_node *node) {
+    return ((uintptr_t)node / sizeof(*node)) % size_table_len;
+}
+
+static int subtree_size(struct tree_node *node) {
+    size_t slot;
+
+    for (slot = size_slot(node); size_table[slot].node != NULL; slot = (slot + 1) % size_table_len)
+        if (size_table[slot].node == node)
+            return size_table[slot].size;
+    return 1;
+}
+
+static int count_and_store(struct tree_node *root) {
+    int i, size = 1;
+    size_t slot;
+
+    for (i = 0; i < root->nr_children; i++)
+        size += count_and_store(root->children + i);
+    for (slot = size_slot(root); size_table[slot].node != NULL; slot = (slot + 1) % size_table_len)
+        ;
+    size_table[slot].node = root;
+    size_table[slot].size = size;
+    return size;
+}
+
+static int count_nodes_plain(struct tree_node *root) {
+    int i, cnt = 1;
+    for (i = 0; i < root->nr_children; i++)
+        cnt += count_nodes_plain(root->children + i);
+    return cnt;
+}
+
+int cpu_place_init(struct tree_node *root) {
+    struct cpu_desc *desc;
+    cpu_set_t allowed;
+    int cpu, max_cpus;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0) {
+        perror("cpu_place_init: sched_getaffinity");
+        return 0;
+    }
+
+    max_cpus = sysconf(_SC_NPROCESSORS_CONF);
+    if (max_cpus > CPU_SETSIZE)
+        max_cpus = CPU_SETSIZE;
+    desc = malloc(max_cpus * sizeof(*desc));
+    cpu_order = malloc(max_cpus * sizeof(*cpu_order));
+    if (desc == NULL || cpu_order == NULL) {
+        fprintf(stderr, "cpu_place_init: out of memory\n");
+        exit(1);
+    }
+
+    // Only the CPUs we are allowed to run on, described by their topology.
+    // Without an L3 (cache/index3), the package is the cache domain.
+    nr_cpus = 0;
+    for (cpu = 0; cpu < max_cpus; cpu++) {
+        if (!CPU_ISSET(cpu, &allowed))
+            continue;
+        desc[nr_cpus].cpu = cpu;
+        desc[nr_cpus].package = read_sysfs_int(cpu, "topology/physical_package_id", 0);
+        desc[nr_cpus].l3 = read_sysfs_int(cpu, "cache/index3/id", desc[nr_cpus].package);
+        desc[nr_cpus].core = read_sysfs_int(cpu, "topology/core_id", cpu);
+        nr_cpus++;
+    }
+    qsort(desc, nr_cpus, sizeof(*desc), cpu_desc_cmp);
+    for (cpu = 0; cpu < nr_cpus; cpu++)
+        cpu_order[cpu] = desc[cpu].cpu;
+    free(desc);
+
+    // Without a pointer tree, the caller splits with cpu_place_split()
+    if (root != NULL) {
+        size_table_len = 2 * count_nodes_plain(root) + 1;
+        size_table = calloc(size_table_len, sizeof(*size_table));
+        if (size_table == NULL) {
+            fprintf(stderr, "cpu_place_init: out of memory\n");
+            exit(1);
+        }
+        count_and_store(root);
+    }
+
+    cpu_place_enabled = (nr_cpus > 0);
+    return nr_cpus;
+}
+
+void cpu_place_self(int lo, int hi) {
+    cpu_set_t set;
+    int k;
+
+    if (!cpu_place_enabled || hi <= lo)
+        return;
+
+    CPU_ZERO(&set);
+    for (k = lo; k < hi; k++)
+        CPU_SET(cpu_order[k], &set);
+    if (sched_setaffinity(0, sizeof(set), &set) < 0)
+        perror("cpu_place_self: sched_setaffinity");
+}
+
+void cpu_place_split(int lo, int hi, long before, long size, long total, int *clo, int *chi) {
+    long width = hi - lo;
+
+    if (!cpu_place_enabled) {
+        *clo = *chi = 0;
+        return;
+    }
+
+    // Proportional share of the parent's range, never empty: when there are
+    // more subtrees than CPUs, neighbouring subtrees share a CPU
+    *clo = lo + width * before / total;
+    *chi = lo + width * (before + size) / total;
+    if (*chi <= *clo)
+        *chi = *clo + 1;
+    if (*chi > hi) {
+        *chi = hi;
+        *clo = hi - 1;
+    }
+}
+
+void cpu_place_child(struct tree_node *root, int lo, int hi, int i, int *clo, int *chi) {
+    long total = 0, before = 0;
+    int j, size;
+
+    if (!cpu_place_enabled) {
+        *clo = *chi = 0;
+        return;
+    }
+
+    for (j = 0; j < root->nr_children; j++) {
+        size = subtree_size(root->children + j);
+        if (j < i)
+            before += size;
+        total += size;
+    }
+    cpu_place_split(lo, hi, before, subtree_size(root->children + i), total, clo, chi);
+}
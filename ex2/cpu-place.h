@@ -0,0 +1,40 @@
+/*
+ * cpu-place.h
+ *
+ * Topology-aware CPU placement for the process trees of ex2.
+ *
+ * The usable CPUs are ordered by (package, L3 cache, core), so that any
+ * contiguous range of that order is as cache-local as possible. The root of
+ * the tree gets the whole range; every node splits its own range among its
+ * children in proportion to the size of their subtrees. A parent therefore
+ * always shares CPUs (and caches) with the children it talks to over pipes,
+ * while independent subtrees end up on different cores/sockets.
+ */
+#ifndef CPU_PLACE_H__
+#define CPU_PLACE_H__
+
+#include "tree.h"
+
+/* Non-zero once cpu_place_init() has succeeded */
+extern int cpu_place_enabled;
+
+/*
+ * Read the topology from sysfs and prepare the subtree sizes of root
+ * (root may be NULL if only cpu_place_split() is used).
+ * Returns the number of usable CPUs, i.e. the range [0, n) of the root.
+ */
+int cpu_place_init(struct tree_node *root);
+
+/* Pin the calling process to the CPUs [lo, hi) of the topology order */
+void cpu_place_self(int lo, int hi);
+
+/* Compute the range [*clo, *chi) of child i of root, whose range is [lo, hi) */
+void cpu_place_child(struct tree_node *root, int lo, int hi, int i, int *clo, int *chi);
+
+/*
+ * Same split, for callers that know the subtree sizes themselves: the child
+ * has `size` nodes, its earlier siblings `before`, all siblings `total`.
+ */
+void cpu_place_split(int lo, int hi, long before, long size, long total, int *clo, int *chi);
+
+#endif /* CPU_PLACE_H__ */
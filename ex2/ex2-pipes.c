@@ -1,22 +1,372 @@
+#define _GNU_SOURCE
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <signal.h>
 #include <assert.h>
 #include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <semaphore.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
+#include <sched.h>
 #include "proc-common.h"
 #define SLEEP_PROC_SEC 10
 #define SLEEP_TREE_SEC 3
 #include "tree.h"
+#include "cpu-place.h"
 
-void child(int fd, struct tree_node *root) {
+/*
+ * Common-subexpression sharing.
+ *
+ * After get_tree_from_file() every subtree is hash-consed: structurally
+ * identical subtrees (same names, same children in the same order) get the
+ * same unique id. Only the first copy of an operator subtree in evaluation
+ * order forks its processes; every later copy is a single leaf-like process
+ * that takes the value from a memo slot shared by the whole process tree.
+ * When subtrees run concurrently (-s), a copy may be woken before the first
+ * copy is done; it then blocks on the slot's semaphore.
+ *
+ * The memo can optionally be kept on disk (-c cache_file), keyed by the
+ * 64-bit structural hash of the subtree, so that a later run over a mostly
+ * unchanged tree skips every subtree it has already seen.
+ */
+struct cse_info {
+    uint64_t hash;             /* Structural hash of the subtree */
+    int id;                    /* Unique subtree id */
+    int shared;                /* 1: take the value from the memo, do not fork */
+    int depth;                 /* Height of the subtree, 1 for a leaf */
+    int size;                  /* Number of nodes in the subtree */
+    struct cse_info *children;
+};
+
+struct memo_slot {
+    uint64_t hash;
+    double value;
+    int valid;
+    sem_t ready;               /* Posted once value is valid */
+};
+
+/* One record of the on-disk memo cache */
+struct memo_record {
+    uint64_t hash;
+    double value;
+};
+
+/* Distinct subtrees, indexed by unique id */
+struct cse_entry {
+    uint64_t hash;
+    struct tree_node *node;    /* First occurrence, used for comparisons */
+    int *child_ids;
+};
+
+struct cse_entry *cse_entries;
+int cse_nr_entries;
+int *cse_table;                /* Open-addressing table of unique ids, -1 = empty */
+int cse_table_size;
+
+struct memo_slot *memo;        /* MAP_SHARED, one slot per unique id */
+
+void *cse_malloc(size_t size) {
+    void *p;
+    if ((p = malloc(size)) == NULL) {
+        fprintf(stderr, "Out of memory, failed to allocate %zu bytes\n", size);
+        exit(1);
+    }
+    return p;
+}
+
+int count_nodes(struct tree_node *root) {
+    int i, cnt = 1;
+    for (i = 0; i < root->nr_children; i++)
+        cnt += count_nodes(root->children + i);
+    return cnt;
+}
+
+int is_operator(struct tree_node *root) {
+    return (strcmp(root->name, "+") == 0) || (strcmp(root->name, "*") == 0);
+}
+
+// FNV-1a, folded over the name and then the children's hashes
+uint64_t fnv1a(uint64_t h, const void *data, size_t len) {
+    const unsigned char *p = data;
+    while (len--) {
+        h ^= *p++;
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+// Two subtrees are identical if they have the same name and their children
+// have the same unique ids (the children are interned before their parent)
+int cse_equal(struct cse_entry *e, struct tree_node *root, struct cse_info *info) {
+    int i;
+    if (strcmp(e->node->name, root->name) != 0 || e->node->nr_children != root->nr_children)
+        return 0;
+    for (i = 0; i < root->nr_children; i++)
+        if (e->child_ids[i] != info->children[i].id)
+            return 0;
+    return 1;
+}
+
+// Bottom-up pass: compute the structural hash and the unique id of every subtree
+void cse_intern(struct tree_node *root, struct cse_info *info) {
+    int i, slot;
+    uint64_t h = 0xcbf29ce484222325ULL;
+
+    info->children = NULL;
+    if (root->nr_children > 0) {
+        info->children = cse_malloc(root->nr_children * sizeof(*info->children));
+    }
+    h = fnv1a(h, root->name, strlen(root->name) + 1);
+    info->depth = 1;
+    info->size = 1;
+    for (i = 0; i < root->nr_children; i++) {
+        cse_intern(root->children + i, info->children + i);
+        h = fnv1a(h, &info->children[i].hash, sizeof(uint64_t));
+        if (info->children[i].depth + 1 > info->depth)
+            info->depth = info->children[i].depth + 1;
+        info->size += info->children[i].size;
+    }
+    info->hash = h;
+    info->shared = 0;
+
+    // Linear probing; the table is at least twice as large as the tree
+    for (slot = h % cse_table_size; cse_table[slot] != -1; slot = (slot + 1) % cse_table_size) {
+        struct cse_entry *e = &cse_entries[cse_table[slot]];
+        if (e->hash == h && cse_equal(e, root, info)) {
+            info->id = cse_table[slot];
+            return;
+        }
+    }
+
+    // First time we see this subtree
+    info->id = cse_nr_entries++;
+    cse_table[slot] = info->id;
+    cse_entries[info->id].hash = h;
+    cse_entries[info->id].node = root;
+    cse_entries[info->id].child_ids = NULL;
+    if (root->nr_children > 0) {
+        cse_entries[info->id].child_ids = cse_malloc(root->nr_children * sizeof(int));
+        for (i = 0; i < root->nr_children; i++)
+            cse_entries[info->id].child_ids[i] = info->children[i].id;
+    }
+}
+
+// Top-down pass in evaluation order: the first copy of each operator subtree
+// is evaluated normally, later copies (and subtrees found in the on-disk cache)
+// are marked as shared and their descendants are never forked.
+// Returns the number of nodes that will not get a process.
+int cse_mark_shared(struct tree_node *root, struct cse_info *info, char *seen) {
+    int i, skipped = 0;
+
+    if (is_operator(root) && (seen[info->id] || memo[info->id].valid)) {
+        info->shared = 1;
+        return count_nodes(root) - 1;
+    }
+    seen[info->id] = 1;
+    for (i = 0; i < root->nr_children; i++)
+        skipped += cse_mark_shared(root->children + i, info->children + i, seen);
+    return skipped;
+}
+
+/*
+ * On-disk memo cache: a flat array of struct memo_record.
+ */
+struct memo_record *cache_records;
+int cache_nr_records;
+
+void cache_load(const char *filename) {
+    int fd, i, slot;
+    struct stat st;
+
+    cache_nr_records = 0;
+    cache_records = NULL;
+    fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return; // No cache yet, it will be created on exit
+    if (fstat(fd, &st) < 0) {
+        perror("cache_load: fstat");
+        exit(1);
+    }
+    cache_nr_records = st.st_size / sizeof(struct memo_record);
+    if (cache_nr_records == 0) {
+        close(fd);
+        return;
+    }
+    cache_records = cse_malloc(cache_nr_records * sizeof(struct memo_record));
+    if (read(fd, cache_records, cache_nr_records * sizeof(struct memo_record)) !=
+        (ssize_t)(cache_nr_records * sizeof(struct memo_record))) {
+        perror("cache_load: read");
+        exit(1);
+    }
+    close(fd);
+
+    // Preload the memo slots of every operator subtree we already know
+    for (i = 0; i < cache_nr_records; i++) {
+        uint64_t h = cache_records[i].hash;
+        for (slot = h % cse_table_size; cse_table[slot] != -1; slot = (slot + 1) % cse_table_size) {
+            int id = cse_table[slot];
+            if (cse_entries[id].hash == h && is_operator(cse_entries[id].node) && !memo[id].valid) {
+                memo[id].value = cache_records[i].value;
+                memo[id].valid = 1;
+                sem_post(&memo[id].ready);
+            }
+        }
+    }
+}
+
+int memo_record_cmp(const void *a, const void *b) {
+    uint64_t ha = ((const struct memo_record *)a)->hash, hb = ((const struct memo_record *)b)->hash;
+    return (ha > hb) - (ha < hb);
+}
+
+// Rewrite the cache with the old records plus every operator value computed now
+void cache_store(const char *filename) {
+    int fd, i, nr = 0, nr_new;
+    struct memo_record *out;
+
+    out = cse_malloc((cache_nr_records + cse_nr_entries) * sizeof(*out));
+    for (i = 0; i < cse_nr_entries; i++) {
+        if (memo[i].valid && is_operator(cse_entries[i].node)) {
+            out[nr].hash = memo[i].hash;
+            out[nr].value = memo[i].value;
+            nr++;
+        }
+    }
+    // Sorted by hash, so that each old record is looked up in O(log n)
+    qsort(out, nr, sizeof(*out), memo_record_cmp);
+    nr_new = nr;
+    for (i = 0; i < cache_nr_records; i++)
+        if (bsearch(&cache_records[i], out, nr_new, sizeof(*out), memo_record_cmp) == NULL)
+            out[nr++] = cache_records[i];
+
+    fd = open(filename, O_CREAT | O_WRONLY | O_TRUNC, S_IRUSR | S_IWUSR);
+    if (fd < 0) {
+        perror(filename);
+        exit(1);
+    }
+    if (write(fd, out, nr * sizeof(*out)) != (ssize_t)(nr * sizeof(*out))) {
+        perror("cache_store: write");
+        exit(1);
+    }
+    close(fd);
+    free(out);
+}
+
+// Build the unique-subtree table and the shared memo for the whole tree
+struct cse_info *cse_setup(struct tree_node *root, const char *cache_file, int *skipped) {
+    struct cse_info *info;
+    char *seen;
+    int i, nr_nodes;
+
+    nr_nodes = count_nodes(root);
+    cse_entries = cse_malloc(nr_nodes * sizeof(*cse_entries));
+    cse_nr_entries = 0;
+    cse_table_size = 2 * nr_nodes + 1;
+    cse_table = cse_malloc(cse_table_size * sizeof(int));
+    for (i = 0; i < cse_table_size; i++)
+        cse_table[i] = -1;
+
+    info = cse_malloc(sizeof(*info));
+    cse_intern(root, info);
+
+    // The memo must be visible to every process of the tree
+    memo = mmap(NULL, cse_nr_entries * sizeof(*memo), PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (memo == MAP_FAILED) {
+        perror("mmap");
+        exit(1);
+    }
+    for (i = 0; i < cse_nr_entries; i++) {
+        memo[i].hash = cse_entries[i].hash;
+        memo[i].valid = 0;
+        if (sem_init(&memo[i].ready, 1, 0) < 0) {
+            perror("sem_init");
+            exit(1);
+        }
+    }
+
+    if (cache_file != NULL)
+        cache_load(cache_file);
+
+    seen = cse_malloc(cse_nr_entries);
+    memset(seen, 0, cse_nr_entries);
+    *skipped = cse_mark_shared(root, info, seen);
+    free(seen);
+    return info;
+}
+
+/*
+ * Critical-path-first scheduling (-s).
+ *
+ * By default a node wakes its children one at a time, in child-index order.
+ * In scheduling mode it wakes all of them at once, the critical subtree
+ * (deepest, then largest, as computed by cse_intern()) first. Processes off
+ * the critical path switch to SCHED_BATCH with a higher nice value, so the
+ * critical chain gets the CPU whenever it is runnable.
+ */
+#define OFF_CRITICAL_NICE 5
+
+int sched_mode = 0;
+int on_critical_path = 1;   /* Inherited through fork, cleared for non-critical children */
+
+int subtree_more_critical(struct cse_info *a, struct cse_info *b) {
+    if (a->depth != b->depth)
+        return a->depth > b->depth;
+    return a->size > b->size;
+}
+
+void demote_off_critical_path(void) {
+    struct sched_param sp = { .sched_priority = 0 };
+
+    if (sched_setscheduler(0, SCHED_BATCH, &sp) < 0)
+        perror("sched_setscheduler(SCHED_BATCH)");
+    if (setpriority(PRIO_PROCESS, 0, OFF_CRITICAL_NICE) < 0)
+        perror("setpriority");
+}
+
+void child(int fd, struct tree_node *root, struct cse_info *info, int cpu_lo, int cpu_hi) {
     // Set the process name to the given name
     change_pname(root->name);
+    // With -p, stay on the CPUs given to this subtree (no-op otherwise)
+    cpu_place_self(cpu_lo, cpu_hi);
+    if (sched_mode && !on_critical_path)
+        demote_off_critical_path();
     printf("%s: Created\n", root->name);
 
+    // SHARED NODE!
+    // An identical subtree is evaluated elsewhere (or was found in the cache),
+    // so this process behaves like a leaf whose value comes from the memo
+    if (info->shared) {
+        struct memo_slot *slot = &memo[info->id];
+
+        raise(SIGSTOP);
+        printf("PID = %ld, name = %s (shared) is awake\n", (long)getpid(), root->name);
+
+        // Wait until the first copy has published its value, and pass the token on
+        // to any other copy waiting for the same slot
+        while (sem_wait(&slot->ready) < 0)
+            ;
+        sem_post(&slot->ready);
+
+        if (write(fd, &slot->value, sizeof(slot->value)) != sizeof(slot->value)) {
+            perror("shared: write to pipe");
+            exit(1);
+        }
+        close(fd);
+        printf(" %s: Exiting...\n", root->name);
+        exit(16);
+    }
+
     // Check if the tree is correct
-    if ((strcmp(root->name, "+") == 0) || (strcmp(root->name, "*") == 0)) { // Non-terminal node (operator)
+    if (is_operator(root)) { // Non-terminal node (operator)
         // Must have exactly 2 children
         if (root->nr_children != 2) {
             perror("child: invalid number of children in + or *");
@@ -24,21 +374,30 @@ void child(int fd, struct tree_node *root) {
         }
 
         // NON-TERMINAL NODE!
-        int i, j;
+        int i, j, k, clo, chi;
         // Create an array to store the 2 pids of the non-terminal node's children
         pid_t pid_child[2];
         int status_child;
         double result[2];
-        int pfd[2];
+        // One pipe per child, so results can be told apart when children run concurrently
+        int pfd[2][2];
+        // Order in which the children are woken up (plain child-index order by default)
+        int order[2] = { 0, 1 };
 
-        // Create the pipe
-        printf("%s: Creating pipe\n", root->name);
-        if (pipe(pfd) < 0) {
-            perror("pipe");
-            exit(1);
+        // Create the pipes
+        printf("%s: Creating pipes\n", root->name);
+        for (i = 0; i < 2; i++) {
+            if (pipe(pfd[i]) < 0) {
+                perror("pipe");
+                exit(1);
+            }
         }
 
-        // printf("pfd[0]= %d , pfd[1]= %d\n",pfd[0], pfd[1]);
+        // Critical-path-first: the deeper (then larger) subtree is woken first
+        if (sched_mode && subtree_more_critical(&info->children[1], &info->children[0])) {
+            order[0] = 1;
+            order[1] = 0;
+        }
 
         // Create the 2 children of the parent process and store their pids in the array
         for (i = 0; i < 2; i++) {
@@ -49,39 +408,56 @@ void child(int fd, struct tree_node *root) {
                 exit(1);
             }
             if (pid_child[i] == 0) { // RECURSION
-                // We want the child to write its data, so we give it the write end of the pipe
+                // We want the child to write its data, so we give it the write end of its own pipe
                 // created when "running" from the parent, to communicate with its children
-                // printf("h anadromh kaleitai gia fd=pfd[1]= %d\n", pfd[1]);
-                child(pfd[1], root->children + i); // Where it sees fd, it will use pfd[1], and where it sees root, it will use root->children + i
+                for (k = 0; k < 2; k++) {
+                    close(pfd[k][0]);
+                    if (k != i)
+                        close(pfd[k][1]);
+                }
+                on_critical_path = on_critical_path && (i == order[0]);
+                cpu_place_child(root, cpu_lo, cpu_hi, i, &clo, &chi);
+                child(pfd[i][1], root->children + i, info->children + i, clo, chi); // Where it sees fd, it will use pfd[i][1], and where it sees root, it will use root->children + i
             }
         }
 
+        // Close the write ends of the pipes with which the parent communicates with the children
+        // so there is no "active" fd with which the parent can still write to them
+        for (i = 0; i < 2; i++)
+            close(pfd[i][1]);
+
         // Tell the parent process to wait for its 2 children to raise SIGSTOP
         wait_for_ready_children(2); // Returns to fork and enters the if for recursion
         raise(SIGSTOP); // After stopping the children with SIGSTOP, do the same for the parent
         printf("PID = %ld, name = %s is awake\n", (long)getpid(), root->name);
 
+        // In scheduling mode both subtrees run at the same time, critical one first
+        if (sched_mode) {
+            for (k = 0; k < root->nr_children; k++)
+                kill(pid_child[order[k]], SIGCONT);
+        }
+
         // We have printed the tree in main and we wake them all up one by one, starting from the children of root
-        for (j = 0; j < root->nr_children; j++) {
+        for (k = 0; k < root->nr_children; k++) {
+            j = order[k];
             // printf("j = %d\n pid_child = %d\n", j, pid_child[j]);
             // Send SIGCONT to the children of the current process
-            kill(pid_child[j], SIGCONT); // After this, the code continues where we did SIGSTOP for each node
-            pid_child[j] = wait(&status_child);
+            if (!sched_mode)
+                kill(pid_child[j], SIGCONT); // After this, the code continues where we did SIGSTOP for each node
+            if (waitpid(pid_child[j], &status_child, 0) < 0) {
+                perror("waitpid");
+                exit(1);
+            }
             explain_wait_status(pid_child[j], status_child); // After the child dies, we perform the operation
-            
-            double res = 0;
-            // Close the write end of the pipe with which the parent communicates with the child
-            // so there is no "active" fd with which the parent can still write to this pipe, and the program won't terminate
-            // Here, we ensure the read operation only reads the characters we want
-            // Even without the close(), it might work, but if we asked it to read everything from the read end, it would block
-            close(pfd[1]);
 
+            double res = 0;
             // The parent reads from the read end of the pipe, through which it communicates with the child,
             // the value that the child passed to the write end before it died
-            if (read(pfd[0], &res, sizeof(res)) != sizeof(res)) {
+            if (read(pfd[j][0], &res, sizeof(res)) != sizeof(res)) {
                 perror("parent: read from pipe");
                 exit(1);
             }
+            close(pfd[j][0]);
             printf("res=%f\n", res);
             result[j] = res; // printf("result[%d]=%f\n", j, res);
         }
@@ -95,11 +471,16 @@ void child(int fd, struct tree_node *root) {
             final_res = result[0] * result[1];
         }
 
+        // Publish the value for every other copy of this subtree
+        memo[info->id].value = final_res;
+        memo[info->id].valid = 1;
+        sem_post(&memo[info->id].ready);
+
         // printf("writing the final result to fd=%d\n", fd);
         // printf("while pfd[1]=%d\n", pfd[1]);
 
         // Write the final result to the write end of the pipe connecting the process to its parent,
-        // not the pipe connecting it to its children (in that case, we would write to pfd[1])
+        // not the pipes connecting it to its children (in that case, we would write to pfd[j][1])
         // Here, we want to pass the value from the child to the same fd passed in the recursion
         if (write(fd, &final_res, sizeof(final_res)) != sizeof(final_res)) {
             perror("parent: write to pipe");
@@ -138,18 +519,385 @@ void child(int fd, struct tree_node *root) {
     exit(16);
 }
 
+/*
+ * Incremental re-evaluation (daemon mode).
+ *
+ * The process tree stays alive after the first evaluation. Every node keeps
+ * the last value of each of its children, so when a leaf changes the update
+ * travels down the path to that leaf and the new values travel back up the
+ * same path: only the ancestors of the changed leaf recompute, and the cost
+ * of an update is proportional to the depth of the tree, not its size.
+ *
+ * Each node talks to its parent through two pipes: updates come in on cmd_fd
+ * and the (new) value of the subtree goes out on val_fd. Leaves are numbered
+ * from 0, left to right. Shared subtrees (CSE) are not used in this mode,
+ * since every copy of a subtree can be updated independently.
+ */
+struct leaf_update {
+    int leaf;                  /* Leaf index in the subtree, -1 = shut down */
+    double value;
+};
+
+int count_leaves(struct tree_node *root) {
+    int i, cnt = 0;
+    if (root->nr_children == 0)
+        return 1;
+    for (i = 0; i < root->nr_children; i++)
+        cnt += count_leaves(root->children + i);
+    return cnt;
+}
+
+void print_leaves(struct tree_node *root, int *next) {
+    int i;
+    if (root->nr_children == 0) {
+        printf("leaf %d = %s\n", (*next)++, root->name);
+        return;
+    }
+    for (i = 0; i < root->nr_children; i++)
+        print_leaves(root->children + i, next);
+}
+
+void daemon_write_value(int fd, double value) {
+    if (write(fd, &value, sizeof(value)) != sizeof(value)) {
+        perror("daemon: write to pipe");
+        exit(1);
+    }
+}
+
+double daemon_read_value(int fd) {
+    double value;
+    if (read(fd, &value, sizeof(value)) != sizeof(value)) {
+        perror("daemon: read from pipe");
+        exit(1);
+    }
+    return value;
+}
+
+void daemon_child(int cmd_fd, int val_fd, struct tree_node *root, int cpu_lo, int cpu_hi) {
+    struct leaf_update upd;
+    double value;
+    ssize_t rcnt;
+
+    change_pname(root->name);
+    cpu_place_self(cpu_lo, cpu_hi);
+
+    if (is_operator(root)) {
+        int i, k, clo, chi, nr_leaves[2];
+        int cmd[2][2], val[2][2];
+        pid_t pid_child[2];
+        double result[2];
+
+        if (root->nr_children != 2) {
+            fprintf(stderr, "daemon_child: invalid number of children in + or *\n");
+            exit(1);
+        }
+
+        for (i = 0; i < 2; i++) {
+            nr_leaves[i] = count_leaves(root->children + i);
+            if (pipe(cmd[i]) < 0 || pipe(val[i]) < 0) {
+                perror("pipe");
+                exit(1);
+            }
+            pid_child[i] = fork();
+            if (pid_child[i] < 0) {
+                perror("pid_child: fork");
+                exit(1);
+            }
+            if (pid_child[i] == 0) {
+                // Keep only the ends this child needs, so EOF works when a parent dies
+                // (the other ends of earlier siblings' pipes are already closed)
+                for (k = 0; k <= i; k++) {
+                    close(cmd[k][1]);
+                    close(val[k][0]);
+                }
+                close(cmd_fd);
+                close(val_fd);
+                cpu_place_child(root, cpu_lo, cpu_hi, i, &clo, &chi);
+                daemon_child(cmd[i][0], val[i][1], root->children + i, clo, chi);
+            }
+            close(cmd[i][0]);
+            close(val[i][1]);
+        }
+
+        // Initial evaluation: every child reports its value once
+        for (i = 0; i < 2; i++)
+            result[i] = daemon_read_value(val[i][0]);
+
+        for (;;) {
+            value = (strcmp(root->name, "+") == 0) ? result[0] + result[1] : result[0] * result[1];
+            daemon_write_value(val_fd, value);
+
+            rcnt = read(cmd_fd, &upd, sizeof(upd));
+            if (rcnt != sizeof(upd) || upd.leaf < 0)
+                break;
+
+            // Forward the update to the one child whose subtree holds the leaf
+            k = (upd.leaf < nr_leaves[0]) ? 0 : 1;
+            if (k == 1)
+                upd.leaf -= nr_leaves[0];
+            if (write(cmd[k][1], &upd, sizeof(upd)) != sizeof(upd)) {
+                perror("daemon_child: write to pipe");
+                exit(1);
+            }
+            result[k] = daemon_read_value(val[k][0]);
+        }
+
+        // Shut down the whole subtree
+        upd.leaf = -1;
+        for (i = 0; i < 2; i++) {
+            if (write(cmd[i][1], &upd, sizeof(upd)) != sizeof(upd))
+                perror("daemon_child: write to pipe");
+            close(cmd[i][1]);
+        }
+        for (i = 0; i < 2; i++)
+            waitpid(pid_child[i], NULL, 0);
+    } else {
+        if (root->nr_children != 0) {
+            fprintf(stderr, "daemon_child: invalid number of children in digit\n");
+            exit(1);
+        }
+
+        value = atof(root->name);
+        for (;;) {
+            daemon_write_value(val_fd, value);
+
+            rcnt = read(cmd_fd, &upd, sizeof(upd));
+            if (rcnt != sizeof(upd) || upd.leaf < 0)
+                break;
+            value = upd.value;
+        }
+    }
+
+    exit(0);
+}
+
+/*
+ * Apply every "leaf value" pair of one input line and return the new root.
+ * Returns -1 if the line is malformed.
+ */
+int daemon_apply_line(char *line, int cmd_fd, int val_fd, int nr_leaves, double *root_val, int *nr_updates) {
+    struct leaf_update upd;
+    char *p = line, *endp;
+
+    int pass;
+
+    // Validate the whole line first, so a bad line changes nothing
+    for (pass = 0; pass < 2; pass++) {
+        p = line;
+        *nr_updates = 0;
+        for (;;) {
+            long leaf = strtol(p, &endp, 10);
+            if (endp == p)
+                break;
+            p = endp;
+            upd.value = strtod(p, &endp);
+            if (endp == p || leaf < 0 || leaf >= nr_leaves)
+                return -1;
+            p = endp;
+            upd.leaf = leaf;
+            (*nr_updates)++;
+
+            if (pass == 0)
+                continue;
+            if (write(cmd_fd, &upd, sizeof(upd)) != sizeof(upd)) {
+                perror("daemon: write to pipe");
+                exit(1);
+            }
+            *root_val = daemon_read_value(val_fd);
+        }
+        while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')
+            p++;
+        if (*p != '\0')
+            return -1;
+    }
+    return 0;
+}
+
+/*
+ * Serve update lines from in, answer on out, until EOF, "quit" or a reply
+ * that cannot be written (the client is gone).
+ * Returns 1 if the daemon should shut down.
+ */
+int daemon_serve(FILE *in, FILE *out, int cmd_fd, int val_fd, int nr_leaves, double *root_val) {
+    char *line = NULL;
+    size_t size = 0;
+    ssize_t len;
+    struct timespec t0, t1;
+    int nr_updates, quit = 0;
+
+    // Whole lines however long, so a line is never applied in pieces
+    while ((len = getline(&line, &size, in)) != -1) {
+        if (strncmp(line, "quit", 4) == 0) {
+            quit = 1;
+            break;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        // A NUL inside the line would hide the rest of it from the parser
+        if ((size_t)len != strlen(line) ||
+            daemon_apply_line(line, cmd_fd, val_fd, nr_leaves, root_val, &nr_updates) < 0) {
+            fprintf(out, "error: expected \"leaf value [leaf value ...]\" with 0 <= leaf < %d\n", nr_leaves);
+        } else {
+            clock_gettime(CLOCK_MONOTONIC, &t1);
+            fprintf(out, "RESULT: %f (%d updates, %.1f us)\n", *root_val, nr_updates,
+                    (t1.tv_sec - t0.tv_sec) * 1e6 + (t1.tv_nsec - t0.tv_nsec) / 1e3);
+        }
+        if (fflush(out) == EOF || ferror(out))
+            break;
+    }
+    free(line);
+    return quit;
+}
+
+void run_daemon(struct tree_node *root, const char *socket_path, int nr_cpus) {
+    int cmd[2], val[2], nr_leaves, next = 0;
+    struct leaf_update upd;
+    double root_val;
+    pid_t p;
+
+    nr_leaves = count_leaves(root);
+    print_leaves(root, &next);
+
+    if (pipe(cmd) < 0 || pipe(val) < 0) {
+        perror("pipe");
+        exit(1);
+    }
+    fflush(stdout);
+    p = fork();
+    if (p < 0) {
+        perror("fork");
+        exit(1);
+    }
+    if (p == 0) {
+        close(cmd[1]);
+        close(val[0]);
+        daemon_child(cmd[0], val[1], root, 0, nr_cpus);
+        assert(0);
+    }
+    close(cmd[0]);
+    close(val[1]);
+
+    root_val = daemon_read_value(val[0]);
+    printf("RESULT: %f\n", root_val);
+    fflush(stdout);
+
+    if (socket_path == NULL) {
+        daemon_serve(stdin, stdout, cmd[1], val[0], nr_leaves, &root_val);
+    } else {
+        struct sockaddr_un addr;
+        int sd, cd, done = 0;
+
+        if ((sd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+            perror("socket");
+            exit(1);
+        }
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+        unlink(socket_path);
+        if (bind(sd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(sd, 8) < 0) {
+            perror(socket_path);
+            exit(1);
+        }
+        printf("Listening on %s\n", socket_path);
+        fflush(stdout);
+
+        // A client that leaves without reading its replies must not kill the daemon
+        signal(SIGPIPE, SIG_IGN);
+
+        // One client at a time, so updates are applied in arrival order
+        while (!done) {
+            FILE *in, *out;
+
+            if ((cd = accept(sd, NULL, NULL)) < 0) {
+                perror("accept");
+                continue;
+            }
+            in = fdopen(cd, "r");
+            out = fdopen(dup(cd), "w");
+            if (in == NULL || out == NULL) {
+                perror("fdopen");
+                exit(1);
+            }
+            done = daemon_serve(in, out, cmd[1], val[0], nr_leaves, &root_val);
+            fclose(in);
+            fclose(out);
+        }
+        close(sd);
+        unlink(socket_path);
+    }
+
+    // Tear down the tree
+    upd.leaf = -1;
+    upd.value = 0;
+    if (write(cmd[1], &upd, sizeof(upd)) != sizeof(upd))
+        perror("daemon: write to pipe");
+    close(cmd[1]);
+    waitpid(p, NULL, 0);
+    printf("Parent: All done, exiting...\n");
+    exit(0);
+}
+
+void usage(char *argv0) {
+    fprintf(stderr, "Usage: %s [-p] [-s] [-c memo_cache_file] [-d | -u socket_path] <input_tree_file>\n\n"
+            "  -p: pin every subtree to a topology-aware CPU range\n"
+            "  -s: run subtrees concurrently, critical path first\n"
+            "  -c: keep the values of evaluated subtrees in memo_cache_file (not with -d, -u)\n"
+            "  -d: keep the tree resident and read \"leaf value\" updates from stdin\n"
+            "  -u: like -d, but read updates from a Unix socket\n", argv0);
+    exit(1);
+}
+
 int main(int argc, char *argv[]) {
     // Print the tree we get as input
     struct tree_node *root;
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <input_tree_file>\n\n", argv[0]);
-        exit(1);
+    struct cse_info *info;
+    char *cache_file = NULL, *socket_path = NULL;
+    int opt, skipped, daemon_mode = 0, placement = 0, nr_cpus = 0;
+    struct timespec t_build, t_start, t_end;
+
+    while ((opt = getopt(argc, argv, "psc:du:")) != -1) {
+        switch (opt) {
+        case 'p':
+            placement = 1;
+            break;
+        case 's':
+            sched_mode = 1;
+            break;
+        case 'c':
+            cache_file = optarg;
+            break;
+        case 'd':
+            daemon_mode = 1;
+            break;
+        case 'u':
+            daemon_mode = 1;
+            socket_path = optarg;
+            break;
+        default:
+            usage(argv[0]);
+        }
     }
+    // The resident tree is never evaluated through the memo, so there is nothing to cache
+    if (argc - optind != 1 || (daemon_mode && cache_file != NULL))
+        usage(argv[0]);
 
     // Get the root
-    root = get_tree_from_file(argv[1]);
+    root = get_tree_from_file(argv[optind]);
     print_tree(root);
 
+    if (placement)
+        nr_cpus = cpu_place_init(root);
+
+    // Long-running mode, does not return
+    if (daemon_mode)
+        run_daemon(root, socket_path, nr_cpus);
+
+    // Share identical subtrees, so each distinct one is evaluated only once
+    info = cse_setup(root, cache_file, &skipped);
+    printf("CSE: %d nodes, %d distinct subtrees, %d nodes not forked\n",
+           count_nodes(root), cse_nr_entries, skipped);
+
     pid_t p;
     int status;
     int pfd[2];
@@ -161,6 +909,7 @@ int main(int argc, char *argv[]) {
     }
 
     printf("Parent: Creating child...\n");
+    clock_gettime(CLOCK_MONOTONIC, &t_build);
     p = fork();
     if (p < 0) {
         /* fork failed */
@@ -170,7 +919,7 @@ int main(int argc, char *argv[]) {
 
     if (p == 0) {
         /* In child process */
-        child(pfd[1], root);
+        child(pfd[1], root, info, 0, nr_cpus);
         /*
         * Should never reach this point,
         * child() does not return
@@ -184,7 +933,10 @@ int main(int argc, char *argv[]) {
     // When the whole tree has raised SIGSTOP, we print it
     show_pstree(p);
 
-    // Wake up the root process of all
+    // Wake up the root process of all, evaluation starts here
+    clock_gettime(CLOCK_MONOTONIC, &t_start);
+    printf("Build time: %.3f ms\n",
+           (t_start.tv_sec - t_build.tv_sec) * 1e3 + (t_start.tv_nsec - t_build.tv_nsec) / 1e6);
     kill(p, SIGCONT);
 
     /* Wait for the child to terminate */
@@ -199,7 +951,15 @@ int main(int argc, char *argv[]) {
         exit(1);
     }
 
+    clock_gettime(CLOCK_MONOTONIC, &t_end);
+
     printf("FINAL RESULT: %f\n", final_val);
+    printf("Evaluation time: %.3f ms (CPU placement %s, %s scheduling)\n",
+           (t_end.tv_sec - t_start.tv_sec) * 1e3 + (t_end.tv_nsec - t_start.tv_nsec) / 1e6,
+           placement ? "on" : "off", sched_mode ? "critical-path-first" : "child-order");
+
+    if (cache_file != NULL)
+        cache_store(cache_file);
     printf("Parent: All done, exiting...\n");
 
     return 0;
@@ -3,28 +3,61 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <signal.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/mman.h>
 #include "tree.h"
 #include "proc-common.h"
+#include "cpu-place.h"
+#include "tree-compact.h"
 
-void fork_procs(struct tree_node *root) {
+/*
+ * Time spent in fork() by the parents, summed over the whole tree.
+ * Lives in a shared mapping so every process can add to it.
+ * CPU time of the caller (which includes the kernel's page-table copying),
+ * so that being preempted by the new child does not count.
+ */
+struct fork_stats {
+    long nr_forks;
+    long fork_ns;
+};
+struct fork_stats *fork_stats;
+
+pid_t timed_fork(void) {
+    struct timespec t0, t1;
+    pid_t p;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t0);
+    p = fork();
+    if (p > 0) {
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t1);
+        __sync_add_and_fetch(&fork_stats->nr_forks, 1);
+        __sync_add_and_fetch(&fork_stats->fork_ns,
+                             (t1.tv_sec - t0.tv_sec) * 1000000000L + (t1.tv_nsec - t0.tv_nsec));
+    }
+    return p;
+}
+
+void fork_procs(struct tree_node *root, int cpu_lo, int cpu_hi) {
     /*
      * Start
      */
     printf("PID = %ld, name %s, starting...\n", (long)getpid(), root->name);
     change_pname(root->name);
+    // With -p, stay on the CPUs given to this subtree (no-op otherwise)
+    cpu_place_self(cpu_lo, cpu_hi);
 
     // Similar to the previous exercise
     // Create an array for each process to store the PIDs of its children
-    int i, j;
+    int i, j, clo, chi;
     pid_t pid_child[root->nr_children];
     int status_child;
 
     // Create as many children as needed based on the process tree structure
     for (i = 0; i < root->nr_children; i++) {
         // Call fork to create each child and store its PID in the corresponding array position
-        pid_child[i] = fork();
+        pid_child[i] = timed_fork();
         printf("pid of child = %d\n", pid_child[i]); // Print the PID of the created child
 
         if (pid_child[i] < 0) {
@@ -36,7 +69,8 @@ void fork_procs(struct tree_node *root) {
         // The parent will wait, and the fork will start being called recursively
         // From each child, creating the rest of the tree structure
         if (pid_child[i] == 0) {
-            fork_procs(root->children + i);
+            cpu_place_child(root, cpu_lo, cpu_hi, i, &clo, &chi);
+            fork_procs(root->children + i, clo, chi);
         }
     }
 
@@ -79,6 +113,57 @@ void fork_procs(struct tree_node *root) {
     exit(16); // All processes return the same exit status upon termination
 }
 
+/*
+ * Same as fork_procs(), on the compact tree (-c): node is an index into t,
+ * and the children of node are the consecutive indices starting at
+ * ct_first_child(t, node).
+ */
+void fork_procs_compact(const struct compact_tree *t, int node, int cpu_lo, int cpu_hi) {
+    int i, j, clo, chi, before = 0;
+    int nr_children = ct_nr_children(t, node);
+    int first = ct_first_child(t, node);
+    pid_t pid_child[nr_children];
+    int status_child;
+
+    printf("PID = %ld, name %s, starting...\n", (long)getpid(), ct_name(t, node));
+    change_pname(ct_name(t, node));
+    cpu_place_self(cpu_lo, cpu_hi);
+
+    for (i = 0; i < nr_children; i++) {
+        pid_child[i] = timed_fork();
+        printf("pid of child = %d\n", pid_child[i]);
+
+        if (pid_child[i] < 0) {
+            perror("pid_child: fork");
+            exit(1);
+        }
+        if (pid_child[i] == 0) {
+            cpu_place_split(cpu_lo, cpu_hi, before, ct_size(t, first + i), ct_size(t, node) - 1, &clo, &chi);
+            fork_procs_compact(t, first + i, clo, chi);
+        }
+        before += ct_size(t, first + i);
+    }
+
+    if (nr_children != 0) { // Parent process
+        wait_for_ready_children(nr_children);
+        raise(SIGSTOP);
+        printf("PID = %ld, name = %s is awake\n", (long)getpid(), ct_name(t, node));
+
+        for (j = 0; j < nr_children; j++) {
+            printf("j = %d\npid_child = %d\n", j, pid_child[j]);
+            kill(pid_child[j], SIGCONT);
+            pid_child[j] = wait(&status_child);
+            explain_wait_status(pid_child[j], status_child);
+        }
+    } else { // Leaf process
+        raise(SIGSTOP);
+        printf("PID = %ld, name = %s is awake\n", (long)getpid(), ct_name(t, node));
+    }
+
+    printf("%s: Exiting...\n", ct_name(t, node));
+    exit(16);
+}
+
 /*
  * The initial process forks the root of the process tree,
  * waits for the process tree to be completely created,
@@ -94,20 +179,48 @@ void fork_procs(struct tree_node *root) {
 int main(int argc, char *argv[]) {
     pid_t pid; // The PID of A will be this
     int status;
-    struct tree_node *root;
+    struct tree_node *root = NULL;
+    const struct compact_tree *ctree = NULL;
+    int opt, nr_cpus = 0, placement = 0, compact = 0;
+    struct timespec t_build, t_start, t_end;
 
     // Print the tree structure provided as input
-    if (argc < 2) {
-        fprintf(stderr, "Usage: %s <tree_file>\n", argv[0]);
+    while ((opt = getopt(argc, argv, "pc")) != -1) {
+        if (opt == 'p') {
+            placement = 1;
+        } else if (opt == 'c') {
+            compact = 1;
+        } else {
+            fprintf(stderr, "Usage: %s [-p] [-c] <tree_file>\n", argv[0]);
+            exit(1);
+        }
+    }
+    if (argc - optind < 1) {
+        fprintf(stderr, "Usage: %s [-p] [-c] <tree_file>\n", argv[0]);
         exit(1);
     }
 
     /* Read tree into memory */
     // Get the root of the tree
-    root = get_tree_from_file(argv[1]);
+    // -c: use the compact shared tree, the pointer-based one is never built here
+    if (compact)
+        ctree = compact_tree_load(argv[optind]);
+    else
+        root = get_tree_from_file(argv[optind]);
+
+    // -p: pin every subtree to a topology-aware CPU range
+    if (placement)
+        nr_cpus = cpu_place_init(root);
+
+    fork_stats = mmap(NULL, sizeof(*fork_stats), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (fork_stats == MAP_FAILED) {
+        perror("mmap");
+        exit(1);
+    }
 
     /* Fork root of process tree */
-    pid = fork();
+    clock_gettime(CLOCK_MONOTONIC, &t_build);
+    pid = timed_fork();
     printf("pid from fork in main is: %d\n", pid);
 
     if (pid < 0) {
@@ -117,7 +230,10 @@ int main(int argc, char *argv[]) {
 
     if (pid == 0) {
         /* Child */
-        fork_procs(root);
+        if (compact)
+            fork_procs_compact(ctree, 0, 0, nr_cpus);
+        else
+            fork_procs(root, 0, nr_cpus);
         exit(1);
     }
 
@@ -129,6 +245,7 @@ int main(int argc, char *argv[]) {
     // (Here, "all" is 1 because the initial process has only 1 child (the root),
     // which is created with the fork and does not directly "see" the entire tree)
     wait_for_ready_children(1);
+    clock_gettime(CLOCK_MONOTONIC, &t_start);
 
     // We reach here once the parent raises SIGSTOP in fork_procs, i.e., at the root of the tree
     // At this point, all nodes-processes in the tree have raised SIGSTOP,
@@ -148,6 +265,19 @@ int main(int argc, char *argv[]) {
     // (Here, only the root, but effectively we wait for all nodes-processes in the tree to terminate)
     wait(&status);
     explain_wait_status(pid, status);
+    clock_gettime(CLOCK_MONOTONIC, &t_end);
+
+    // Reported for the benchmark runner (tree-bench.sh)
+    printf("Build time: %.3f ms\n",
+           (t_start.tv_sec - t_build.tv_sec) * 1e3 + (t_start.tv_nsec - t_build.tv_nsec) / 1e6);
+    printf("Evaluation time: %.3f ms\n",
+           (t_end.tv_sec - t_start.tv_sec) * 1e3 + (t_end.tv_nsec - t_start.tv_nsec) / 1e6);
+    printf("Fork latency: %.1f us average over %ld forks (%s tree)\n",
+           fork_stats->fork_ns / 1e3 / fork_stats->nr_forks, fork_stats->nr_forks,
+           compact ? "compact" : "pointer");
+
+    if (compact)
+        compact_tree_destroy(ctree);
 
     return 0;
 }
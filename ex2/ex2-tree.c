@@ -6,13 +6,16 @@
 #include <sys/wait.h>
 #include "proc-common.h"
 #include "tree.h"
+#include "cpu-place.h"
 
 #define SLEEP_PROC_SEC  10
 #define SLEEP_TREE_SEC  3
 
-void fork_procs(struct tree_node *root) {
+void fork_procs(struct tree_node *root, int cpu_lo, int cpu_hi) {
     change_pname(root->name);
-    int i, j;
+    // With -p, stay on the CPUs given to this subtree (no-op otherwise)
+    cpu_place_self(cpu_lo, cpu_hi);
+    int i, j, clo, chi;
 
     // Create an array to store the PIDs of the children for each process
     pid_t pid_child[root->nr_children];
@@ -34,7 +37,8 @@ void fork_procs(struct tree_node *root) {
         // Each child process will then enter this `if` block and proceed with recursion
         // to create the rest of the tree.
         if (pid_child[i] == 0) {
-            fork_procs(root->children + i);
+            cpu_place_child(root, cpu_lo, cpu_hi, i, &clo, &chi);
+            fork_procs(root->children + i, clo, chi);
             printf("Recursion finished, returning\n");
         }
     }
@@ -63,14 +67,28 @@ void fork_procs(struct tree_node *root) {
 int main(int argc, char *argv[]) {
     // Print the tree structure given as input
     struct tree_node *root;
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <input_tree_file>\n\n", argv[0]);
+    int opt, nr_cpus = 0, placement = 0;
+
+    while ((opt = getopt(argc, argv, "p")) != -1) {
+        if (opt == 'p') {
+            placement = 1;
+        } else {
+            fprintf(stderr, "Usage: %s [-p] <input_tree_file>\n\n", argv[0]);
+            exit(1);
+        }
+    }
+    if (argc - optind != 1) {
+        fprintf(stderr, "Usage: %s [-p] <input_tree_file>\n\n", argv[0]);
         exit(1);
     }
 
-    root = get_tree_from_file(argv[1]);
+    root = get_tree_from_file(argv[optind]);
     print_tree(root);
 
+    // -p: pin every subtree to a topology-aware CPU range
+    if (placement)
+        nr_cpus = cpu_place_init(root);
+
     pid_t pid;
     int status;
 
@@ -85,7 +103,7 @@ int main(int argc, char *argv[]) {
 
     if (pid == 0) {
         /* Child */
-        fork_procs(root);
+        fork_procs(root, 0, nr_cpus);
         printf("fork_procs has finished running\n");
         exit(1);
     }
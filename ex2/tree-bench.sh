@@ -0,0 +1,87 @@
+#!/bin/bash
+#
+# tree-bench.sh
+#
+# Stress test for the ex2 process-tree programs.
+#
+# Generates trees with tree-gen for every shape and size, runs ex2-tree,
+# ex2-signals and ex2-pipes on each one and reports:
+#   build:  time until the whole tree is created (as printed by the program)
+#   eval:   time from waking the root until it terminates (idem)
+#   wall:   total wall-clock time of the run
+#   procs:  peak number of processes of the run (sampled, so short runs
+#           may be under-reported)
+#   rss:    peak sum of the resident set sizes of those processes (KB)
+#
+# ex2-tree only sleeps, so it reports wall time only. Runs that fail (for
+# example by hitting the process limit) or time out are marked as such.
+#
+# Usage: ./tree-bench.sh [bin_dir]
+# Environment: SHAPES, SIZES, PROGRAMS, TIMEOUT (seconds per run), SEED
+#
+
+BIN=${1:-.}
+SHAPES=${SHAPES:-"balanced random skewed degenerate"}
+SIZES=${SIZES:-"11 101 1001 10001 100001 1000001"}
+PROGRAMS=${PROGRAMS:-"ex2-tree ex2-signals ex2-pipes"}
+TIMEOUT=${TIMEOUT:-120}
+SEED=${SEED:-1}
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+for prog in tree-gen $PROGRAMS; do
+    if [ ! -x "$BIN/$prog" ]; then
+        echo "$BIN/$prog: not found, build it first" >&2
+        exit 1
+    fi
+done
+
+# Sample the session of $1 until it is gone, print "peak_procs peak_rss_kb"
+sample_session() {
+    local sid=$1 procs rss max_procs=0 max_rss=0
+
+    while kill -0 "$sid" 2>/dev/null; do
+        read procs rss < <(ps -o rss= -s "$sid" 2>/dev/null | awk '{ n++; s += $1 } END { print n + 0, s + 0 }')
+        [ "$procs" -gt "$max_procs" ] && max_procs=$procs
+        [ "$rss" -gt "$max_rss" ] && max_rss=$rss
+        sleep 0.01
+    done
+    echo "$max_procs $max_rss"
+}
+
+printf "%-10s %8s %-12s %-8s %10s %10s %10s %8s %10s\n" \
+    shape nodes program status build_ms eval_ms wall_ms procs rss_kb
+
+for shape in $SHAPES; do
+    for size in $SIZES; do
+        tree="$WORK/$shape-$size.tree"
+        "$BIN/tree-gen" "$shape" "$size" "$SEED" > "$tree" || exit 1
+
+        for prog in $PROGRAMS; do
+            log="$WORK/$prog.log"
+            start=$(date +%s%N)
+
+            # Own session, so every process of the tree can be found and killed
+            setsid timeout -s KILL "$TIMEOUT" "$BIN/$prog" "$tree" > "$log" 2>&1 < /dev/null &
+            pid=$!
+            read procs rss < <(sample_session "$pid")
+            wait "$pid"
+            ret=$?
+            pkill -KILL -s "$pid" 2>/dev/null
+            end=$(date +%s%N)
+
+            case $ret in
+            0) status=ok ;;
+            137) status=timeout ;;
+            *) status="fail($ret)" ;;
+            esac
+            build=$(sed -n 's/^Build time: \([0-9.]*\) ms.*/\1/p' "$log" | tail -1)
+            eval=$(sed -n 's/^Evaluation time: \([0-9.]*\) ms.*/\1/p' "$log" | tail -1)
+
+            printf "%-10s %8s %-12s %-8s %10s %10s %10d %8d %10d\n" \
+                "$shape" "$size" "$prog" "$status" "${build:--}" "${eval:--}" \
+                $(( (end - start) / 1000000 )) "$procs" "$rss"
+        done
+    done
+done
@@ -0,0 +1,159 @@
+/*
+ * tree-compact.c
+ *
+ * Struct-of-arrays tree in a shared mapping. See tree-compact.h.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "tree-compact.h"
+
+static size_t align8(size_t off) {
+    return (off + 7) & ~(size_t)7;
+}
+
+static int count_nodes(struct tree_node *root) {
+    int i, cnt = 1;
+    for (i = 0; i < root->nr_children; i++)
+        cnt += count_nodes(root->children + i);
+    return cnt;
+}
+
+/*
+ * Loader process: build the pointer tree, lay it out breadth-first into
+ * the file fd and exit. Its heap dies with it.
+ */
+static void compact_tree_build(int fd, const char *filename) {
+    struct tree_node *root, **queue;
+    struct compact_tree *t;
+    int n, i, j, head, tail;
+    size_t off;
+    void *addr;
+
+    root = get_tree_from_file(filename);
+    n = count_nodes(root);
+
+    off = align8(sizeof(struct compact_tree));
+    struct compact_tree hdr = { .nr_nodes = n };
+    hdr.off_first_child = off;
+    off = align8(off + n * sizeof(int));
+    hdr.off_nr_children = off;
+    off = align8(off + n * sizeof(int));
+    hdr.off_size = off;
+    off = align8(off + n * sizeof(int));
+    hdr.off_value = off;
+    off = align8(off + n * sizeof(double));
+    hdr.off_op = off;
+    off = align8(off + n);
+    hdr.off_name = off;
+    off += (size_t)n * NODE_NAME_SIZE;
+    hdr.map_size = off;
+
+    if (ftruncate(fd, hdr.map_size) < 0) {
+        perror("compact_tree_build: ftruncate");
+        exit(1);
+    }
+    addr = mmap(NULL, hdr.map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        perror("compact_tree_build: mmap");
+        exit(1);
+    }
+    t = addr;
+    *t = hdr;
+
+    queue = malloc(n * sizeof(*queue));
+    if (queue == NULL) {
+        fprintf(stderr, "compact_tree_build: out of memory\n");
+        exit(1);
+    }
+
+    // Breadth-first: node i's children get the next free consecutive indices
+    queue[0] = root;
+    for (head = 0, tail = 1; head < tail; head++) {
+        struct tree_node *node = queue[head];
+
+        CT_ARRAY(t, off_first_child, int)[head] = tail;
+        CT_ARRAY(t, off_nr_children, int)[head] = node->nr_children;
+        if (strcmp(node->name, "+") == 0)
+            CT_ARRAY(t, off_op, unsigned char)[head] = TREE_OP_ADD;
+        else if (strcmp(node->name, "*") == 0)
+            CT_ARRAY(t, off_op, unsigned char)[head] = TREE_OP_MUL;
+        else
+            CT_ARRAY(t, off_op, unsigned char)[head] = TREE_OP_NONE;
+        CT_ARRAY(t, off_value, double)[head] = atof(node->name);
+        strncpy(CT_ARRAY(t, off_name, char) + (size_t)head * NODE_NAME_SIZE, node->name, NODE_NAME_SIZE);
+
+        for (j = 0; j < node->nr_children; j++)
+            queue[tail++] = node->children + j;
+    }
+
+    // Children always come after their parent, so sizes can be summed backwards
+    for (i = n - 1; i >= 0; i--) {
+        int size = 1, first = CT_ARRAY(t, off_first_child, int)[i];
+        for (j = 0; j < CT_ARRAY(t, off_nr_children, int)[i]; j++)
+            size += CT_ARRAY(t, off_size, int)[first + j];
+        CT_ARRAY(t, off_size, int)[i] = size;
+    }
+
+    free(queue);
+    if (munmap(addr, hdr.map_size) < 0) {
+        perror("compact_tree_build: munmap");
+        exit(1);
+    }
+    exit(0);
+}
+
+const struct compact_tree *compact_tree_load(const char *filename) {
+    struct stat st;
+    int fd, status;
+    void *addr;
+    pid_t p;
+
+    fd = memfd_create("compact-tree", 0);
+    if (fd < 0) {
+        perror("compact_tree_load: memfd_create");
+        exit(1);
+    }
+
+    fflush(stdout);
+    p = fork();
+    if (p < 0) {
+        perror("compact_tree_load: fork");
+        exit(1);
+    }
+    if (p == 0)
+        compact_tree_build(fd, filename);
+
+    if (waitpid(p, &status, 0) < 0) {
+        perror("compact_tree_load: waitpid");
+        exit(1);
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "compact_tree_load: could not load %s\n", filename);
+        exit(1);
+    }
+
+    if (fstat(fd, &st) < 0) {
+        perror("compact_tree_load: fstat");
+        exit(1);
+    }
+    addr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        perror("compact_tree_load: mmap");
+        exit(1);
+    }
+    close(fd);
+    return addr;
+}
+
+void compact_tree_destroy(const struct compact_tree *t) {
+    if (munmap((void *)t, t->map_size) < 0) {
+        perror("compact_tree_destroy: munmap");
+        exit(1);
+    }
+}
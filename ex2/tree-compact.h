@@ -0,0 +1,76 @@
+/*
+ * tree-compact.h
+ *
+ * A compact, read-only copy of a process tree description.
+ *
+ * get_tree_from_file() builds a pointer-based tree on the heap, and every
+ * process forked from it inherits that heap (and the parser's garbage)
+ * copy-on-write. The compact tree is instead a struct of arrays in a single
+ * MAP_SHARED mapping: nodes are numbered in breadth-first order, so the
+ * children of a node are consecutive and are found through first_child[].
+ *
+ * The file is parsed in a short-lived loader process, so the pointer-based
+ * tree never exists in the process that forks the tree at all.
+ */
+#ifndef TREE_COMPACT_H__
+#define TREE_COMPACT_H__
+
+#include <stddef.h>
+#include "tree.h"
+
+enum tree_op {
+    TREE_OP_NONE = 0,          /* Leaf (or any non-operator name) */
+    TREE_OP_ADD,
+    TREE_OP_MUL
+};
+
+/*
+ * Header at the start of the mapping. The arrays follow it and are located
+ * through byte offsets, since the loader maps the region at another address.
+ */
+struct compact_tree {
+    int nr_nodes;
+    size_t map_size;
+    size_t off_first_child;    /* int[nr_nodes]: index of the first child */
+    size_t off_nr_children;    /* int[nr_nodes] */
+    size_t off_size;           /* int[nr_nodes]: nodes in the subtree */
+    size_t off_op;             /* unsigned char[nr_nodes]: enum tree_op */
+    size_t off_value;          /* double[nr_nodes]: constant of a leaf */
+    size_t off_name;           /* char[nr_nodes][NODE_NAME_SIZE] */
+};
+
+#define CT_ARRAY(t, off, type) ((type *)((char *)(t) + (t)->off))
+
+static inline int ct_first_child(const struct compact_tree *t, int i) {
+    return CT_ARRAY(t, off_first_child, const int)[i];
+}
+
+static inline int ct_nr_children(const struct compact_tree *t, int i) {
+    return CT_ARRAY(t, off_nr_children, const int)[i];
+}
+
+static inline int ct_size(const struct compact_tree *t, int i) {
+    return CT_ARRAY(t, off_size, const int)[i];
+}
+
+static inline enum tree_op ct_op(const struct compact_tree *t, int i) {
+    return CT_ARRAY(t, off_op, const unsigned char)[i];
+}
+
+static inline double ct_value(const struct compact_tree *t, int i) {
+    return CT_ARRAY(t, off_value, const double)[i];
+}
+
+static inline const char *ct_name(const struct compact_tree *t, int i) {
+    return CT_ARRAY(t, off_name, const char) + (size_t)i * NODE_NAME_SIZE;
+}
+
+/*
+ * Parse filename in a loader process and map the compact tree read-only,
+ * shared. Node 0 is the root. Exits on error, like get_tree_from_file().
+ */
+const struct compact_tree *compact_tree_load(const char *filename);
+
+void compact_tree_destroy(const struct compact_tree *t);
+
+#endif /* TREE_COMPACT_H__ */
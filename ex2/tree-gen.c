@@ -0,0 +1,106 @@
+/*
+ * tree-gen.c
+ *
+ * Generates random '+'/'*' expression trees in the format read by
+ * get_tree_from_file(): one line per node, in depth-first order,
+ * "name nr_children child_name ...". Operators are '+' or '*',
+ * leaves are the digits 1-9.
+ *
+ * Shapes:
+ *   balanced:   both subtrees of every operator have the same size (+-1)
+ *   random:     the size of the left subtree is uniformly random
+ *   skewed:     the left subtree gets about 90% of the nodes
+ *   degenerate: every left child is a leaf, i.e. a chain of depth n/2
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct pending {
+    long size;      /* Number of nodes in this subtree (always odd) */
+    char name;      /* Name chosen by the parent when it listed this child */
+};
+
+void *safe_malloc(size_t size) {
+    void *p;
+    if ((p = malloc(size)) == NULL) {
+        fprintf(stderr, "Out of memory, failed to allocate %zu bytes\n", size);
+        exit(1);
+    }
+    return p;
+}
+
+void usage(char *argv0) {
+    fprintf(stderr, "Usage: %s balanced|random|skewed|degenerate nr_nodes [seed]\n\n"
+            "Writes an expression tree of nr_nodes nodes (rounded up to an odd number)\n"
+            "to standard output.\n", argv0);
+    exit(1);
+}
+
+// Number of nodes in the left subtree of an operator with `size` nodes
+long left_size(const char *shape, long size) {
+    long inner = (size - 1) / 2;   /* Operators below this one */
+    long left_inner;
+
+    if (strcmp(shape, "balanced") == 0)
+        left_inner = (inner - 1) / 2;
+    else if (strcmp(shape, "skewed") == 0)
+        left_inner = (inner - 1) * 9 / 10;
+    else if (strcmp(shape, "degenerate") == 0)
+        left_inner = 0;
+    else
+        left_inner = (long)(drand48() * inner);
+
+    return 2 * left_inner + 1;
+}
+
+char node_name(long size) {
+    if (size == 1)
+        return '1' + lrand48() % 9;
+    return (lrand48() % 2) ? '+' : '*';
+}
+
+int main(int argc, char *argv[]) {
+    struct pending *stack, cur;
+    long nr_nodes, top = 0, l, r;
+    char *endp;
+
+    if (argc != 3 && argc != 4)
+        usage(argv[0]);
+    if (strcmp(argv[1], "balanced") != 0 && strcmp(argv[1], "random") != 0 &&
+        strcmp(argv[1], "skewed") != 0 && strcmp(argv[1], "degenerate") != 0)
+        usage(argv[0]);
+    nr_nodes = strtol(argv[2], &endp, 10);
+    if (*endp != '\0' || nr_nodes <= 0)
+        usage(argv[0]);
+    if (nr_nodes % 2 == 0)
+        nr_nodes++;
+    srand48(argc == 4 ? atol(argv[3]) : 1);
+
+    // Depth-first with an explicit stack: degenerate trees are too deep to recurse
+    stack = safe_malloc((nr_nodes / 2 + 2) * sizeof(*stack));
+    stack[top].size = nr_nodes;
+    stack[top].name = node_name(nr_nodes);
+    top++;
+
+    while (top > 0) {
+        cur = stack[--top];
+        if (cur.size == 1) {
+            printf("%c 0\n", cur.name);
+            continue;
+        }
+        l = left_size(argv[1], cur.size);
+        r = cur.size - 1 - l;
+
+        // Right child below the left one, so the left subtree is printed first
+        stack[top].size = r;
+        stack[top].name = node_name(r);
+        stack[top + 1].size = l;
+        stack[top + 1].name = node_name(l);
+        printf("%c 2 %c %c\n", cur.name, stack[top + 1].name, stack[top].name);
+        top += 2;
+    }
+
+    free(stack);
+    return 0;
+}
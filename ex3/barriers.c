@@ -0,0 +1,141 @@
+/*
+ * barriers.c
+ *
+ * Spinning barriers for simplesync. See barriers.h.
+ */
+#define _GNU_SOURCE
+#include <sched.h>
+#include "barriers.h"
+
+static inline void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+/* Spin until *flag == val */
+static void spin_until(atomic_int *flag, int val) {
+    unsigned spins = 0;
+
+    while (atomic_load_explicit(flag, memory_order_acquire) != val) {
+        if (++spins % BARRIER_YIELD_EVERY == 0)
+            sched_yield();
+        else
+            cpu_relax();
+    }
+}
+
+static int nr_rounds(int n) {
+    int rounds = 0;
+
+    while ((1 << rounds) < n)
+        rounds++;
+    return rounds;
+}
+
+void barrier_local_init(struct barrier_local *me, int id) {
+    me->id = id;
+    me->sense = 1;
+    me->parity = 0;
+}
+
+/*
+ * Centralized sense-reversing barrier
+ */
+void central_barrier_init(struct central_barrier *b, int n) {
+    atomic_init(&b->count, n);
+    atomic_init(&b->sense, 0);
+    b->n = n;
+}
+
+void central_barrier_wait(struct central_barrier *b, struct barrier_local *me) {
+    if (atomic_fetch_sub_explicit(&b->count, 1, memory_order_acq_rel) == 1) {
+        // Last to arrive: reset for the next episode before releasing everybody
+        atomic_store_explicit(&b->count, b->n, memory_order_relaxed);
+        atomic_store_explicit(&b->sense, me->sense, memory_order_release);
+    } else {
+        spin_until(&b->sense, me->sense);
+    }
+    me->sense = !me->sense;
+}
+
+/*
+ * Dissemination barrier (Hensgen, Finkel and Manber). Flags alternate
+ * between two sets (parity), and the sense flips every second episode,
+ * so no flag ever has to be reset.
+ */
+size_t dissemination_barrier_size(int n) {
+    return sizeof(struct dissemination_barrier) + n * sizeof(struct dissemination_node);
+}
+
+void dissemination_barrier_init(struct dissemination_barrier *b, int n) {
+    int i, r;
+
+    b->n = n;
+    b->rounds = nr_rounds(n);
+    for (i = 0; i < n; i++)
+        for (r = 0; r < BARRIER_MAX_ROUNDS; r++) {
+            atomic_init(&b->node[i].flag[0][r], 0);
+            atomic_init(&b->node[i].flag[1][r], 0);
+        }
+}
+
+void dissemination_barrier_wait(struct dissemination_barrier *b, struct barrier_local *me) {
+    int r, partner;
+
+    for (r = 0; r < b->rounds; r++) {
+        partner = (me->id + (1 << r)) % b->n;
+        atomic_store_explicit(&b->node[partner].flag[me->parity][r], me->sense, memory_order_release);
+        spin_until(&b->node[me->id].flag[me->parity][r], me->sense);
+    }
+    if (me->parity == 1)
+        me->sense = !me->sense;
+    me->parity = 1 - me->parity;
+}
+
+/*
+ * Tournament barrier with tree wakeup. In round k the participant whose
+ * id has the k lowest bits clear and bit k set loses to id - 2^k; the
+ * winners go on to round k + 1, participant 0 wins the tournament.
+ */
+size_t tournament_barrier_size(int n) {
+    return sizeof(struct tournament_barrier) + n * sizeof(struct tournament_node);
+}
+
+void tournament_barrier_init(struct tournament_barrier *b, int n) {
+    int i, r;
+
+    b->n = n;
+    b->rounds = nr_rounds(n);
+    for (i = 0; i < n; i++) {
+        for (r = 0; r < BARRIER_MAX_ROUNDS; r++)
+            atomic_init(&b->node[i].arrive[r], 0);
+        atomic_init(&b->node[i].release, 0);
+    }
+}
+
+void tournament_barrier_wait(struct tournament_barrier *b, struct barrier_local *me) {
+    int k, opponent, id = me->id;
+
+    // Arrival: win until we lose (or win it all)
+    for (k = 0; k < b->rounds; k++) {
+        if (id & (1 << k)) {
+            atomic_store_explicit(&b->node[id - (1 << k)].arrive[k], me->sense, memory_order_release);
+            spin_until(&b->node[id].release, me->sense);
+            break;
+        }
+        opponent = id + (1 << k);
+        if (opponent < b->n)
+            spin_until(&b->node[id].arrive[k], me->sense);
+    }
+
+    // Wakeup: release everybody we beat, latest round first
+    while (--k >= 0) {
+        opponent = id + (1 << k);
+        if (opponent < b->n)
+            atomic_store_explicit(&b->node[opponent].release, me->sense, memory_order_release);
+    }
+    me->sense = !me->sense;
+}
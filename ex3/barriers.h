@@ -0,0 +1,77 @@
+/*
+ * barriers.h
+ *
+ * Spinning barriers, to compare against pthread_barrier_t in simplesync:
+ *
+ *   central_barrier:        one shared counter, the last one to arrive
+ *                           resets it and flips a shared sense flag
+ *   dissemination_barrier:  ceil(log2 n) rounds, in round r participant i
+ *                           signals (i + 2^r) mod n and waits for its own flag
+ *   tournament_barrier:     pairwise matches up a binary tree, losers wait
+ *                           on their own flag, the champion wakes the
+ *                           participants it beat, who wake theirs, and so on
+ *
+ * None of them contains pointers, so they work between processes as well
+ * when placed in a MAP_SHARED mapping before fork(). The dissemination and
+ * tournament barriers have one flag node per participant; allocate them with
+ * their *_size(n) and initialize them in place.
+ *
+ * Every participant keeps a struct barrier_local of its own.
+ */
+#ifndef BARRIERS_H__
+#define BARRIERS_H__
+
+#include <stddef.h>
+#include <stdatomic.h>
+
+#define CACHE_LINE_SIZE 64
+#define BARRIER_MAX_ROUNDS 16    /* Up to 65536 participants */
+
+/* Spinning participants yield every BARRIER_YIELD_EVERY checks */
+#define BARRIER_YIELD_EVERY 16
+
+struct barrier_local {
+    int id;          /* 0 .. n - 1 */
+    int sense;
+    int parity;      /* Dissemination only */
+};
+
+struct central_barrier {
+    atomic_int count __attribute__((aligned(CACHE_LINE_SIZE)));
+    atomic_int sense __attribute__((aligned(CACHE_LINE_SIZE)));
+    int n;
+};
+
+struct dissemination_node {
+    atomic_int flag[2][BARRIER_MAX_ROUNDS];
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+struct dissemination_barrier {
+    int n, rounds;
+    struct dissemination_node node[];
+};
+
+struct tournament_node {
+    atomic_int arrive[BARRIER_MAX_ROUNDS];   /* Set by the loser of round k */
+    atomic_int release;                      /* Set by whoever beat us */
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+struct tournament_barrier {
+    int n, rounds;
+    struct tournament_node node[];
+};
+
+void barrier_local_init(struct barrier_local *me, int id);
+
+void central_barrier_init(struct central_barrier *b, int n);
+void central_barrier_wait(struct central_barrier *b, struct barrier_local *me);
+
+size_t dissemination_barrier_size(int n);
+void dissemination_barrier_init(struct dissemination_barrier *b, int n);
+void dissemination_barrier_wait(struct dissemination_barrier *b, struct barrier_local *me);
+
+size_t tournament_barrier_size(int n);
+void tournament_barrier_init(struct tournament_barrier *b, int n);
+void tournament_barrier_wait(struct tournament_barrier *b, struct barrier_local *me);
+
+#endif /* BARRIERS_H__ */
@@ -6,6 +6,10 @@
 * mandel.c
 *
 * A program to draw the Mandelbrot Set on a 256-color xterm. *
+*
+* Build: gcc -Wall -O2 -pthread -o mandel-condvar ex3-mandel-condition-variavles.c
+*        mandel-sched.c mandel-reorder.c mandel-simd.c mandel-output.c
+*        perfctr.c mandel-lib.o -lm
 */
 // CONDITION VARIABLES
 #include <errno.h>
@@ -18,7 +22,13 @@
 #include <math.h>
 #include <stdlib.h>
 #include <semaphore.h>
+#include <time.h>
 #include "mandel-lib.h"
+#include "mandel-sched.h"
+#include "mandel-reorder.h"
+#include "perfctr.h"
+#include "mandel-simd.h"
+#include "mandel-output.h"
 #define MANDEL_MAX_ITERATION 100000
 
 /*************************** * Compile-time parameters * ***************************/
@@ -45,7 +55,7 @@ double ystep;
 // Create the mutex
 pthread_mutex_t mutex; 
 pthread_cond_t condition; 
-int count = 0;
+int count = 0; // The next line to be printed
 
 // FROM phthread-test.c
 /*
@@ -63,8 +73,30 @@ struct thread_info_struct {
     pthread_t tid; /* POSIX thread id, as returned by the library */
     int thrid; /* Application-defined thread id */
     int thrcnt;
+    int rows;    /* Rows this thread computed */
+    double busy; /* CPU seconds spent computing them */
 };
 
+// Rows are handed out according to the policy chosen with -s (mandel-sched.h)
+struct row_sched sched;
+
+// With -r, finished rows go to a writer thread through this ring (mandel-reorder.h)
+int reorder_slots = 0;
+struct reorder_ring ring;
+
+double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// CPU time of the calling thread: busy time is not inflated by preemption
+double thread_cpu(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
 int safe_atoi(char *s, int *val) {
     long l;
     char *endp;
@@ -79,17 +111,20 @@ int safe_atoi(char *s, int *val) {
 void *safe_malloc(size_t size) {
     void *p;
     if ((p = malloc(size)) == NULL) {
-        fprintf(stderr, "Out of memory, failed to allocate %zd bytes\n", size);
+        fprintf(stderr, "Out of memory, failed to allocate %zu bytes\n", size);
         exit(1);
     }
     return p;
 }
 
 void usage(char *argv0) {
-    fprintf(stderr, "Usage: %s thread_count array_size\n\n" 
-            "Exactly two arguments required:\n"
+    fprintf(stderr, "Usage: %s [-s static|chunked|guided|atomic] [-k chunk] [-r slots] thread_count\n\n"
             " thread_count: The number of threads to create.\n"
-            " array_size: The size of the array to run with.\n", argv0);
+            " -s: how rows are handed out to the threads (default: static, row i\n"
+            "     goes to thread i mod thread_count)\n"
+            " -k: rows per claim for chunked (default: 4), minimum for guided (default: 1)\n"
+            " -r: print through a writer thread and a reorder ring of this many rows,\n"
+            "     so that computing threads only wait for output when the ring is full\n", argv0);
     exit(1);
 }
 
@@ -98,25 +133,23 @@ void usage(char *argv0) {
 */
 void compute_mandel_line(int line, int color_val[]) {
     /*
-    * x and y traverse the complex plane.
+    * y traverses the complex plane, x is handled by the line kernel.
     */
-    double x, y;
+    double y;
     int n;
     int val;
-    
+
     /* Find out the y value corresponding to this line */
     y = ymax - ystep * line;
 
-    /* and iterate for all points on this line */
-    for (x = xmin, n = 0; n < x_chars; x += xstep, n++) {
-        /* Compute the point's color value */
-        val = mandel_iterations_at_point(x, y, MANDEL_MAX_ITERATION);
+    /* and iterate for all points on this line, several at once (mandel-simd.h) */
+    mandel_line_iterations(xmin, xstep, y, x_chars, MANDEL_MAX_ITERATION, color_val);
+    for (n = 0; n < x_chars; n++) {
+        /* Turn the point's iteration count into its color value */
+        val = color_val[n];
         if (val > 255)
             val = 255;
-
-        /* And store it in the color_val[] array */
-        val = xterm_color(val);
-        color_val[n] = val;
+        color_val[n] = xterm_color(val);
     }
 }
 
@@ -124,24 +157,10 @@ void compute_mandel_line(int line, int color_val[]) {
 * This function outputs an array of x_char color values to a 256-color xterm.
 */
 void output_mandel_line(int fd, int color_val[]) {
-    int i;
-    char point = '@';
-    char newline = '\n';
-    
-    for (i = 0; i < x_chars; i++) {
-        /* Set the current color, then output the point */
-        set_xterm_color(fd, color_val[i]);
-        if (write(fd, &point, 1) != 1) {
-            perror("compute_and_output_mandel_line: write point");
-            exit(1);
-        }
-    }
+    char buf[MANDEL_LINE_BYTES(x_chars)];
 
-    /* Now that the line is done, output a newline character */
-    if (write(fd, &newline, 1) != 1) {
-        perror("compute_and_output_mandel_line: write newline");
-        exit(1);
-    }
+    /* Encode the whole line, color escapes only where the color changes, and write it at once */
+    mandel_write_all(fd, buf, mandel_encode_line(buf, color_val, x_chars));
 }
 
 /*
@@ -154,31 +173,49 @@ void* compute_and_output_mandel_line(void *arg) {
     int color_val[x_chars]; 
     struct thread_info_struct *thr = arg;
     int i;
-
-    // Each thread takes care of the lines i, i + n, i + 2×n, i + 3×n,... where n=thrcnt=the number of threads
-    for (i = thr->thrid; i < y_chars; i += thr->thrcnt) {
+    char label[32];
+    double t0;
+    struct row_cursor cur;
+    // Counters with PERFCTR set in the environment, NULL (and no-ops) otherwise
+    struct perfctr *perf = perfctr_start();
+
+    // With the static schedule each thread takes care of the lines i, i + n, i + 2×n, i + 3×n,...
+    // where n=thrcnt=the number of threads, the other schedules hand out lines as threads get free
+    row_cursor_init(&cur, thr->thrid);
+    while ((i = row_sched_next(&sched, &cur)) >= 0) {
         // All threads can do the compute operation in parallel, but the output must be done sequentially,
         // so we identify the critical part of the code as output_mandel_line(1, color_val);
+        t0 = thread_cpu();
         compute_mandel_line(i, color_val);
+        thr->busy += thread_cpu() - t0;
+        thr->rows++;
+        perfctr_phase(perf, "compute");
+
+        if (reorder_slots) {
+            // The writer thread prints it when its turn comes
+            reorder_put(&ring, i, color_val);
+            perfctr_phase(perf, "handoff");
+            continue;
+        }
+
 
         // All threads arrive here, and only one will enter
         pthread_mutex_lock(&mutex);
 
         // We use the count variable so that the threads enter the output_mandel_line in order and correctly,
         // ensuring that the lines are printed in the correct sequence
-        // The thread whose thrid is equal to count is the one that proceeds to print the line
+        // The thread holding line number count is the one that proceeds to print the line
         // to avoid printing a line before another one.
-        while (count != thr->thrid) {
+        while (count != i) {
             // Threads that are not their turn to print will wait (giving the lock key to the next thread)
             // until the condition is met, practically meaning until the thread that is to print wakes them up.
             pthread_cond_wait(&condition, &mutex);
         }
         output_mandel_line(1, color_val);
 
-        // Increment the count so we know which thread will print next, and thus, which lines will be printed.
-        // We need the mod operation because the count should go from 0 to thrid of the last thread,
-        // and after the last thread prints its line, we go back to the first thread and repeat the process.
-        count = (count + 1) % thr->thrcnt;
+        // Increment the count so we know which line will be printed next
+        // (and thus, under the static schedule, which thread prints next).
+        count++;
 
         // Since we have cond_broadcast, this wakes up all threads waiting in the while loop. Then, the count has
         // changed, so all threads check if the while condition is met. For those that still meet the condition,
@@ -187,25 +224,62 @@ void* compute_and_output_mandel_line(void *arg) {
 
         // Unlock because we have completed the critical section of code
         pthread_mutex_unlock(&mutex);
+        perfctr_phase(perf, "wait+output");
     }
 
+    snprintf(label, sizeof(label), "thread %d", thr->thrid);
+    perfctr_stop(perf, label);
     return NULL;
 }
 
+/*
+* Per-thread load, on stderr so that the picture stays intact
+*/
+void report_busy(struct thread_info_struct *thr, int thrcnt, double wall) {
+    double max = 0, sum = 0;
+    int i;
+
+    for (i = 0; i < thrcnt; i++) {
+        fprintf(stderr, "thread %d: %d rows, busy %.3f ms\n", i, thr[i].rows, thr[i].busy * 1e3);
+        sum += thr[i].busy;
+        if (thr[i].busy > max)
+            max = thr[i].busy;
+    }
+    // max/mean is 1 for a perfect balance, and thrcnt if one thread did everything
+    fprintf(stderr, "%s schedule: wall %.3f ms, busy max/mean %.2f\n",
+            row_policy_names[sched.policy], wall * 1e3, sum > 0 ? max / (sum / thrcnt) : 0);
+}
+
 int main(int argc, char *argv[]) {
-    int i, thrcnt, ret;
+    int i, thrcnt, ret, opt, policy = ROW_STATIC, chunk = 0;
     struct thread_info_struct *thr;
+    double start;
 
     /*
     * Parse the command line
     */
-    if (argc != 2) usage(argv[0]);
+    while ((opt = getopt(argc, argv, "s:k:r:")) != -1) {
+        if (opt == 's') {
+            if ((policy = row_policy_parse(optarg)) < 0)
+                usage(argv[0]);
+        } else if (opt == 'k') {
+            if (safe_atoi(optarg, &chunk) < 0 || chunk <= 0)
+                usage(argv[0]);
+        } else if (opt == 'r') {
+            if (safe_atoi(optarg, &reorder_slots) < 0 || reorder_slots <= 0)
+                usage(argv[0]);
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (argc - optind != 1) usage(argv[0]);
 
     // thrcnt = the number of threads passed as input
-    if (safe_atoi(argv[1], &thrcnt) < 0 || thrcnt <= 0) {
-        fprintf(stderr, "`%s' is not valid for `thread_count'\n", argv[1]);
+    if (safe_atoi(argv[optind], &thrcnt) < 0 || thrcnt <= 0) {
+        fprintf(stderr, "`%s' is not valid for `thread_count'\n", argv[optind]);
         exit(1);
     }
+    row_sched_init(&sched, policy, y_chars, thrcnt, chunk);
 
     // Create an array of objects (structs) where each entry stores the information for the corresponding thread
     thr = safe_malloc(thrcnt * sizeof(*thr));
@@ -217,7 +291,13 @@ int main(int argc, char *argv[]) {
         /* Initialize per-thread structure */
         thr[i].thrid = i;
         thr[i].thrcnt = thrcnt;
-
+        thr[i].rows = 0;
+        thr[i].busy = 0;
+    }
+    start = now();
+    if (reorder_slots)
+        reorder_start(&ring, reorder_slots, x_chars, y_chars, output_mandel_line, 1);
+    for (i = 0; i < thrcnt; i++) {
         /* Spawn new thread */
         ret = pthread_create(&thr[i].tid, NULL, compute_and_output_mandel_line, &thr[i]);
         if (ret) {
@@ -235,10 +315,18 @@ int main(int argc, char *argv[]) {
         }
     }
 
+    // Every row has been handed over, let the writer print the rest
+    if (reorder_slots)
+        reorder_finish(&ring);
+
     // Destroy the mutex and condition since we are done and no longer need them
     pthread_mutex_destroy(&mutex); 
     pthread_cond_destroy(&condition);
 
     reset_xterm_color(1);
+    report_busy(thr, thrcnt, now() - start);
+    if (reorder_slots)
+        fprintf(stderr, "reorder ring: %d rows, computing threads found it full %ld times\n",
+                reorder_slots, ring.full_waits);
     return 0;
 }
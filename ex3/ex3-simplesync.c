@@ -4,49 +4,257 @@
 * Vangelis Koukis <vkoukis@cslab.ece.ntua.gr>
 * Operating Systems course, ECE, NTUA *
 */
+/*
+* Extended into a small benchmark suite for synchronization primitives.
+* Half of the threads run increase_fn(), the other half decrease_fn(), each
+* for a configurable number of operations on one shared counter. All threads
+* start together at a barrier and time themselves, so we get ops/sec per
+* thread and in total, for every mode and every thread count asked for.
+*
+* With -w readmostly the counter is replaced by the read-mostly workload of
+* simplesync-readmostly.c (rwlock, seqlock, rcu), with -w queue by the
+* producer/consumer queues of simplesync-queue.c, with -w barrier by the
+* barrier episodes of simplesync-barrier.c, see there.
+*
+* Build: gcc -Wall -O2 -pthread [-DSYNC_<MODE>] -o simplesync ex3-simplesync.c
+*        simplesync-readmostly.c simplesync-queue.c simplesync-barrier.c
+*        locks.c barriers.c perfctr.c
+* Run with PERFCTR=1 in the environment for per-thread hardware/software
+* counters of the counter workload (see perfctr.h).
+* The SYNC_* define (SYNC_MUTEX, SYNC_ATOMIC, SYNC_SPIN, SYNC_FUTEX, SYNC_TICKET,
+* SYNC_MCS, SYNC_CLH or SYNC_ADAPTIVE) only picks the default mode, -m overrides
+* it at runtime.
+*/
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <time.h>
 #include <pthread.h>
-
-/*
-* POSIX thread functions do not return error numbers in errno,
-* but in the actual return value of the function call instead.
-* This macro helps with error reporting in this case.
-*/
-#define perror_pthread(ret, msg) \
-do { errno = ret; perror(msg); } while (0)
+#include <stdatomic.h>
+#include "locks.h"
+#include "simplesync.h"
+#include "perfctr.h"
 
 #define N 10000000
 
 /* Dots indicate lines where you are free to insert code at will */
-pthread_mutex_t mutex;  // Mutex for synchronization
+pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;  // Mutex for synchronization
+pthread_spinlock_t spinlock;                         // Spinlock for the "spin" mode
+struct futex_mutex futex_mutex;                      // Locks from locks.h, one per mode
+struct ticket_lock ticket;
+struct mcs_lock mcs;
+struct clh_lock clh;
+struct adaptive_lock adaptive;
 
 /* ... */
 
-#if defined(SYNC_ATOMIC) ^ defined(SYNC_MUTEX) == 0
-# error You must #define exactly one of SYNC_ATOMIC or SYNC_MUTEX.
+#if defined(SYNC_ATOMIC) + defined(SYNC_MUTEX) + defined(SYNC_SPIN) + defined(SYNC_FUTEX) + \
+    defined(SYNC_TICKET) + defined(SYNC_MCS) + defined(SYNC_CLH) + defined(SYNC_ADAPTIVE) > 1
+# error You must #define at most one SYNC_* mode.
 #endif
 
+/*
+* The synchronization modes. The C11 modes all do atomic_fetch_add/sub,
+* each with a different memory order.
+*/
+enum sync_mode {
+    MODE_MUTEX,
+    MODE_SPIN,
+    MODE_ATOMIC,
+    MODE_C11_RELAXED,
+    MODE_C11_ACQUIRE,
+    MODE_C11_RELEASE,
+    MODE_C11_ACQ_REL,
+    MODE_C11_SEQ_CST,
+    MODE_SHARDED,
+    MODE_SHARDED_UNPADDED,
+    MODE_FUTEX,
+    MODE_TICKET,
+    MODE_MCS,
+    MODE_CLH,
+    MODE_ADAPTIVE,
+    NR_MODES
+};
+
+const char *mode_names[NR_MODES] = {
+    [MODE_MUTEX] = "mutex",
+    [MODE_SPIN] = "spin",
+    [MODE_ATOMIC] = "atomic",
+    [MODE_C11_RELAXED] = "c11-relaxed",
+    [MODE_C11_ACQUIRE] = "c11-acquire",
+    [MODE_C11_RELEASE] = "c11-release",
+    [MODE_C11_ACQ_REL] = "c11-acq_rel",
+    [MODE_C11_SEQ_CST] = "c11-seq_cst",
+    [MODE_SHARDED] = "sharded",
+    [MODE_SHARDED_UNPADDED] = "sharded-unpad",
+    [MODE_FUTEX] = "futex",
+    [MODE_TICKET] = "ticket",
+    [MODE_MCS] = "mcs",
+    [MODE_CLH] = "clh",
+    [MODE_ADAPTIVE] = "adaptive",
+};
+
 #if defined(SYNC_ATOMIC)
-# define USE_ATOMIC_OPS 1
+# define DEFAULT_MODE MODE_ATOMIC
+#elif defined(SYNC_SPIN)
+# define DEFAULT_MODE MODE_SPIN
+#elif defined(SYNC_FUTEX)
+# define DEFAULT_MODE MODE_FUTEX
+#elif defined(SYNC_TICKET)
+# define DEFAULT_MODE MODE_TICKET
+#elif defined(SYNC_MCS)
+# define DEFAULT_MODE MODE_MCS
+#elif defined(SYNC_CLH)
+# define DEFAULT_MODE MODE_CLH
+#elif defined(SYNC_ADAPTIVE)
+# define DEFAULT_MODE MODE_ADAPTIVE
 #else
-# define USE_ATOMIC_OPS 0
+# define DEFAULT_MODE MODE_MUTEX
 #endif
 
-void *increase_fn(void *arg) {
+/*
+* The shared counter: a plain int for the lock-based and __sync modes,
+* an _Atomic int for the C11 modes.
+*
+* The sharded modes give every thread its own slot instead, so no two cores
+* write to the same location; the value of the counter is the sum of the
+* slots. In "sharded" every slot is alone in a shard_pad-byte line, in
+* "sharded-unpad" the slots are packed next to each other, so neighbouring
+* threads still fight over the same cache line (false sharing).
+*/
+struct counter {
+    volatile int val;
+    atomic_int aval;
+    char *shards;          /* thrcnt slots of type atomic_long */
+    size_t shard_stride;   /* Distance between two slots, in bytes */
+};
+
+size_t shard_pad = 64;     /* Cache-line size to pad slots to (-P) */
+long shard_batch = 1;      /* Operations batched locally before a flush (-k) */
+
+atomic_long *shard_slot(struct counter *cnt, int thrid) {
+    return (atomic_long *)(cnt->shards + thrid * cnt->shard_stride);
+}
+
+/*
+* Only the owner writes a slot, so a plain load/store pair is enough;
+* they are atomic only so that a concurrent reader never sees a torn value.
+*/
+void shard_flush(atomic_long *slot, long delta) {
+    atomic_store_explicit(slot, atomic_load_explicit(slot, memory_order_relaxed) + delta,
+                          memory_order_relaxed);
+}
+
+void sharded_ops(struct counter *cnt, int thrid, long nr_ops, int delta) {
+    atomic_long *slot = shard_slot(cnt, thrid);
+    long i, local = 0, pending = 0;
+
+    for (i = 0; i < nr_ops; i++) {
+        local += delta;
+        if (++pending == shard_batch) {
+            shard_flush(slot, local);
+            local = 0;
+            pending = 0;
+        }
+    }
+    if (pending)
+        shard_flush(slot, local);
+}
+
+/*
+* Aggregated read: the sum of all slots. May run concurrently with writers.
+*/
+long sharded_read(struct counter *cnt, int thrcnt) {
+    long sum = 0;
     int i;
-    volatile int *ip = arg;
-    fprintf(stderr, "About to increase variable %d times\n", N);
+    for (i = 0; i < thrcnt; i++)
+        sum += atomic_load_explicit(shard_slot(cnt, i), memory_order_relaxed);
+    return sum;
+}
 
-    for (i = 0; i < N; i++) {
-        if (USE_ATOMIC_OPS) {
-            /* ... */
-            /* You can modify the following line */
-            __sync_add_and_fetch(ip, 1);
-            /* ... */
-        } else {
+/*
+* A (distinct) instance of this structure is passed to each thread
+*/
+struct thread_info_struct {
+    pthread_t tid;       /* POSIX thread id, as returned by the library */
+    int thrid;           /* Application-defined thread id */
+    enum sync_mode mode;
+    long nr_ops;
+    struct counter *cnt;
+    double start, end;   /* Seconds, taken right after the start barrier and at the end */
+    struct mcs_node mcs_node;     /* This thread's queue node for the MCS lock */
+    struct clh_thread clh_thread; /* This thread's queue node for the CLH lock */
+    struct perfctr *perf;         /* Counters of this thread with PERFCTR set, else NULL */
+};
+
+pthread_barrier_t start_barrier;
+int verbose = 0;
+
+double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+unsigned long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void barrier_wait(pthread_barrier_t *b) {
+    int ret = pthread_barrier_wait(b);
+    if (ret && ret != PTHREAD_BARRIER_SERIAL_THREAD) {
+        perror_pthread(ret, "pthread_barrier_wait");
+        exit(1);
+    }
+}
+
+void *safe_malloc(size_t size) {
+    void *p;
+
+    if ((p = malloc(size)) == NULL) {
+        fprintf(stderr, "Out of memory, failed to allocate %zu bytes\n", size);
+        exit(1);
+    }
+    return p;
+}
+
+/*
+* Wait for every thread to be ready, then start the clock
+*/
+void thread_start(struct thread_info_struct *thr) {
+    barrier_wait(&start_barrier);
+    thr->perf = perfctr_start();
+    thr->start = now();
+}
+
+/*
+* Stop the clock, and report this thread's counters if they are on
+*/
+void thread_end(struct thread_info_struct *thr) {
+    char label[32];
+
+    thr->end = now();
+    perfctr_phase(thr->perf, mode_names[thr->mode]);
+    snprintf(label, sizeof(label), "thread %d", thr->thrid);
+    perfctr_stop(thr->perf, label);
+}
+
+void *increase_fn(void *arg) {
+    long i;
+    struct thread_info_struct *thr = arg;
+    volatile int *ip = &thr->cnt->val;
+    atomic_int *ap = &thr->cnt->aval;
+    if (verbose)
+        fprintf(stderr, "About to increase variable %ld times\n", thr->nr_ops);
+
+    thread_start(thr);
+    switch (thr->mode) {
+    case MODE_MUTEX:
+        for (i = 0; i < thr->nr_ops; i++) {
             /* ... */
             pthread_mutex_lock(&mutex);
             /* You cannot modify the following line */
@@ -54,85 +262,533 @@ void *increase_fn(void *arg) {
             pthread_mutex_unlock(&mutex);
             /* ... */
         }
+        break;
+    case MODE_SPIN:
+        for (i = 0; i < thr->nr_ops; i++) {
+            pthread_spin_lock(&spinlock);
+            ++(*ip);
+            pthread_spin_unlock(&spinlock);
+        }
+        break;
+    case MODE_ATOMIC:
+        for (i = 0; i < thr->nr_ops; i++) {
+            /* ... */
+            /* You can modify the following line */
+            __sync_add_and_fetch(ip, 1);
+            /* ... */
+        }
+        break;
+    case MODE_C11_RELAXED:
+        for (i = 0; i < thr->nr_ops; i++)
+            atomic_fetch_add_explicit(ap, 1, memory_order_relaxed);
+        break;
+    case MODE_C11_ACQUIRE:
+        for (i = 0; i < thr->nr_ops; i++)
+            atomic_fetch_add_explicit(ap, 1, memory_order_acquire);
+        break;
+    case MODE_C11_RELEASE:
+        for (i = 0; i < thr->nr_ops; i++)
+            atomic_fetch_add_explicit(ap, 1, memory_order_release);
+        break;
+    case MODE_C11_ACQ_REL:
+        for (i = 0; i < thr->nr_ops; i++)
+            atomic_fetch_add_explicit(ap, 1, memory_order_acq_rel);
+        break;
+    case MODE_C11_SEQ_CST:
+        for (i = 0; i < thr->nr_ops; i++)
+            atomic_fetch_add_explicit(ap, 1, memory_order_seq_cst);
+        break;
+    case MODE_SHARDED:
+    case MODE_SHARDED_UNPADDED:
+        sharded_ops(thr->cnt, thr->thrid, thr->nr_ops, 1);
+        break;
+    case MODE_FUTEX:
+        for (i = 0; i < thr->nr_ops; i++) {
+            futex_mutex_lock(&futex_mutex);
+            ++(*ip);
+            futex_mutex_unlock(&futex_mutex);
+        }
+        break;
+    case MODE_TICKET:
+        for (i = 0; i < thr->nr_ops; i++) {
+            ticket_lock(&ticket);
+            ++(*ip);
+            ticket_unlock(&ticket);
+        }
+        break;
+    case MODE_MCS:
+        for (i = 0; i < thr->nr_ops; i++) {
+            mcs_lock(&mcs, &thr->mcs_node);
+            ++(*ip);
+            mcs_unlock(&mcs, &thr->mcs_node);
+        }
+        break;
+    case MODE_CLH:
+        for (i = 0; i < thr->nr_ops; i++) {
+            clh_lock(&clh, &thr->clh_thread);
+            ++(*ip);
+            clh_unlock(&clh, &thr->clh_thread);
+        }
+        break;
+    case MODE_ADAPTIVE:
+        for (i = 0; i < thr->nr_ops; i++) {
+            adaptive_lock(&adaptive);
+            ++(*ip);
+            adaptive_unlock(&adaptive);
+        }
+        break;
+    default:
+        break;
     }
+    thread_end(thr);
 
-    fprintf(stderr, "Done increasing variable.\n");
+    if (verbose)
+        fprintf(stderr, "Done increasing variable.\n");
     return NULL;
 }
 
 void *decrease_fn(void *arg) {
-    int i;
-    volatile int *ip = arg;
-    fprintf(stderr, "About to decrease variable %d times\n", N);
+    long i;
+    struct thread_info_struct *thr = arg;
+    volatile int *ip = &thr->cnt->val;
+    atomic_int *ap = &thr->cnt->aval;
+    if (verbose)
+        fprintf(stderr, "About to decrease variable %ld times\n", thr->nr_ops);
 
-    for (i = 0; i < N; i++) {
-        if (USE_ATOMIC_OPS) {
+    thread_start(thr);
+    switch (thr->mode) {
+    case MODE_MUTEX:
+        for (i = 0; i < thr->nr_ops; i++) {
+            /* ... */
+            pthread_mutex_lock(&mutex);
+            /* You cannot modify the following line */
+            --(*ip);
+            pthread_mutex_unlock(&mutex);
+            /* ... */
+        }
+        break;
+    case MODE_SPIN:
+        for (i = 0; i < thr->nr_ops; i++) {
+            pthread_spin_lock(&spinlock);
+            --(*ip);
+            pthread_spin_unlock(&spinlock);
+        }
+        break;
+    case MODE_ATOMIC:
+        for (i = 0; i < thr->nr_ops; i++) {
             /* ... */
             /* You can modify the following line */
             // The argument ip is the address of the variable we want to change, i.e., ip is the address of val.
-            // To avoid confusion with the ip, we could use val as a global variable and write more simply:
-            // __sync_sub_and_fetch(&val, 1); and similarly for the other one __sync_add_and_fetch(&val, 1);
             // We write __sync_sub_and_fetch(ip, 1); because ip holds the address of val, whereas &ip
             // is the address of the pointer. We want to change the value of val, not its address.
             // Thus, we want to change the value at the address pointed to by ip (i.e., the "content" of ip),
             // which is why we use ip directly.
+            __sync_sub_and_fetch(ip, 1);
             /* ... */
-        } else {
-            /* ... */
-            pthread_mutex_lock(&mutex);
-            /* You cannot modify the following line */
+        }
+        break;
+    case MODE_C11_RELAXED:
+        for (i = 0; i < thr->nr_ops; i++)
+            atomic_fetch_sub_explicit(ap, 1, memory_order_relaxed);
+        break;
+    case MODE_C11_ACQUIRE:
+        for (i = 0; i < thr->nr_ops; i++)
+            atomic_fetch_sub_explicit(ap, 1, memory_order_acquire);
+        break;
+    case MODE_C11_RELEASE:
+        for (i = 0; i < thr->nr_ops; i++)
+            atomic_fetch_sub_explicit(ap, 1, memory_order_release);
+        break;
+    case MODE_C11_ACQ_REL:
+        for (i = 0; i < thr->nr_ops; i++)
+            atomic_fetch_sub_explicit(ap, 1, memory_order_acq_rel);
+        break;
+    case MODE_C11_SEQ_CST:
+        for (i = 0; i < thr->nr_ops; i++)
+            atomic_fetch_sub_explicit(ap, 1, memory_order_seq_cst);
+        break;
+    case MODE_SHARDED:
+    case MODE_SHARDED_UNPADDED:
+        sharded_ops(thr->cnt, thr->thrid, thr->nr_ops, -1);
+        break;
+    case MODE_FUTEX:
+        for (i = 0; i < thr->nr_ops; i++) {
+            futex_mutex_lock(&futex_mutex);
             --(*ip);
-            pthread_mutex_unlock(&mutex);
-            /* ... */
+            futex_mutex_unlock(&futex_mutex);
+        }
+        break;
+    case MODE_TICKET:
+        for (i = 0; i < thr->nr_ops; i++) {
+            ticket_lock(&ticket);
+            --(*ip);
+            ticket_unlock(&ticket);
+        }
+        break;
+    case MODE_MCS:
+        for (i = 0; i < thr->nr_ops; i++) {
+            mcs_lock(&mcs, &thr->mcs_node);
+            --(*ip);
+            mcs_unlock(&mcs, &thr->mcs_node);
+        }
+        break;
+    case MODE_CLH:
+        for (i = 0; i < thr->nr_ops; i++) {
+            clh_lock(&clh, &thr->clh_thread);
+            --(*ip);
+            clh_unlock(&clh, &thr->clh_thread);
+        }
+        break;
+    case MODE_ADAPTIVE:
+        for (i = 0; i < thr->nr_ops; i++) {
+            adaptive_lock(&adaptive);
+            --(*ip);
+            adaptive_unlock(&adaptive);
         }
+        break;
+    default:
+        break;
     }
+    thread_end(thr);
 
-    fprintf(stderr, "Done decreasing variable.\n");
+    if (verbose)
+        fprintf(stderr, "Done decreasing variable.\n");
     return NULL;
 }
 
-int main(int argc, char *argv[]) {
-    int val, ret, ok;
-    pthread_t t1, t2;
+/*
+* Run one mode with thrcnt threads: even thread ids increase, odd ones decrease.
+* Returns the total throughput in operations per second, *ok tells whether
+* the final value of the counter is the expected one.
+*
+* *fairness is Jain's index over the per-thread throughputs: 1 when every
+* thread got the lock equally often, down to 1/thrcnt when one thread
+* monopolized it.
+*/
+double run_benchmark(enum sync_mode mode, int thrcnt, long nr_ops, int *ok, double *fairness) {
+    struct thread_info_struct *thr;
+    struct counter cnt;
+    double first_start, last_end, tput, sum = 0, sum_sq = 0;
+    long expected = 0, val;
+    int i, ret;
 
     /*
     * Initial value
     */
-    val = 0;
-
-    /*
-    * Create threads
-    */
-    ret = pthread_create(&t1, NULL, increase_fn, &val);
-    if (ret) {
-        perror_pthread(ret, "pthread_create");
+    cnt.val = 0;
+    atomic_init(&cnt.aval, 0);
+    cnt.shard_stride = (mode == MODE_SHARDED) ? shard_pad : sizeof(atomic_long);
+    cnt.shards = aligned_alloc(shard_pad, ((thrcnt * cnt.shard_stride) / shard_pad + 1) * shard_pad);
+    if (cnt.shards == NULL) {
+        fprintf(stderr, "Out of memory\n");
         exit(1);
     }
+    for (i = 0; i < thrcnt; i++)
+        atomic_init(shard_slot(&cnt, i), 0);
 
-    ret = pthread_create(&t2, NULL, decrease_fn, &val);
+    // The lock nodes inside are cache-line aligned, which malloc() does not guarantee
+    thr = aligned_alloc(CACHE_LINE_SIZE,
+                        (thrcnt * sizeof(*thr) + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE);
+    if (thr == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    ret = pthread_barrier_init(&start_barrier, NULL, thrcnt);
     if (ret) {
-        perror_pthread(ret, "pthread_create");
+        perror_pthread(ret, "pthread_barrier_init");
         exit(1);
     }
 
+    /*
+    * Create threads
+    */
+    for (i = 0; i < thrcnt; i++) {
+        thr[i].thrid = i;
+        thr[i].mode = mode;
+        clh_thread_init(&thr[i].clh_thread);
+        thr[i].nr_ops = nr_ops;
+        thr[i].cnt = &cnt;
+        expected += (i % 2 == 0) ? nr_ops : -nr_ops;
+
+        ret = pthread_create(&thr[i].tid, NULL, (i % 2 == 0) ? increase_fn : decrease_fn, &thr[i]);
+        if (ret) {
+            perror_pthread(ret, "pthread_create");
+            exit(1);
+        }
+    }
+
     /*
     * Wait for threads to terminate
     */
-    ret = pthread_join(t1, NULL);
-    if (ret)
-        perror_pthread(ret, "pthread_join");
+    for (i = 0; i < thrcnt; i++) {
+        ret = pthread_join(thr[i].tid, NULL);
+        if (ret)
+            perror_pthread(ret, "pthread_join");
+    }
 
-    ret = pthread_join(t2, NULL);
-    if (ret)
-        perror_pthread(ret, "pthread_join");
+    first_start = thr[0].start;
+    last_end = thr[0].end;
+    for (i = 0; i < thrcnt; i++) {
+        if (thr[i].start < first_start)
+            first_start = thr[i].start;
+        if (thr[i].end > last_end)
+            last_end = thr[i].end;
+        tput = thr[i].nr_ops / (thr[i].end - thr[i].start);
+        sum += tput;
+        sum_sq += tput * tput;
+        if (verbose)
+            fprintf(stderr, "  %s, thread %d/%d (%s): %.2f Mops/s\n", mode_names[mode], i, thrcnt,
+                   (i % 2 == 0) ? "increase" : "decrease", tput / 1e6);
+        clh_thread_destroy(&thr[i].clh_thread);
+    }
+    *fairness = sum * sum / (thrcnt * sum_sq);
 
     /*
     * Is everything OK?
     */
-    ok = (val == 0);
-    printf("%sOK, val = %d.\n", ok ? "" : "NOT ", val);
+    if (mode == MODE_SHARDED || mode == MODE_SHARDED_UNPADDED)
+        val = sharded_read(&cnt, thrcnt);
+    else if (mode >= MODE_C11_RELAXED && mode <= MODE_C11_SEQ_CST)
+        val = atomic_load(&cnt.aval);
+    else
+        val = cnt.val;
+    *ok = (val == expected);
+    if (verbose || !*ok)
+        fprintf(stderr, "  %s, %d threads: %sOK, val = %ld.\n", mode_names[mode], thrcnt, *ok ? "" : "NOT ", val);
+
+    pthread_barrier_destroy(&start_barrier);
+    free(cnt.shards);
+    free(thr);
+    return (double)nr_ops * thrcnt / (last_end - first_start);
+}
+
+void usage(char *argv0) {
+    fprintf(stderr, "Usage: %s [-m mode[,mode...]|all] [-t threads[,threads...]|scale] [-n ops]\n"
+            "          [-P pad] [-k batch] [-w counter|readmostly|queue|barrier]\n"
+            "          [-r read_pct] [-p producers] [-c consumers] [-f] [-v]\n\n"
+            "  -m: synchronization modes to run (default: %s)\n"
+            "  -t: thread counts to run with (default: 2), \"scale\" for 1, 2, 4, ...\n"
+            "      up to the number of online CPUs (barrier: 2, 4, ..., 256)\n"
+            "  -n: operations per thread (default: %d, barrier: episodes, 1000)\n"
+            "  -P: sharded modes, bytes each slot is padded to (default: 64)\n"
+            "  -k: sharded modes, operations batched locally per flush (default: 1)\n"
+            "  -w: workload, the shared counter (default), a read-mostly record or\n"
+            "      a producer/consumer queue, or barrier episodes\n"
+            "  -r: readmostly, percentage of operations that are reads (default: 90)\n"
+            "  -p, -c: queue, number of producer and consumer threads (default: 2, 2),\n"
+            "      -n is then the number of items per producer\n"
+            "  -f: barrier, participants are forked processes instead of threads\n"
+            "  -v: per-thread results (on stderr)\n"
+            "Modes:", argv0, mode_names[DEFAULT_MODE], N);
+    for (int i = 0; i < NR_MODES; i++)
+        fprintf(stderr, " %s", mode_names[i]);
+    fprintf(stderr, "\nReadmostly modes: mutex rwlock seqlock rcu\n"
+            "Queue modes: mutex msqueue vyukov\n"
+            "Barrier modes: pthread central dissemination tournament\n");
+    exit(1);
+}
+
+/*
+* Parse a comma-separated list of modes into selected[]
+*/
+int parse_modes(char *arg, int selected[NR_MODES]) {
+    char *tok, *save;
+    int i;
+
+    for (tok = strtok_r(arg, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save)) {
+        if (strcmp(tok, "all") == 0) {
+            for (i = 0; i < NR_MODES; i++)
+                selected[i] = 1;
+            continue;
+        }
+        for (i = 0; i < NR_MODES; i++)
+            if (strcmp(tok, mode_names[i]) == 0)
+                break;
+        if (i == NR_MODES)
+            return -1;
+        selected[i] = 1;
+    }
+    return 0;
+}
+
+/*
+* Parse a comma-separated list of thread counts, or "scale"
+*/
+int parse_threads(char *arg, int counts[MAX_THREAD_COUNTS]) {
+    char *tok, *save, *endp;
+    int nr = 0, ncpus;
+    long t;
+
+    if (strcmp(arg, "scale") == 0) {
+        ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+        for (t = 1; t < ncpus && nr < MAX_THREAD_COUNTS - 1; t *= 2)
+            counts[nr++] = t;
+        counts[nr++] = ncpus;
+        return nr;
+    }
+    for (tok = strtok_r(arg, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save)) {
+        t = strtol(tok, &endp, 10);
+        if (*endp != '\0' || t <= 0 || nr == MAX_THREAD_COUNTS)
+            return -1;
+        counts[nr++] = t;
+    }
+    return nr;
+}
+
+int main(int argc, char *argv[]) {
+    int selected[NR_MODES] = { 0 }, any = 0;
+    int counts[MAX_THREAD_COUNTS] = { 2 }, nr_counts = 1, counts_given = 0;
+    long nr_ops = 0;
+    int opt, i, m, ok, all_ok = 1;
+    double fairness[NR_MODES][MAX_THREAD_COUNTS];
+    char *endp, *mode_arg = NULL;
+    int readmostly = 0, read_pct = 90;
+    int queue = 0, nr_producers = 2, nr_consumers = 2;
+    int barrier = 0, processes = 0;
+
+    while ((opt = getopt(argc, argv, "m:t:n:P:k:w:r:p:c:fv")) != -1) {
+        switch (opt) {
+        case 'm':
+            // Parsed once we know the workload, the mode names differ
+            mode_arg = optarg;
+            break;
+        case 't':
+            if ((nr_counts = parse_threads(optarg, counts)) < 0)
+                usage(argv[0]);
+            counts_given = 1;
+            break;
+        case 'n':
+            nr_ops = strtol(optarg, &endp, 10);
+            if (*endp != '\0' || nr_ops <= 0)
+                usage(argv[0]);
+            break;
+        case 'P':
+            shard_pad = strtol(optarg, &endp, 10);
+            // aligned_alloc() needs a power of two, at least one slot wide
+            if (*endp != '\0' || shard_pad < sizeof(atomic_long) || (shard_pad & (shard_pad - 1)))
+                usage(argv[0]);
+            break;
+        case 'k':
+            shard_batch = strtol(optarg, &endp, 10);
+            if (*endp != '\0' || shard_batch <= 0)
+                usage(argv[0]);
+            break;
+        case 'w':
+            if (strcmp(optarg, "readmostly") == 0)
+                readmostly = 1;
+            else if (strcmp(optarg, "queue") == 0)
+                queue = 1;
+            else if (strcmp(optarg, "barrier") == 0)
+                barrier = 1;
+            else if (strcmp(optarg, "counter") != 0)
+                usage(argv[0]);
+            break;
+        case 'r':
+            read_pct = strtol(optarg, &endp, 10);
+            if (*endp != '\0' || read_pct < 0 || read_pct > 100)
+                usage(argv[0]);
+            break;
+        case 'p':
+            nr_producers = strtol(optarg, &endp, 10);
+            if (*endp != '\0' || nr_producers <= 0)
+                usage(argv[0]);
+            break;
+        case 'c':
+            nr_consumers = strtol(optarg, &endp, 10);
+            if (*endp != '\0' || nr_consumers <= 0)
+                usage(argv[0]);
+            break;
+        case 'f':
+            processes = 1;
+            break;
+        case 'v':
+            verbose = 1;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    // The barrier workload has its own defaults, see barrier_run()
+    if (barrier) {
+        ok = barrier_run(mode_arg, counts_given ? counts : NULL, nr_counts, nr_ops, processes);
+        if (ok < 0)
+            usage(argv[0]);
+        return ok;
+    }
+    if (nr_ops == 0)
+        nr_ops = N;
+
+    if (readmostly) {
+        ok = readmostly_run(mode_arg, counts, nr_counts, nr_ops, read_pct);
+        if (ok < 0)
+            usage(argv[0]);
+        return ok;
+    }
+    if (queue) {
+        ok = queue_run(mode_arg, nr_producers, nr_consumers, nr_ops);
+        if (ok < 0)
+            usage(argv[0]);
+        return ok;
+    }
+    if (mode_arg != NULL && parse_modes(mode_arg, selected) < 0)
+        usage(argv[0]);
+    for (m = 0; m < NR_MODES; m++)
+        any |= selected[m];
+    if (!any)
+        selected[DEFAULT_MODE] = 1;
+
+    pthread_spin_init(&spinlock, PTHREAD_PROCESS_PRIVATE);
+    futex_mutex_init(&futex_mutex);
+    ticket_lock_init(&ticket);
+    mcs_lock_init(&mcs);
+    clh_lock_init(&clh);
+    adaptive_lock_init(&adaptive);
+
+    /*
+    * Scaling table: total throughput in millions of operations per second
+    */
+    printf("%-14s", "Mops/s");
+    for (i = 0; i < nr_counts; i++)
+        printf(" %8d thr", counts[i]);
+    printf("\n");
+
+    for (m = 0; m < NR_MODES; m++) {
+        if (!selected[m])
+            continue;
+        printf("%-14s", mode_names[m]);
+        fflush(stdout);
+        for (i = 0; i < nr_counts; i++) {
+            double tput = run_benchmark(m, counts[i], nr_ops, &ok, &fairness[m][i]);
+            all_ok &= ok;
+            printf(" %12.2f%s", tput / 1e6, ok ? "" : "!");
+            fflush(stdout);
+        }
+        printf("\n");
+    }
+
+    if (!all_ok)
+        printf("NOT OK: '!' marks runs that ended with a wrong value.\n");
+
+    /*
+    * Fairness table: Jain's index of the per-thread throughputs
+    */
+    printf("\n%-14s", "fairness");
+    for (i = 0; i < nr_counts; i++)
+        printf(" %8d thr", counts[i]);
+    printf("\n");
+    for (m = 0; m < NR_MODES; m++) {
+        if (!selected[m])
+            continue;
+        printf("%-14s", mode_names[m]);
+        for (i = 0; i < nr_counts; i++)
+            printf(" %12.3f", fairness[m][i]);
+        printf("\n");
+    }
 
-    // We destroy the mutex since we are done and no longer need it
+    // We destroy the mutex and the spinlock since we are done and no longer need them
     pthread_mutex_destroy(&mutex);
-    return ok;
+    pthread_spin_destroy(&spinlock);
+    clh_lock_destroy(&clh);
+    return all_ok ? 0 : 1;
 }
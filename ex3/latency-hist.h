@@ -0,0 +1,86 @@
+/*
+ * latency-hist.h
+ *
+ * A log-linear latency histogram: exact below 16, then 16 sub-buckets per
+ * power of two (about 6% resolution) up to 2^64. Small enough to keep one
+ * per thread and merge at the end, so no samples need to be stored.
+ */
+#ifndef LATENCY_HIST_H__
+#define LATENCY_HIST_H__
+
+#include <string.h>
+
+#define LAT_HIST_SUB_BITS 4
+#define LAT_HIST_SUB (1 << LAT_HIST_SUB_BITS)
+#define LAT_HIST_BUCKETS (64 * LAT_HIST_SUB)
+
+struct lat_hist {
+    unsigned long count;
+    unsigned long long sum;
+    unsigned long long max;
+    unsigned long bucket[LAT_HIST_BUCKETS];
+};
+
+static inline void lat_hist_init(struct lat_hist *h) {
+    memset(h, 0, sizeof(*h));
+}
+
+static inline int lat_hist_index(unsigned long long v) {
+    int msb;
+
+    if (v < LAT_HIST_SUB)
+        return v;
+    msb = 63 - __builtin_clzll(v);
+    return (msb - LAT_HIST_SUB_BITS + 1) * LAT_HIST_SUB +
+           ((v >> (msb - LAT_HIST_SUB_BITS)) & (LAT_HIST_SUB - 1));
+}
+
+/* Lower bound of the values that fall in bucket idx */
+static inline unsigned long long lat_hist_value(int idx) {
+    int msb, sub;
+
+    if (idx < LAT_HIST_SUB)
+        return idx;
+    msb = idx / LAT_HIST_SUB + LAT_HIST_SUB_BITS - 1;
+    sub = idx % LAT_HIST_SUB;
+    return (1ULL << msb) | ((unsigned long long)sub << (msb - LAT_HIST_SUB_BITS));
+}
+
+static inline void lat_hist_add(struct lat_hist *h, unsigned long long v) {
+    h->bucket[lat_hist_index(v)]++;
+    h->count++;
+    h->sum += v;
+    if (v > h->max)
+        h->max = v;
+}
+
+static inline void lat_hist_merge(struct lat_hist *dst, const struct lat_hist *src) {
+    int i;
+
+    for (i = 0; i < LAT_HIST_BUCKETS; i++)
+        dst->bucket[i] += src->bucket[i];
+    dst->count += src->count;
+    dst->sum += src->sum;
+    if (src->max > dst->max)
+        dst->max = src->max;
+}
+
+/* Value below which pct percent of the samples fall */
+static inline unsigned long long lat_hist_percentile(const struct lat_hist *h, double pct) {
+    unsigned long target, seen = 0;
+    int i;
+
+    if (h->count == 0)
+        return 0;
+    target = (unsigned long)(pct / 100.0 * h->count);
+    if (target == 0)
+        target = 1;
+    for (i = 0; i < LAT_HIST_BUCKETS; i++) {
+        seen += h->bucket[i];
+        if (seen >= target)
+            return lat_hist_value(i);
+    }
+    return h->max;
+}
+
+#endif /* LATENCY_HIST_H__ */
@@ -0,0 +1,451 @@
+/*
+ * lockprof.c
+ *
+ * A lock-contention profiler for unmodified pthread programs. Loaded with
+ * LD_PRELOAD it wraps the pthread mutex, condition variable and semaphore
+ * calls and records, for every lock and for every call site that uses it:
+ *
+ *   wait time:  from calling lock/wait until getting the lock
+ *               (0 when a trylock first succeeds, "contended" otherwise)
+ *   hold time:  mutexes only, from getting the lock until unlock, with the
+ *               time spent inside pthread_cond_wait() not counted
+ *
+ * A report sorted by total wait time is printed when the program exits,
+ * on stderr or appended to $LOCKPROF_OUT. Call sites are printed as
+ * object+offset, for addr2line -f -e <object> <offset>.
+ *
+ * Build: gcc -Wall -O2 -fPIC -shared -pthread -o liblockprof.so lockprof.c -ldl
+ * Use:   LD_PRELOAD=./liblockprof.so ./mandel
+ *        LD_PRELOAD=./liblockprof.so ./simplesync -m mutex -t 4
+ *
+ * Processes that fork (ex4) get one report per process, each with its pid.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <sched.h>
+#include <dlfcn.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include "latency-hist.h"
+
+/* Tables are fixed-size, anything beyond them is counted as dropped */
+#define LOCKPROF_MAX_LOCKS 256
+#define LOCKPROF_MAX_SITES 512
+
+enum lp_kind {
+    LP_MUTEX,
+    LP_COND,
+    LP_SEM,
+};
+
+const char *lp_kind_names[] = {
+    [LP_MUTEX] = "mutex",
+    [LP_COND] = "cond",
+    [LP_SEM] = "sem",
+};
+
+/*
+ * One lock (site == NULL) or one (lock, call site) pair.
+ * Histograms are updated under busy, a spinlock of our own so that the
+ * profiler never calls the functions it wraps.
+ */
+struct lp_entry {
+    atomic_int used;          /* Set once lock, site and kind are filled in */
+    void *lock;
+    void *site;
+    enum lp_kind kind;
+    atomic_flag busy;
+    unsigned long acquisitions;
+    unsigned long contended;
+    struct lat_hist wait;
+    struct lat_hist hold;
+    /* Mutexes: written by the current owner only */
+    unsigned long long acquired_ns;
+    struct lp_entry *acquired_site;
+};
+
+struct lp_entry lp_locks[LOCKPROF_MAX_LOCKS];
+struct lp_entry lp_sites[LOCKPROF_MAX_SITES];
+atomic_flag lp_insert_lock = ATOMIC_FLAG_INIT;
+atomic_ulong lp_dropped;
+
+/* Set while the profiler itself runs, calls made from there go straight through */
+__thread int lp_inside;
+
+int (*real_mutex_lock)(pthread_mutex_t *);
+int (*real_mutex_trylock)(pthread_mutex_t *);
+int (*real_mutex_unlock)(pthread_mutex_t *);
+int (*real_cond_wait)(pthread_cond_t *, pthread_mutex_t *);
+int (*real_cond_timedwait)(pthread_cond_t *, pthread_mutex_t *, const struct timespec *);
+int (*real_sem_wait)(sem_t *);
+int (*real_sem_trywait)(sem_t *);
+int (*real_sem_timedwait)(sem_t *, const struct timespec *);
+
+static unsigned long long lp_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void lp_spin_lock(atomic_flag *f) {
+    while (atomic_flag_test_and_set_explicit(f, memory_order_acquire))
+        sched_yield();
+}
+
+static void lp_spin_unlock(atomic_flag *f) {
+    atomic_flag_clear_explicit(f, memory_order_release);
+}
+
+static void lp_resolve(void) {
+    lp_inside = 1;
+    real_mutex_lock = dlsym(RTLD_NEXT, "pthread_mutex_lock");
+    real_mutex_trylock = dlsym(RTLD_NEXT, "pthread_mutex_trylock");
+    real_mutex_unlock = dlsym(RTLD_NEXT, "pthread_mutex_unlock");
+    real_cond_wait = dlsym(RTLD_NEXT, "pthread_cond_wait");
+    real_cond_timedwait = dlsym(RTLD_NEXT, "pthread_cond_timedwait");
+    real_sem_wait = dlsym(RTLD_NEXT, "sem_wait");
+    real_sem_trywait = dlsym(RTLD_NEXT, "sem_trywait");
+    real_sem_timedwait = dlsym(RTLD_NEXT, "sem_timedwait");
+    lp_inside = 0;
+    if (!real_mutex_lock || !real_mutex_trylock || !real_mutex_unlock || !real_cond_wait ||
+        !real_cond_timedwait || !real_sem_wait || !real_sem_trywait || !real_sem_timedwait) {
+        fprintf(stderr, "lockprof: dlsym: %s\n", dlerror());
+        exit(1);
+    }
+}
+
+/*
+ * Find the entry of (lock, site) in table, adding it if needed.
+ * Lookups are lock-free, inserts are rare and serialized.
+ */
+static struct lp_entry *lp_lookup(struct lp_entry *table, int size, void *lock, void *site,
+                                  enum lp_kind kind) {
+    uintptr_t h = ((uintptr_t)lock ^ ((uintptr_t)site * 31)) * 0x9e3779b97f4a7c15ULL;
+    int i, n;
+    struct lp_entry *e;
+
+    for (n = 0, i = (h >> 32) % size; n < size; n++, i = (i + 1) % size) {
+        e = &table[i];
+        if (!atomic_load_explicit(&e->used, memory_order_acquire)) {
+            lp_spin_lock(&lp_insert_lock);
+            if (!atomic_load_explicit(&e->used, memory_order_relaxed)) {
+                e->lock = lock;
+                e->site = site;
+                e->kind = kind;
+                atomic_store_explicit(&e->used, 1, memory_order_release);
+            }
+            lp_spin_unlock(&lp_insert_lock);
+        }
+        if (e->lock == lock && e->site == site)
+            return e;
+    }
+    atomic_fetch_add(&lp_dropped, 1);
+    return NULL;
+}
+
+static void lp_record_wait(struct lp_entry *e, unsigned long long wait, int contended) {
+    if (e == NULL)
+        return;
+    lp_spin_lock(&e->busy);
+    e->acquisitions++;
+    e->contended += contended;
+    lat_hist_add(&e->wait, wait);
+    lp_spin_unlock(&e->busy);
+}
+
+static void lp_record_hold(struct lp_entry *e, unsigned long long hold) {
+    if (e == NULL)
+        return;
+    lp_spin_lock(&e->busy);
+    lat_hist_add(&e->hold, hold);
+    lp_spin_unlock(&e->busy);
+}
+
+/* A lock, wait or sem_wait at site returned after wait ns */
+static void lp_acquired(void *lock, void *site, enum lp_kind kind, unsigned long long wait,
+                        int contended) {
+    lp_inside = 1;
+    lp_record_wait(lp_lookup(lp_locks, LOCKPROF_MAX_LOCKS, lock, NULL, kind), wait, contended);
+    lp_record_wait(lp_lookup(lp_sites, LOCKPROF_MAX_SITES, lock, site, kind), wait, contended);
+    lp_inside = 0;
+}
+
+/* The calling thread owns mutex m from now on, taken at site */
+static void lp_hold_start(pthread_mutex_t *m, void *site) {
+    struct lp_entry *e;
+
+    lp_inside = 1;
+    if ((e = lp_lookup(lp_locks, LOCKPROF_MAX_LOCKS, m, NULL, LP_MUTEX)) != NULL) {
+        e->acquired_site = lp_lookup(lp_sites, LOCKPROF_MAX_SITES, m, site, LP_MUTEX);
+        e->acquired_ns = lp_now();
+    }
+    lp_inside = 0;
+}
+
+/* The calling thread is about to give up mutex m */
+static void lp_hold_end(pthread_mutex_t *m) {
+    struct lp_entry *e;
+    unsigned long long hold;
+
+    lp_inside = 1;
+    e = lp_lookup(lp_locks, LOCKPROF_MAX_LOCKS, m, NULL, LP_MUTEX);
+    if (e != NULL && e->acquired_ns) {
+        hold = lp_now() - e->acquired_ns;
+        e->acquired_ns = 0;
+        lp_record_hold(e, hold);
+        lp_record_hold(e->acquired_site, hold);
+    }
+    lp_inside = 0;
+}
+
+int pthread_mutex_lock(pthread_mutex_t *m) {
+    void *site = __builtin_return_address(0);
+    unsigned long long t0, wait = 0;
+    int ret, contended = 0;
+
+    if (real_mutex_lock == NULL) {
+        // Called before our constructor, or by dlsym() while resolving
+        if (lp_inside)
+            return 0;
+        lp_resolve();
+    }
+    if (lp_inside)
+        return real_mutex_lock(m);
+
+    // Uncontended acquisitions cost one trylock and are counted with 0 wait
+    ret = real_mutex_trylock(m);
+    if (ret == EBUSY) {
+        contended = 1;
+        t0 = lp_now();
+        ret = real_mutex_lock(m);
+        wait = lp_now() - t0;
+    }
+    if (ret == 0) {
+        lp_acquired(m, site, LP_MUTEX, wait, contended);
+        lp_hold_start(m, site);
+    }
+    return ret;
+}
+
+int pthread_mutex_trylock(pthread_mutex_t *m) {
+    void *site = __builtin_return_address(0);
+    int ret;
+
+    if (real_mutex_trylock == NULL) {
+        if (lp_inside)
+            return 0;
+        lp_resolve();
+    }
+    ret = real_mutex_trylock(m);
+    if (ret == 0 && !lp_inside) {
+        lp_acquired(m, site, LP_MUTEX, 0, 0);
+        lp_hold_start(m, site);
+    }
+    return ret;
+}
+
+int pthread_mutex_unlock(pthread_mutex_t *m) {
+    if (real_mutex_unlock == NULL) {
+        if (lp_inside)
+            return 0;
+        lp_resolve();
+    }
+    if (!lp_inside)
+        lp_hold_end(m);
+    return real_mutex_unlock(m);
+}
+
+int pthread_cond_wait(pthread_cond_t *c, pthread_mutex_t *m) {
+    void *site = __builtin_return_address(0);
+    unsigned long long t0;
+    int ret;
+
+    if (real_cond_wait == NULL)
+        lp_resolve();
+    if (lp_inside)
+        return real_cond_wait(c, m);
+
+    // The mutex is released while we sleep, and taken again before returning
+    lp_hold_end(m);
+    t0 = lp_now();
+    ret = real_cond_wait(c, m);
+    lp_acquired(c, site, LP_COND, lp_now() - t0, 1);
+    lp_hold_start(m, site);
+    return ret;
+}
+
+int pthread_cond_timedwait(pthread_cond_t *c, pthread_mutex_t *m, const struct timespec *abstime) {
+    void *site = __builtin_return_address(0);
+    unsigned long long t0;
+    int ret;
+
+    if (real_cond_timedwait == NULL)
+        lp_resolve();
+    if (lp_inside)
+        return real_cond_timedwait(c, m, abstime);
+
+    lp_hold_end(m);
+    t0 = lp_now();
+    ret = real_cond_timedwait(c, m, abstime);
+    lp_acquired(c, site, LP_COND, lp_now() - t0, 1);
+    lp_hold_start(m, site);
+    return ret;
+}
+
+int sem_wait(sem_t *s) {
+    void *site = __builtin_return_address(0);
+    unsigned long long t0, wait = 0;
+    int ret, contended = 0, saved_errno = errno;
+
+    if (real_sem_wait == NULL)
+        lp_resolve();
+    if (lp_inside)
+        return real_sem_wait(s);
+
+    ret = real_sem_trywait(s);
+    if (ret < 0 && errno == EAGAIN) {
+        errno = saved_errno;
+        contended = 1;
+        t0 = lp_now();
+        ret = real_sem_wait(s);
+        wait = lp_now() - t0;
+    }
+    if (ret == 0)
+        lp_acquired(s, site, LP_SEM, wait, contended);
+    return ret;
+}
+
+int sem_trywait(sem_t *s) {
+    void *site = __builtin_return_address(0);
+    int ret;
+
+    if (real_sem_trywait == NULL)
+        lp_resolve();
+    ret = real_sem_trywait(s);
+    if (ret == 0 && !lp_inside)
+        lp_acquired(s, site, LP_SEM, 0, 0);
+    return ret;
+}
+
+int sem_timedwait(sem_t *s, const struct timespec *abstime) {
+    void *site = __builtin_return_address(0);
+    unsigned long long t0;
+    int ret;
+
+    if (real_sem_timedwait == NULL)
+        lp_resolve();
+    if (lp_inside)
+        return real_sem_timedwait(s, abstime);
+
+    t0 = lp_now();
+    ret = real_sem_timedwait(s, abstime);
+    if (ret == 0)
+        lp_acquired(s, site, LP_SEM, lp_now() - t0, 1);
+    return ret;
+}
+
+/*
+ * Report
+ */
+static int lp_by_wait(const void *a, const void *b) {
+    const struct lp_entry *x = *(struct lp_entry *const *)a, *y = *(struct lp_entry *const *)b;
+    return x->wait.sum < y->wait.sum ? 1 : x->wait.sum > y->wait.sum ? -1 : 0;
+}
+
+static void lp_print_times(FILE *f, const struct lp_entry *e) {
+    fprintf(f, " %8lu %9lu %11.3f %8llu %8llu %10llu", e->acquisitions, e->contended,
+            e->wait.sum / 1e6, lat_hist_percentile(&e->wait, 50),
+            lat_hist_percentile(&e->wait, 99), e->wait.max);
+    if (e->hold.count)
+        fprintf(f, " %11.3f %8llu %8llu %10llu\n", e->hold.sum / 1e6,
+                lat_hist_percentile(&e->hold, 50), lat_hist_percentile(&e->hold, 99), e->hold.max);
+    else
+        fprintf(f, " %11s %8s %8s %10s\n", "-", "-", "-", "-");
+}
+
+static void lp_print_site(FILE *f, void *site) {
+    Dl_info info;
+
+    if (dladdr(site, &info) && info.dli_fname) {
+        const char *obj = strrchr(info.dli_fname, '/');
+        if (info.dli_sname)
+            fprintf(f, "    %s+0x%lx (%s)\n", info.dli_sname,
+                    (unsigned long)((char *)site - (char *)info.dli_saddr), obj ? obj + 1 : info.dli_fname);
+        else
+            fprintf(f, "    %s+0x%lx\n", info.dli_fname,
+                    (unsigned long)((char *)site - (char *)info.dli_fbase));
+    } else {
+        fprintf(f, "    %p\n", site);
+    }
+}
+
+__attribute__((destructor))
+static void lp_report(void) {
+    struct lp_entry *locks[LOCKPROF_MAX_LOCKS], *sites[LOCKPROF_MAX_SITES];
+    int nr_locks = 0, nr_sites = 0, i, j;
+    char *path = getenv("LOCKPROF_OUT"), *buf;
+    size_t len;
+    FILE *f, *out = stderr;
+
+    lp_inside = 1;
+    for (i = 0; i < LOCKPROF_MAX_LOCKS; i++)
+        if (atomic_load(&lp_locks[i].used) && lp_locks[i].acquisitions)
+            locks[nr_locks++] = &lp_locks[i];
+    // Sites only reached through a cond_wait() return have hold times but no acquisitions
+    for (i = 0; i < LOCKPROF_MAX_SITES; i++)
+        if (atomic_load(&lp_sites[i].used) && (lp_sites[i].acquisitions || lp_sites[i].hold.count))
+            sites[nr_sites++] = &lp_sites[i];
+    if (nr_locks == 0)
+        return;
+
+    // Build the report in memory and write it at once, forked processes exit together
+    if ((f = open_memstream(&buf, &len)) == NULL) {
+        perror("lockprof: open_memstream");
+        return;
+    }
+    qsort(locks, nr_locks, sizeof(locks[0]), lp_by_wait);
+    qsort(sites, nr_sites, sizeof(sites[0]), lp_by_wait);
+
+    fprintf(f, "lockprof: pid %ld, %d locks, %d call sites", (long)getpid(), nr_locks, nr_sites);
+    if (atomic_load(&lp_dropped))
+        fprintf(f, ", %lu events dropped (tables full)", atomic_load(&lp_dropped));
+    fprintf(f, "\n%-24s %8s %9s %11s %8s %8s %10s %11s %8s %8s %10s\n", "lock / call site",
+            "acq", "contended", "wait ms", "p50 ns", "p99 ns", "max ns", "hold ms", "p50 ns", "p99 ns", "max ns");
+
+    for (i = 0; i < nr_locks; i++) {
+        fprintf(f, "%-5s %-18p", lp_kind_names[locks[i]->kind], locks[i]->lock);
+        lp_print_times(f, locks[i]);
+        for (j = 0; j < nr_sites; j++) {
+            if (sites[j]->lock != locks[i]->lock)
+                continue;
+            fprintf(f, "  %-22s", "");
+            lp_print_times(f, sites[j]);
+            lp_print_site(f, sites[j]->site);
+        }
+    }
+
+    fclose(f);
+
+    if (path && (out = fopen(path, "a")) == NULL) {
+        perror("lockprof: fopen");
+        out = stderr;
+    }
+    fwrite(buf, 1, len, out);
+    fflush(out);
+    if (out != stderr)
+        fclose(out);
+    free(buf);
+}
+
+__attribute__((constructor))
+static void lp_init(void) {
+    if (real_mutex_lock == NULL)
+        lp_resolve();
+}
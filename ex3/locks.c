@@ -0,0 +1,223 @@
+/*
+ * locks.c
+ *
+ * Mutual exclusion locks for simplesync. See locks.h.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sched.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include "locks.h"
+
+static inline void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+/* One iteration of a spin-wait loop */
+static inline void spin_pause(unsigned *spins) {
+    if (++*spins % SPIN_YIELD_EVERY == 0)
+        sched_yield();
+    else
+        cpu_relax();
+}
+
+static void futex_wait(atomic_int *addr, int val) {
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static void futex_wake(atomic_int *addr, int nr) {
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, nr, NULL, NULL, 0);
+}
+
+/*
+ * Futex mutex ("Futexes Are Tricky", mutex #2)
+ */
+void futex_mutex_init(struct futex_mutex *l) {
+    atomic_init(&l->state, 0);
+}
+
+// Slow path shared with adaptive_lock: mark the lock contended and sleep
+static void futex_lock_slow(atomic_int *state, int c) {
+    if (c != 2)
+        c = atomic_exchange_explicit(state, 2, memory_order_acquire);
+    while (c != 0) {
+        futex_wait(state, 2);
+        c = atomic_exchange_explicit(state, 2, memory_order_acquire);
+    }
+}
+
+void futex_mutex_lock(struct futex_mutex *l) {
+    int c = 0;
+
+    if (atomic_compare_exchange_strong_explicit(&l->state, &c, 1,
+                                                memory_order_acquire, memory_order_relaxed))
+        return;
+    futex_lock_slow(&l->state, c);
+}
+
+static void futex_unlock_state(atomic_int *state) {
+    // 1 -> 0: nobody waits. 2 -> 1: someone may sleep, release and wake one
+    if (atomic_fetch_sub_explicit(state, 1, memory_order_release) != 1) {
+        atomic_store_explicit(state, 0, memory_order_release);
+        futex_wake(state, 1);
+    }
+}
+
+void futex_mutex_unlock(struct futex_mutex *l) {
+    futex_unlock_state(&l->state);
+}
+
+/*
+ * Ticket lock
+ */
+void ticket_lock_init(struct ticket_lock *l) {
+    atomic_init(&l->next, 0);
+    atomic_init(&l->owner, 0);
+}
+
+void ticket_lock(struct ticket_lock *l) {
+    unsigned me = atomic_fetch_add_explicit(&l->next, 1, memory_order_relaxed);
+    unsigned spins = 0;
+
+    while (atomic_load_explicit(&l->owner, memory_order_acquire) != me)
+        spin_pause(&spins);
+}
+
+void ticket_unlock(struct ticket_lock *l) {
+    // Only the holder writes owner, so a load/store pair is enough
+    atomic_store_explicit(&l->owner, atomic_load_explicit(&l->owner, memory_order_relaxed) + 1,
+                          memory_order_release);
+}
+
+/*
+ * MCS queue lock
+ */
+void mcs_lock_init(struct mcs_lock *l) {
+    atomic_init(&l->tail, NULL);
+}
+
+void mcs_lock(struct mcs_lock *l, struct mcs_node *me) {
+    struct mcs_node *pred;
+    unsigned spins = 0;
+
+    atomic_store_explicit(&me->next, NULL, memory_order_relaxed);
+    atomic_store_explicit(&me->locked, 1, memory_order_relaxed);
+
+    pred = atomic_exchange_explicit(&l->tail, me, memory_order_acq_rel);
+    if (pred == NULL)
+        return;
+
+    // Link behind the predecessor and spin on our own node only
+    atomic_store_explicit(&pred->next, me, memory_order_release);
+    while (atomic_load_explicit(&me->locked, memory_order_acquire))
+        spin_pause(&spins);
+}
+
+void mcs_unlock(struct mcs_lock *l, struct mcs_node *me) {
+    struct mcs_node *next = atomic_load_explicit(&me->next, memory_order_acquire);
+    unsigned spins = 0;
+
+    if (next == NULL) {
+        struct mcs_node *expected = me;
+
+        // No known successor: try to mark the queue empty
+        if (atomic_compare_exchange_strong_explicit(&l->tail, &expected, NULL,
+                                                    memory_order_release, memory_order_relaxed))
+            return;
+        // Someone is enqueuing right now, wait until they link to us
+        while ((next = atomic_load_explicit(&me->next, memory_order_acquire)) == NULL)
+            spin_pause(&spins);
+    }
+    atomic_store_explicit(&next->locked, 0, memory_order_release);
+}
+
+/*
+ * CLH queue lock
+ */
+static struct clh_node *clh_node_alloc(void) {
+    struct clh_node *n = aligned_alloc(CACHE_LINE_SIZE, sizeof(*n));
+
+    if (n == NULL) {
+        fprintf(stderr, "clh_node_alloc: out of memory\n");
+        exit(1);
+    }
+    atomic_init(&n->locked, 0);
+    return n;
+}
+
+void clh_lock_init(struct clh_lock *l) {
+    atomic_init(&l->tail, clh_node_alloc());
+}
+
+void clh_lock_destroy(struct clh_lock *l) {
+    free(atomic_load(&l->tail));
+}
+
+void clh_thread_init(struct clh_thread *t) {
+    t->node = clh_node_alloc();
+    t->pred = NULL;
+}
+
+void clh_thread_destroy(struct clh_thread *t) {
+    free(t->node);
+}
+
+void clh_lock(struct clh_lock *l, struct clh_thread *t) {
+    unsigned spins = 0;
+
+    atomic_store_explicit(&t->node->locked, 1, memory_order_relaxed);
+    t->pred = atomic_exchange_explicit(&l->tail, t->node, memory_order_acq_rel);
+    while (atomic_load_explicit(&t->pred->locked, memory_order_acquire))
+        spin_pause(&spins);
+}
+
+void clh_unlock(struct clh_lock *l, struct clh_thread *t) {
+    struct clh_node *pred = t->pred;
+
+    // Our node now belongs to our successor; reuse the predecessor's node
+    atomic_store_explicit(&t->node->locked, 0, memory_order_release);
+    t->node = pred;
+    (void)l;
+}
+
+/*
+ * Adaptive spin-then-park lock
+ */
+void adaptive_lock_init(struct adaptive_lock *l) {
+    atomic_init(&l->state, 0);
+}
+
+void adaptive_lock(struct adaptive_lock *l) {
+    unsigned backoff = 1, i, k;
+    int c;
+
+    for (i = 0; i < ADAPTIVE_SPIN_LIMIT; i++) {
+        c = 0;
+        if (atomic_load_explicit(&l->state, memory_order_relaxed) == 0 &&
+            atomic_compare_exchange_weak_explicit(&l->state, &c, 1,
+                                                  memory_order_acquire, memory_order_relaxed))
+            return;
+        for (k = 0; k < backoff; k++)
+            cpu_relax();
+        if (backoff < ADAPTIVE_MAX_BACKOFF)
+            backoff *= 2;
+    }
+
+    // Spinning did not pay off, park in the kernel
+    c = 0;
+    if (atomic_compare_exchange_strong_explicit(&l->state, &c, 1,
+                                                memory_order_acquire, memory_order_relaxed))
+        return;
+    futex_lock_slow(&l->state, c);
+}
+
+void adaptive_unlock(struct adaptive_lock *l) {
+    futex_unlock_state(&l->state);
+}
@@ -0,0 +1,93 @@
+/*
+ * locks.h
+ *
+ * A small library of mutual exclusion locks, to compare against
+ * pthread_mutex_t in simplesync:
+ *
+ *   futex_mutex:    three-state futex mutex (0 free, 1 locked, 2 contended),
+ *                   waiters sleep in the kernel
+ *   ticket_lock:    FIFO spinlock, one shared "now serving" counter
+ *   mcs_lock:       FIFO queue lock, every waiter spins on its own node
+ *   clh_lock:       FIFO queue lock, every waiter spins on its predecessor's node
+ *   adaptive_lock:  futex mutex that first spins with exponential backoff
+ *                   and parks in the kernel only if that fails
+ *
+ * The spinning locks yield the CPU every SPIN_YIELD_EVERY iterations,
+ * so that they still make progress with more threads than CPUs.
+ */
+#ifndef LOCKS_H__
+#define LOCKS_H__
+
+#include <stdatomic.h>
+
+#define CACHE_LINE_SIZE 64
+#define SPIN_YIELD_EVERY 128
+
+/* Spin iterations of adaptive_lock before parking, and its backoff cap */
+#define ADAPTIVE_SPIN_LIMIT 100
+#define ADAPTIVE_MAX_BACKOFF 1024
+
+struct futex_mutex {
+    atomic_int state;
+};
+
+struct ticket_lock {
+    atomic_uint next;      /* Next ticket to hand out */
+    atomic_uint owner;     /* Ticket currently allowed in */
+};
+
+struct mcs_node {
+    struct mcs_node *_Atomic next;
+    atomic_int locked;
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+struct mcs_lock {
+    struct mcs_node *_Atomic tail;
+};
+
+struct clh_node {
+    atomic_int locked;
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+struct clh_lock {
+    struct clh_node *_Atomic tail;
+};
+
+/*
+ * Per-thread CLH state: the node a thread enqueues changes with every
+ * acquisition (it takes over its predecessor's node on unlock).
+ */
+struct clh_thread {
+    struct clh_node *node;
+    struct clh_node *pred;
+};
+
+struct adaptive_lock {
+    atomic_int state;      /* Same states as futex_mutex */
+};
+
+void futex_mutex_init(struct futex_mutex *l);
+void futex_mutex_lock(struct futex_mutex *l);
+void futex_mutex_unlock(struct futex_mutex *l);
+
+void ticket_lock_init(struct ticket_lock *l);
+void ticket_lock(struct ticket_lock *l);
+void ticket_unlock(struct ticket_lock *l);
+
+void mcs_lock_init(struct mcs_lock *l);
+void mcs_lock(struct mcs_lock *l, struct mcs_node *me);
+void mcs_unlock(struct mcs_lock *l, struct mcs_node *me);
+
+/* clh_lock_init() allocates the initial dummy node, clh_thread_init() a thread's node */
+void clh_lock_init(struct clh_lock *l);
+void clh_lock_destroy(struct clh_lock *l);
+void clh_thread_init(struct clh_thread *t);
+void clh_thread_destroy(struct clh_thread *t);
+void clh_lock(struct clh_lock *l, struct clh_thread *t);
+void clh_unlock(struct clh_lock *l, struct clh_thread *t);
+
+void adaptive_lock_init(struct adaptive_lock *l);
+void adaptive_lock(struct adaptive_lock *l);
+void adaptive_unlock(struct adaptive_lock *l);
+
+#endif /* LOCKS_H__ */
@@ -0,0 +1,92 @@
+/*
+ * mandel-curve.c
+ *
+ * Tile orders along space-filling curves. See mandel-curve.h.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mandel-curve.h"
+
+const char *tile_order_names[NR_TILE_ORDERS] = {
+    [TILE_ROWS] = "rows",
+    [TILE_MORTON] = "morton",
+    [TILE_HILBERT] = "hilbert",
+};
+
+int tile_order_parse(const char *name) {
+    int o;
+
+    for (o = 0; o < NR_TILE_ORDERS; o++)
+        if (strcmp(name, tile_order_names[o]) == 0)
+            return o;
+    return -1;
+}
+
+static long morton_key(int x, int y) {
+    long d = 0;
+    int b;
+
+    // Grids up to 65536 tiles a side
+    for (b = 0; b < 16; b++)
+        d |= (long)((x >> b) & 1) << (2 * b) | (long)((y >> b) & 1) << (2 * b + 1);
+    return d;
+}
+
+/* Distance of (x, y) along the Hilbert curve through an n by n grid, n a power of two */
+static long hilbert_key(int n, int x, int y) {
+    long d = 0;
+    int s, rx, ry, t;
+
+    for (s = n / 2; s > 0; s /= 2) {
+        rx = (x & s) > 0;
+        ry = (y & s) > 0;
+        d += (long)s * s * ((3 * rx) ^ ry);
+        // Rotate the quadrant so that the curve inside it starts and ends right
+        if (ry == 0) {
+            if (rx == 1) {
+                x = n - 1 - x;
+                y = n - 1 - y;
+            }
+            t = x;
+            x = y;
+            y = t;
+        }
+    }
+    return d;
+}
+
+struct keyed_tile {
+    long key;
+    int tile;
+};
+
+static int compare_keys(const void *a, const void *b) {
+    long ka = ((const struct keyed_tile *)a)->key, kb = ((const struct keyed_tile *)b)->key;
+
+    return (ka > kb) - (ka < kb);
+}
+
+void tile_order_grid(enum tile_order order, int nx, int ny, int tiles[]) {
+    struct keyed_tile *k;
+    int n = 1, tx, ty, i;
+
+    while (n < nx || n < ny)
+        n *= 2;
+    if ((k = malloc((size_t)nx * ny * sizeof(*k))) == NULL) {
+        fprintf(stderr, "Out of memory, failed to order %d tiles\n", nx * ny);
+        exit(1);
+    }
+    for (ty = 0; ty < ny; ty++)
+        for (tx = 0; tx < nx; tx++) {
+            i = ty * nx + tx;
+            k[i].tile = i;
+            k[i].key = order == TILE_MORTON ? morton_key(tx, ty) :
+                       order == TILE_HILBERT ? hilbert_key(n, tx, ty) : i;
+        }
+    // Keys are distinct, so the order is the same whatever qsort does
+    qsort(k, (size_t)nx * ny, sizeof(*k), compare_keys);
+    for (i = 0; i < nx * ny; i++)
+        tiles[i] = k[i].tile;
+    free(k);
+}
@@ -0,0 +1,34 @@
+/*
+ * mandel-curve.h
+ *
+ * The order the tiles of a frame are handed out in. Along a space-filling
+ * curve, tiles claimed one after the other are neighbors in both
+ * directions, so a worker's tiles, and the tiles of workers that claim at
+ * the same time, stay close together:
+ *
+ *   rows:     row-major, left to right and top to bottom
+ *   morton:   Z-order, the bits of x and y interleaved
+ *   hilbert:  Hilbert curve, every tile adjacent to the next one
+ *
+ * Grids that are not a power of two square follow the curve of the
+ * smallest one that covers them, skipping the tiles outside.
+ */
+#ifndef MANDEL_CURVE_H__
+#define MANDEL_CURVE_H__
+
+enum tile_order {
+    TILE_ROWS,
+    TILE_MORTON,
+    TILE_HILBERT,
+    NR_TILE_ORDERS
+};
+
+extern const char *tile_order_names[NR_TILE_ORDERS];
+
+/* Order by name, -1 if there is none */
+int tile_order_parse(const char *name);
+
+/* The tiles ty * nx + tx of an nx by ny grid into tiles[0..nx * ny), in order */
+void tile_order_grid(enum tile_order order, int nx, int ny, int tiles[]);
+
+#endif /* MANDEL_CURVE_H__ */
@@ -0,0 +1,324 @@
+/*
+ * mandel-deep.c
+ *
+ * Deep zooms by perturbation. See mandel-deep.h.
+ */
+// The double-double operations rely on every rounding happening where it is written
+#pragma GCC optimize("fp-contract=off")
+
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <immintrin.h>
+#include "mandel-deep.h"
+#include "mandel-simd.h"
+
+/*
+ * Double-double arithmetic (Dekker, Knuth): two_sum and two_prod give the
+ * exact rounding error of an addition and a multiplication.
+ */
+static struct dd two_sum(double a, double b) {
+    struct dd r;
+    double v;
+
+    r.hi = a + b;
+    v = r.hi - a;
+    r.lo = (a - (r.hi - v)) + (b - v);
+    return r;
+}
+
+static struct dd quick_two_sum(double a, double b) {
+    struct dd r;
+
+    r.hi = a + b;
+    r.lo = b - (r.hi - a);
+    return r;
+}
+
+static struct dd dd_add(struct dd a, struct dd b) {
+    struct dd s = two_sum(a.hi, b.hi), t = two_sum(a.lo, b.lo);
+
+    s.lo += t.hi;
+    s = quick_two_sum(s.hi, s.lo);
+    s.lo += t.lo;
+    return quick_two_sum(s.hi, s.lo);
+}
+
+static struct dd dd_mul(struct dd a, struct dd b) {
+    struct dd p;
+
+    p.hi = a.hi * b.hi;
+    p.lo = fma(a.hi, b.hi, -p.hi);
+    p.lo += a.hi * b.lo + a.lo * b.hi;
+    return quick_two_sum(p.hi, p.lo);
+}
+
+static struct dd dd_mul_d(struct dd a, double b) {
+    struct dd p;
+
+    p.hi = a.hi * b;
+    p.lo = fma(a.hi, b, -p.hi);
+    p.lo += a.lo * b;
+    return quick_two_sum(p.hi, p.lo);
+}
+
+static struct dd dd_div_d(struct dd a, double b) {
+    struct dd q, r;
+
+    // One correction step on top of the double quotient
+    q.hi = a.hi / b;
+    r = dd_add(a, dd_mul_d((struct dd){ q.hi, 0 }, -b));
+    q.lo = (r.hi + r.lo) / b;
+    return quick_two_sum(q.hi, q.lo);
+}
+
+int dd_parse(const char *s, struct dd *d) {
+    struct dd v = { 0, 0 };
+    int neg = 0, digits = 0, frac = 0, point = 0, exp = 0, n;
+    char *end;
+
+    while (isspace((unsigned char)*s))
+        s++;
+    if (*s == '-' || *s == '+')
+        neg = *s++ == '-';
+    for (; isdigit((unsigned char)*s) || (*s == '.' && !point); s++) {
+        if (*s == '.') {
+            point = 1;
+            continue;
+        }
+        v = dd_add(dd_mul_d(v, 10), (struct dd){ *s - '0', 0 });
+        digits++;
+        frac += point;
+    }
+    if (digits == 0)
+        return -1;
+    if (*s == 'e' || *s == 'E') {
+        exp = strtol(s + 1, &end, 10);
+        if (end == s + 1)
+            return -1;
+        s = end;
+    }
+    if (*s != '\0')
+        return -1;
+
+    for (n = exp - frac; n > 0; n--)
+        v = dd_mul_d(v, 10);
+    for (; n < 0; n++)
+        v = dd_div_d(v, 10);
+    if (neg) {
+        v.hi = -v.hi;
+        v.lo = -v.lo;
+    }
+    *d = v;
+    return 0;
+}
+
+void deep_ref_init(struct deep_ref *ref, struct dd cx, struct dd cy, int max_iter) {
+    struct dd x = { 0, 0 }, y = { 0, 0 }, x2, y2, t;
+    int k;
+
+    ref->cx = cx;
+    ref->cy = cy;
+    ref->max_iter = max_iter;
+    ref->zx = malloc((max_iter + 1) * sizeof(*ref->zx));
+    ref->zy = malloc((max_iter + 1) * sizeof(*ref->zy));
+    if (ref->zx == NULL || ref->zy == NULL) {
+        fprintf(stderr, "Out of memory, failed to allocate the reference orbit\n");
+        exit(1);
+    }
+
+    // Z_0 = 0, Z_k+1 = Z_k^2 + C, kept until it escapes
+    for (k = 0; k <= max_iter; k++) {
+        ref->zx[k] = x.hi + x.lo;
+        ref->zy[k] = y.hi + y.lo;
+        x2 = dd_mul(x, x);
+        y2 = dd_mul(y, y);
+        if (x2.hi + y2.hi > 4.0) {
+            k++;
+            break;
+        }
+        t = dd_add(dd_add(x2, (struct dd){ -y2.hi, -y2.lo }), cx);
+        y = dd_add(dd_mul_d(dd_mul(x, y), 2), cy);
+        x = t;
+    }
+    ref->length = k;
+}
+
+void deep_ref_destroy(struct deep_ref *ref) {
+    free(ref->zx);
+    free(ref->zy);
+}
+
+/* One point: the orbit w_0 = 0, w_1 = c, ... is w_k = Z_m + d */
+static int deep_point(const struct deep_ref *ref, double dcx, double dcy, long *rebases) {
+    const double *zx = ref->zx, *zy = ref->zy;
+    double dx = 0, dy = 0, ax, ay, wx, wy, t, w2;
+    int k, m = 0;
+
+    for (k = 1; k <= ref->max_iter; k++) {
+        ax = 2 * zx[m] + dx;
+        ay = 2 * zy[m] + dy;
+        t = ax * dx - ay * dy + dcx;
+        dy = ax * dy + ay * dx + dcy;
+        dx = t;
+        m++;
+        wx = zx[m] + dx;
+        wy = zy[m] + dy;
+        w2 = wx * wx + wy * wy;
+        // w_k is mandel_iterations_at_point()'s z after k - 1 iterations
+        if (w2 > 4.0)
+            return k - 1;
+        // Glitch, or the end of the reference: carry on from Z_0 = 0
+        if (w2 < dx * dx + dy * dy || m == ref->length - 1) {
+            dx = wx;
+            dy = wy;
+            m = 0;
+            (*rebases)++;
+        }
+    }
+    return ref->max_iter;
+}
+
+static void deep_scalar(const struct deep_ref *ref, const double dxs[], const double dys[],
+                        int count, int iters[], long *rebases) {
+    int n;
+
+    for (n = 0; n < count; n++)
+        iters[n] = deep_point(ref, dxs[n], dys[n], rebases);
+}
+
+/*
+ * The same, 4 and 8 points at a time. Every lane has its own position m
+ * in the reference orbit, so Z_m is gathered; lanes that are done keep
+ * their m and are masked out of the gathers. Same operations in the same
+ * order as deep_point(), so the counts are the same too.
+ */
+__attribute__((target("avx2")))
+static void deep_avx2(const struct deep_ref *ref, const double dxs[], const double dys[],
+                      int count, int iters[], long *rebases) {
+    const __m256d two = _mm256_set1_pd(2.0), four = _mm256_set1_pd(4.0);
+    const __m256i one = _mm256_set1_epi64x(1), last = _mm256_set1_epi64x(ref->length - 1);
+    __m256d dcx, dcy, dx, dy, Zx, Zy, ax, ay, t, wx, wy, w2, active, esc, reb, res;
+    __m256i m;
+    double out[4];
+    int k, base, i;
+
+    for (base = 0; base + 4 <= count; base += 4) {
+        dcx = _mm256_loadu_pd(dxs + base);
+        dcy = _mm256_loadu_pd(dys + base);
+        dx = dy = Zx = Zy = _mm256_setzero_pd();
+        m = _mm256_setzero_si256();
+        res = _mm256_set1_pd(ref->max_iter);
+        active = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+        for (k = 1; k <= ref->max_iter; k++) {
+            ax = _mm256_add_pd(_mm256_mul_pd(two, Zx), dx);
+            ay = _mm256_add_pd(_mm256_mul_pd(two, Zy), dy);
+            t = _mm256_add_pd(_mm256_sub_pd(_mm256_mul_pd(ax, dx), _mm256_mul_pd(ay, dy)), dcx);
+            dy = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(ax, dy), _mm256_mul_pd(ay, dx)), dcy);
+            dx = t;
+            m = _mm256_add_epi64(m, _mm256_and_si256(_mm256_castpd_si256(active), one));
+            Zx = _mm256_mask_i64gather_pd(Zx, ref->zx, m, active, 8);
+            Zy = _mm256_mask_i64gather_pd(Zy, ref->zy, m, active, 8);
+            wx = _mm256_add_pd(Zx, dx);
+            wy = _mm256_add_pd(Zy, dy);
+            w2 = _mm256_add_pd(_mm256_mul_pd(wx, wx), _mm256_mul_pd(wy, wy));
+
+            esc = _mm256_and_pd(active, _mm256_cmp_pd(w2, four, _CMP_GT_OQ));
+            res = _mm256_blendv_pd(res, _mm256_set1_pd(k - 1), esc);
+            active = _mm256_andnot_pd(esc, active);
+            if (_mm256_movemask_pd(active) == 0)
+                break;
+
+            reb = _mm256_or_pd(_mm256_cmp_pd(w2, _mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy)),
+                                             _CMP_LT_OQ),
+                               _mm256_castsi256_pd(_mm256_cmpeq_epi64(m, last)));
+            reb = _mm256_and_pd(active, reb);
+            if (_mm256_movemask_pd(reb)) {
+                dx = _mm256_blendv_pd(dx, wx, reb);
+                dy = _mm256_blendv_pd(dy, wy, reb);
+                Zx = _mm256_andnot_pd(reb, Zx);
+                Zy = _mm256_andnot_pd(reb, Zy);
+                m = _mm256_andnot_si256(_mm256_castpd_si256(reb), m);
+                *rebases += __builtin_popcount(_mm256_movemask_pd(reb));
+            }
+        }
+        _mm256_storeu_pd(out, res);
+        for (i = 0; i < 4; i++)
+            iters[base + i] = out[i];
+    }
+    deep_scalar(ref, dxs + base, dys + base, count - base, iters + base, rebases);
+}
+
+__attribute__((target("avx512f")))
+static void deep_avx512(const struct deep_ref *ref, const double dxs[], const double dys[],
+                        int count, int iters[], long *rebases) {
+    const __m512d two = _mm512_set1_pd(2.0), four = _mm512_set1_pd(4.0);
+    const __m512i one = _mm512_set1_epi64(1), last = _mm512_set1_epi64(ref->length - 1);
+    __m512d dcx, dcy, dx, dy, Zx, Zy, ax, ay, t, wx, wy, w2, res;
+    __mmask8 active, esc, reb;
+    __m512i m;
+    double out[8];
+    int k, base, i;
+
+    for (base = 0; base + 8 <= count; base += 8) {
+        dcx = _mm512_loadu_pd(dxs + base);
+        dcy = _mm512_loadu_pd(dys + base);
+        dx = dy = Zx = Zy = _mm512_setzero_pd();
+        m = _mm512_setzero_si512();
+        res = _mm512_set1_pd(ref->max_iter);
+        active = 0xff;
+        for (k = 1; k <= ref->max_iter; k++) {
+            ax = _mm512_add_pd(_mm512_mul_pd(two, Zx), dx);
+            ay = _mm512_add_pd(_mm512_mul_pd(two, Zy), dy);
+            t = _mm512_add_pd(_mm512_sub_pd(_mm512_mul_pd(ax, dx), _mm512_mul_pd(ay, dy)), dcx);
+            dy = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(ax, dy), _mm512_mul_pd(ay, dx)), dcy);
+            dx = t;
+            m = _mm512_mask_add_epi64(m, active, m, one);
+            Zx = _mm512_mask_i64gather_pd(Zx, active, m, ref->zx, 8);
+            Zy = _mm512_mask_i64gather_pd(Zy, active, m, ref->zy, 8);
+            wx = _mm512_add_pd(Zx, dx);
+            wy = _mm512_add_pd(Zy, dy);
+            w2 = _mm512_add_pd(_mm512_mul_pd(wx, wx), _mm512_mul_pd(wy, wy));
+
+            esc = _mm512_mask_cmp_pd_mask(active, w2, four, _CMP_GT_OQ);
+            res = _mm512_mask_mov_pd(res, esc, _mm512_set1_pd(k - 1));
+            active &= ~esc;
+            if (active == 0)
+                break;
+
+            reb = _mm512_mask_cmp_pd_mask(active, w2,
+                                          _mm512_add_pd(_mm512_mul_pd(dx, dx), _mm512_mul_pd(dy, dy)),
+                                          _CMP_LT_OQ)
+                  | _mm512_mask_cmpeq_epi64_mask(active, m, last);
+            if (reb) {
+                dx = _mm512_mask_mov_pd(dx, reb, wx);
+                dy = _mm512_mask_mov_pd(dy, reb, wy);
+                Zx = _mm512_mask_mov_pd(Zx, reb, _mm512_setzero_pd());
+                Zy = _mm512_mask_mov_pd(Zy, reb, _mm512_setzero_pd());
+                m = _mm512_mask_mov_epi64(m, reb, _mm512_setzero_si512());
+                *rebases += __builtin_popcount(reb);
+            }
+        }
+        _mm512_storeu_pd(out, res);
+        for (i = 0; i < 8; i++)
+            iters[base + i] = out[i];
+    }
+    deep_avx2(ref, dxs + base, dys + base, count - base, iters + base, rebases);
+}
+
+void deep_points_iterations(const struct deep_ref *ref, const double dxs[], const double dys[],
+                            int count, int iters[], long *rebases) {
+    // Gathers need AVX2, SSE2 machines use the scalar loop
+    switch (mandel_simd_variant()) {
+    case MANDEL_SIMD_AVX512:
+        deep_avx512(ref, dxs, dys, count, iters, rebases);
+        break;
+    case MANDEL_SIMD_AVX2:
+        deep_avx2(ref, dxs, dys, count, iters, rebases);
+        break;
+    default:
+        deep_scalar(ref, dxs, dys, count, iters, rebases);
+        break;
+    }
+}
@@ -0,0 +1,49 @@
+/*
+ * mandel-deep.h
+ *
+ * Deep zooms by perturbation. Past a magnification of about 1e13 the
+ * points of a view are no longer distinct doubles, so one reference orbit
+ * is computed at the view's center in double-double arithmetic (about 32
+ * significant digits) and every point only iterates its difference from
+ * it, which is small and fits a double:
+ *
+ *   z = Z + d,  d' = (2Z + d) d + dc
+ *
+ * where dc is the point's offset from the center. When z comes closer to
+ * 0 than d is large, d no longer follows the reference well (a "glitch"):
+ * d is rebased onto the start of the reference orbit, d = z, which is
+ * also what happens when the reference escapes before the point does.
+ *
+ * Counts follow mandel_iterations_at_point(): z starts at c, and the count
+ * is the number of iterations started with |z|^2 <= 4.
+ */
+#ifndef MANDEL_DEEP_H__
+#define MANDEL_DEEP_H__
+
+/* Double-double: the unevaluated sum hi + lo, |lo| <= ulp(hi) / 2 */
+struct dd {
+    double hi, lo;
+};
+
+struct deep_ref {
+    struct dd cx, cy;       /* Center of the view */
+    int max_iter;
+    int length;             /* Orbit points computed: zx[0..length) */
+    double *zx, *zy;        /* Reference orbit, rounded to double, zx[0] = 0 */
+};
+
+/* Parse a decimal number ("-0.7436438870371587047521915", "1e-20") at full precision */
+int dd_parse(const char *s, struct dd *d);
+
+/* Compute the reference orbit at (cx, cy) for up to max_iter iterations */
+void deep_ref_init(struct deep_ref *ref, struct dd cx, struct dd cy, int max_iter);
+void deep_ref_destroy(struct deep_ref *ref);
+
+/*
+ * iters[n] for the points (cx + dxs[n], cy + dys[n]); *rebases counts the
+ * rebased iterations
+ */
+void deep_points_iterations(const struct deep_ref *ref, const double dxs[], const double dys[],
+                            int count, int iters[], long *rebases);
+
+#endif /* MANDEL_DEEP_H__ */
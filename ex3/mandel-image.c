@@ -0,0 +1,85 @@
+/*
+ * mandel-image.c
+ *
+ * Binary image output for the Mandelbrot renderers. See mandel-image.h.
+ */
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "mandel-image.h"
+
+static int has_suffix(const char *s, const char *suffix) {
+    size_t n = strlen(s), m = strlen(suffix);
+    return n >= m && strcmp(s + n - m, suffix) == 0;
+}
+
+void mandel_image_create(struct mandel_image *im, const char *path, int width, int height) {
+    char header[128];
+    int len, ret;
+
+    im->format = has_suffix(path, ".pam") ? IMAGE_PAM : IMAGE_PPM;
+    im->width = width;
+    im->height = height;
+    if (im->format == IMAGE_PAM)
+        len = snprintf(header, sizeof(header),
+                       "P7\nWIDTH %d\nHEIGHT %d\nDEPTH 3\nMAXVAL 255\nTUPLTYPE RGB\nENDHDR\n",
+                       width, height);
+    else
+        len = snprintf(header, sizeof(header), "P6\n%d %d\n255\n", width, height);
+    im->size = len + (size_t)width * height * 3;
+
+    im->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (im->fd < 0) {
+        perror(path);
+        exit(1);
+    }
+    // Allocate the blocks now: running out of space later would be a SIGBUS in a writer
+    ret = posix_fallocate(im->fd, 0, im->size);
+    if (ret) {
+        fprintf(stderr, "%s: posix_fallocate: %s\n", path, strerror(ret));
+        exit(1);
+    }
+    im->map = mmap(NULL, im->size, PROT_READ | PROT_WRITE, MAP_SHARED, im->fd, 0);
+    if (im->map == MAP_FAILED) {
+        perror("mandel_image_create: mmap");
+        exit(1);
+    }
+    memcpy(im->map, header, len);
+    im->pixels = im->map + len;
+}
+
+/* A cyclic palette: smooth polynomials of the iteration count mod 256 */
+static void iter_rgb(int it, int max_iter, unsigned char rgb[3]) {
+    double t;
+
+    if (it >= max_iter) {
+        rgb[0] = rgb[1] = rgb[2] = 0;
+        return;
+    }
+    t = (it % 256) / 255.0;
+    rgb[0] = 9 * (1 - t) * t * t * t * 255;
+    rgb[1] = 15 * (1 - t) * (1 - t) * t * t * 255;
+    rgb[2] = 8.5 * (1 - t) * (1 - t) * (1 - t) * t * 255;
+}
+
+void mandel_image_put_row(struct mandel_image *im, int line, const int iters[], int max_iter) {
+    unsigned char *p = im->pixels + (size_t)line * im->width * 3;
+    int n;
+
+    for (n = 0; n < im->width; n++, p += 3)
+        iter_rgb(iters[n], max_iter, p);
+}
+
+void mandel_image_close(struct mandel_image *im) {
+    if (munmap(im->map, im->size) == -1) {
+        perror("mandel_image_close: munmap");
+        exit(1);
+    }
+    if (close(im->fd) == -1) {
+        perror("mandel_image_close: close");
+        exit(1);
+    }
+}
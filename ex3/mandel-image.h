@@ -0,0 +1,41 @@
+/*
+ * mandel-image.h
+ *
+ * Binary image output for the Mandelbrot renderers. The file (binary PPM,
+ * or PAM for names ending in .pam) is created at its final size up front
+ * and mapped MAP_SHARED, so whoever computes a line turns it into RGB
+ * right where it belongs in the file: no staging buffer, no copying, and
+ * no ordering between the writers. Lines are independent, so threads and
+ * processes forked after mandel_image_create() can write them in any order.
+ *
+ * Build with -I../ex3 ../ex3/mandel-image.c from ex4.
+ */
+#ifndef MANDEL_IMAGE_H__
+#define MANDEL_IMAGE_H__
+
+#include <stddef.h>
+
+enum image_format {
+    IMAGE_PPM,
+    IMAGE_PAM
+};
+
+struct mandel_image {
+    enum image_format format;
+    int width, height;
+    int fd;
+    unsigned char *map;        /* The whole file */
+    size_t size;
+    unsigned char *pixels;     /* First pixel, after the header; 3 bytes each */
+};
+
+/* Create path (replacing any old file) at width x height and map it */
+void mandel_image_create(struct mandel_image *im, const char *path, int width, int height);
+
+/* Color line from its iteration counts; points that reach max_iter are black */
+void mandel_image_put_row(struct mandel_image *im, int line, const int iters[], int max_iter);
+
+/* Unmap and close; the file holds whatever lines were put */
+void mandel_image_close(struct mandel_image *im);
+
+#endif /* MANDEL_IMAGE_H__ */
@@ -0,0 +1,231 @@
+/*
+ * mandel-mariani.c
+ *
+ * Mariani-Silver subdivision for mandel-render. See mandel-mariani.h.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include "mandel-mariani.h"
+#include "mandel-render.h"
+
+static void *mariani_alloc(size_t size) {
+    void *p = malloc(size);
+
+    if (p == NULL) {
+        fprintf(stderr, "Out of memory, failed to allocate %zu bytes\n", size);
+        exit(1);
+    }
+    return p;
+}
+
+/* Called with the lock held */
+static void push(struct mariani_state *ms, int x, int y, int w, int h, int root) {
+    struct mariani_tile *t;
+
+    if (ms->nr_tiles == ms->size) {
+        ms->size = ms->size ? 2 * ms->size : 64;
+        ms->stack = realloc(ms->stack, ms->size * sizeof(*ms->stack));
+        if (ms->stack == NULL) {
+            fprintf(stderr, "Out of memory, failed to grow the tile stack\n");
+            exit(1);
+        }
+    }
+    t = &ms->stack[ms->nr_tiles++];
+    t->x = x;
+    t->y = y;
+    t->w = w;
+    t->h = h;
+    t->root = root;
+    ms->outstanding++;
+}
+
+void mariani_start(struct mandel_render *r) {
+    struct mariani_state *ms = mariani_alloc(sizeof(*ms));
+    int size = r->tile_size, x, y, n, nx, ny, *order;
+    double xv;
+
+    if (r->iters == NULL) {
+        fprintf(stderr, "mariani_start: tile renders need iters\n");
+        exit(1);
+    }
+    pthread_mutex_init(&ms->lock, NULL);
+    pthread_cond_init(&ms->more, NULL);
+    ms->stack = NULL;
+    ms->nr_tiles = ms->size = ms->outstanding = 0;
+    ms->iterated = 0;
+
+    // Accumulated like mandel_line_iterations() does, so the points are the same
+    ms->xs = mariani_alloc(r->view.width * sizeof(*ms->xs));
+    for (xv = r->view.xmin, n = 0; n < r->view.width; xv += r->xstep, n++)
+        ms->xs[n] = xv;
+    ms->ys = mariani_alloc(r->view.height * sizeof(*ms->ys));
+    for (n = 0; n < r->view.height; n++)
+        ms->ys[n] = r->view.ymax - r->ystep * n;
+
+    // Pushed backwards, so that the workers pop them in r->order (mandel-curve.h)
+    nx = (r->view.width + size - 1) / size;
+    ny = (r->view.height + size - 1) / size;
+    order = mariani_alloc((size_t)nx * ny * sizeof(*order));
+    tile_order_grid(r->order, nx, ny, order);
+    for (n = nx * ny - 1; n >= 0; n--) {
+        x = order[n] % nx * size;
+        y = order[n] / nx * size;
+        push(ms, x, y, size < r->view.width - x ? size : r->view.width - x,
+             size < r->view.height - y ? size : r->view.height - y, 1);
+    }
+    free(order);
+    r->tiles = ms;
+}
+
+/* Iterate count points of line starting at column col, MARIANI_CHUNK at a time */
+static void span(struct mandel_render *r, int line, int col, int count) {
+    struct mariani_state *ms = r->tiles;
+    double ys[MARIANI_CHUNK];
+    int base, n;
+
+    for (n = 0; n < MARIANI_CHUNK && n < count; n++)
+        ys[n] = ms->ys[line];
+    for (base = 0; base < count; base += MARIANI_CHUNK)
+        mandel_render_points(r, ms->xs + col + base, ys,
+                             count - base < MARIANI_CHUNK ? count - base : MARIANI_CHUNK,
+                             r->iters + (size_t)line * r->view.width + col + base);
+}
+
+/* Iterate the points of column col from line first to last, as many at once as a line */
+static void column(struct mandel_render *r, int col, int first, int last) {
+    struct mariani_state *ms = r->tiles;
+    double xs[MARIANI_CHUNK];
+    int iters[MARIANI_CHUNK];
+    int base, count, n;
+
+    for (n = 0; n < MARIANI_CHUNK; n++)
+        xs[n] = ms->xs[col];
+    for (base = first; base <= last; base += count) {
+        count = last - base + 1 < MARIANI_CHUNK ? last - base + 1 : MARIANI_CHUNK;
+        mandel_render_points(r, xs, ms->ys + base, count, iters);
+        for (n = 0; n < count; n++)
+            r->iters[(size_t)(base + n) * r->view.width + col] = iters[n];
+    }
+}
+
+/* The iteration count all along t's border, -1 if it is not the same everywhere */
+static int border_value(struct mandel_render *r, const struct mariani_tile *t) {
+    int *top = r->iters + (size_t)t->y * r->view.width + t->x;
+    int *bottom = top + (size_t)(t->h - 1) * r->view.width;
+    int v = top[0], i;
+
+    for (i = 0; i < t->w; i++)
+        if (top[i] != v || bottom[i] != v)
+            return -1;
+    for (i = 1; i < t->h - 1; i++)
+        if (top[i * r->view.width] != v || top[i * r->view.width + t->w - 1] != v)
+            return -1;
+    return v;
+}
+
+/*
+ * Settle t, return the number of halves put in children[] (0 or 2) and
+ * add the points iterated to *iterated
+ */
+static int tile(struct mandel_render *r, const struct mariani_tile *t,
+                struct mariani_tile children[2], long *iterated) {
+    int x = t->x, y = t->y, w = t->w, h = t->h;
+    int i, line, mid, v;
+
+    if (t->root) {
+        span(r, y, x, w);
+        if (h > 1)
+            span(r, y + h - 1, x, w);
+        column(r, x, y + 1, y + h - 2);
+        if (w > 1)
+            column(r, x + w - 1, y + 1, y + h - 2);
+        *iterated += w <= 2 || h <= 2 ? (long)w * h : 2 * w + 2 * h - 4;
+    }
+    if (w <= 2 || h <= 2)
+        return 0;
+
+    // Uniform border: fill the inside
+    if ((v = border_value(r, t)) >= 0) {
+        for (line = y + 1; line < y + h - 1; line++)
+            for (i = x + 1; i < x + w - 1; i++)
+                r->iters[(size_t)line * r->view.width + i] = v;
+        return 0;
+    }
+
+    if (w < MARIANI_MIN_SIZE || h < MARIANI_MIN_SIZE) {
+        for (line = y + 1; line < y + h - 1; line++)
+            span(r, line, x + 1, w - 2);
+        *iterated += (long)(w - 2) * (h - 2);
+        return 0;
+    }
+
+    // Split across the longer side; the split line becomes border of both halves
+    children[0] = children[1] = *t;
+    children[0].root = children[1].root = 0;
+    if (w >= h) {
+        mid = x + w / 2;
+        column(r, mid, y + 1, y + h - 2);
+        *iterated += h - 2;
+        children[0].w = mid - x + 1;
+        children[1].x = mid;
+        children[1].w = x + w - mid;
+    } else {
+        mid = y + h / 2;
+        span(r, mid, x + 1, w - 2);
+        *iterated += w - 2;
+        children[0].h = mid - y + 1;
+        children[1].y = mid;
+        children[1].h = y + h - mid;
+    }
+    return 2;
+}
+
+long mariani_work(struct mandel_render *r) {
+    struct mariani_state *ms = r->tiles;
+    struct mariani_tile t, children[2];
+    long tiles = 0, iterated;
+    int i, n, last = 0;
+
+    pthread_mutex_lock(&ms->lock);
+    for (;;) {
+        while (ms->nr_tiles == 0 && ms->outstanding > 0)
+            pthread_cond_wait(&ms->more, &ms->lock);
+        if (ms->nr_tiles == 0)
+            break;
+        t = ms->stack[--ms->nr_tiles];
+        pthread_mutex_unlock(&ms->lock);
+
+        iterated = 0;
+        n = tile(r, &t, children, &iterated);
+        tiles++;
+
+        pthread_mutex_lock(&ms->lock);
+        for (i = 0; i < n; i++)
+            push(ms, children[i].x, children[i].y, children[i].w, children[i].h, 0);
+        ms->iterated += iterated;
+        if (--ms->outstanding == 0)
+            last = 1;
+        if (n > 0 || last)
+            pthread_cond_broadcast(&ms->more);
+    }
+    pthread_mutex_unlock(&ms->lock);
+
+    // Lines are only complete now
+    if (last && r->row_done)
+        for (i = 0; i < r->view.height; i++)
+            r->row_done(r, i, r->iters + (size_t)i * r->view.width);
+    return tiles;
+}
+
+void mariani_finish(struct mandel_render *r) {
+    struct mariani_state *ms = r->tiles;
+
+    r->iterated = ms->iterated;
+    pthread_mutex_destroy(&ms->lock);
+    pthread_cond_destroy(&ms->more);
+    free(ms->stack);
+    free(ms->xs);
+    free(ms->ys);
+    free(ms);
+    r->tiles = NULL;
+}
@@ -0,0 +1,62 @@
+/*
+ * mandel-mariani.h
+ *
+ * Mariani-Silver subdivision for mandel-render. The frame is cut into
+ * tiles; a tile whose border has a single iteration count is filled with
+ * it without iterating its inside, any other tile is split in two across
+ * its longer side, the split line is computed, and the halves (whose
+ * borders are then all known) go back on the render's tile stack. Workers
+ * of the pool take tiles from that stack, so subdivided tiles spread over
+ * all of them.
+ *
+ * Every tile writes only its own inside (root tiles their border too), and
+ * a tile's border is written before the tile is pushed, so no point is
+ * written twice and the workers need no other synchronization.
+ *
+ * The fill is the usual Mariani-Silver bet: a feature smaller than a tile
+ * and not touching its border is lost. Tiles smaller than
+ * MARIANI_MIN_SIZE are computed point by point.
+ */
+#ifndef MANDEL_MARIANI_H__
+#define MANDEL_MARIANI_H__
+
+#include <pthread.h>
+
+#define MARIANI_MIN_SIZE 6
+
+/* Points iterated per call, so that tiles of any size fit on the stack */
+#define MARIANI_CHUNK 1024
+
+struct mandel_render;
+
+struct mariani_tile {
+    int x, y;           /* Upper left point */
+    int w, h;
+    int root;           /* Border not computed yet */
+};
+
+struct mariani_state {
+    pthread_mutex_t lock;
+    pthread_cond_t more;           /* Workers wait here for tiles */
+    struct mariani_tile *stack;
+    int nr_tiles, size;
+    int outstanding;               /* Tiles pushed and not finished yet */
+    double *xs;                    /* x of every column */
+    double *ys;                    /* y of every line */
+    long iterated;                 /* Points actually iterated */
+};
+
+/* Cut r into tiles of tile_size; called at submission, r->iters must be set */
+void mariani_start(struct mandel_render *r);
+
+/*
+ * Work on r's tiles until there are none left, return how many this
+ * worker did. The worker that finishes the last one calls r->row_done for
+ * every line.
+ */
+long mariani_work(struct mandel_render *r);
+
+/* Free the tile state once every worker is out of mariani_work() */
+void mariani_finish(struct mandel_render *r);
+
+#endif /* MANDEL_MARIANI_H__ */
@@ -0,0 +1,39 @@
+/*
+ * mandel-output.c
+ *
+ * Terminal output encoder for the Mandelbrot renderers. See mandel-output.h.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "mandel-output.h"
+
+size_t mandel_encode_line(char *buf, const int color_val[], int width) {
+    char *p = buf;
+    int i, color = -1;
+
+    for (i = 0; i < width; i++) {
+        if (color_val[i] != color) {
+            color = color_val[i];
+            p += sprintf(p, "\033[38;5;%dm", color);
+        }
+        *p++ = '@';
+    }
+    *p++ = '\n';
+    return p - buf;
+}
+
+void mandel_write_all(int fd, const char *buf, size_t len) {
+    ssize_t ret;
+
+    while (len > 0) {
+        ret = write(fd, buf, len);
+        if (ret < 0) {
+            perror("mandel_write_all: write");
+            exit(1);
+        }
+        buf += ret;
+        len -= ret;
+    }
+}
@@ -0,0 +1,32 @@
+/*
+ * mandel-output.h
+ *
+ * Terminal output encoder for the Mandelbrot renderers. Instead of a
+ * set_xterm_color() and a one-byte write() per point, lines are built in a
+ * user-space buffer, with a color escape only where the color changes (and
+ * at the start of every line, so lines can be printed by anybody), and the
+ * buffer goes out with as few write() calls as the kernel allows.
+ *
+ * The escape is the same as set_xterm_color()'s, so the picture on the
+ * terminal is unchanged.
+ *
+ * Used by the ex3 and ex4 renderers; build with mandel-output.c (and
+ * -I../ex3 ../ex3/mandel-output.c from ex4).
+ */
+#ifndef MANDEL_OUTPUT_H__
+#define MANDEL_OUTPUT_H__
+
+#include <stddef.h>
+
+/* Worst case per point: "\033[38;5;255m@" */
+#define MANDEL_POINT_BYTES 12
+/* Buffer space for one encoded line, newline included */
+#define MANDEL_LINE_BYTES(width) ((size_t)(width) * MANDEL_POINT_BYTES + 1)
+
+/* Encode width points of color_val[] and a newline into buf, return the length */
+size_t mandel_encode_line(char *buf, const int color_val[], int width);
+
+/* write() all of buf, exit on errors */
+void mandel_write_all(int fd, const char *buf, size_t len);
+
+#endif /* MANDEL_OUTPUT_H__ */
@@ -0,0 +1,329 @@
+/*
+ * mandel-pool.c
+ *
+ * Draws a zoom into the Mandelbrot Set on a 256-color xterm, every frame
+ * its own render with its own view (mandel-render.h). All frames are
+ * submitted to one pool of worker threads at once and printed in order as
+ * they complete, so the workers go from frame to frame without being
+ * re-spawned and without waiting for the output.
+ *
+ * With -o the frames go to PPM/PAM files instead (mandel-image.h), every
+ * line written into the mapped file by the worker that computed it, so
+ * large images never pass through a frame buffer.
+ *
+ * With -d the frames are rendered by perturbation around one reference
+ * orbit at the zoom center (mandel-deep.h), for zooms past what doubles
+ * can resolve. With -p the kernels' precision is chosen (mandel-prec.h),
+ * and -p auto picks it frame by frame from the pixel step and the
+ * iteration limit: float for coarse frames with few iterations, then
+ * double, long double and perturbation as the zoom deepens.
+ *
+ * With -b the frames are handed out in square blocks instead of rows, in
+ * the order given with -O (mandel-curve.h). The timings end with every
+ * worker's CPU time and the busiest worker's against the mean, how well
+ * the work was balanced.
+ *
+ * Build: gcc -Wall -O2 -pthread -o mandel-pool mandel-pool.c mandel-render.c
+ *        mandel-sched.c mandel-simd.c mandel-output.c mandel-image.c
+ *        mandel-mariani.c mandel-deep.c mandel-prec.c mandel-curve.c
+ *        mandel-lib.o -lm
+ */
+#include <errno.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include "mandel-lib.h"
+#include "mandel-render.h"
+#include "mandel-output.h"
+#include "mandel-image.h"
+#include "mandel-deep.h"
+
+/* Where the zoom goes: Seahorse Valley, to more digits than a double holds */
+#define ZOOM_X "-0.743643887037158704752191506114774"
+#define ZOOM_Y "0.131825904205311970493132056385139"
+
+double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int safe_atoi(char *s, int *val) {
+    long l;
+    char *endp;
+    l = strtol(s, &endp, 10);
+    if (s != endp && *endp == '\0') {
+        *val = l;
+        return 0;
+    } else
+        return -1;
+}
+
+void *safe_malloc(size_t size) {
+    void *p;
+    if ((p = malloc(size)) == NULL) {
+        fprintf(stderr, "Out of memory, failed to allocate %zu bytes\n", size);
+        exit(1);
+    }
+    return p;
+}
+
+void usage(char *argv0) {
+    fprintf(stderr, "Usage: %s [-t threads] [-n frames] [-z zoom] [-i max_iter] [-W width] [-H height]\n"
+            "       [-s chunked|guided|atomic] [-k chunk] [-o file.ppm|file.pam] [-f] [-m tile]\n"
+            "       [-d] [-p float|double|long|deep|auto] [-b block] [-O rows|morton|hilbert]\n"
+            "       [-x re] [-y im] [-q]\n\n"
+            " -t: worker threads in the pool (default: 4)\n"
+            " -n: frames to render (default: 4)\n"
+            " -z: magnification from one frame to the next (default: 4)\n"
+            " -i: iteration limit (default: 100000)\n"
+            " -W, -H: frame size in characters or pixels (default: 90x50)\n"
+            " -s, -k: how the rows of a frame are shared out (default: chunked, see mandel-sched.h)\n"
+            " -o: write the frames to this image file instead of the terminal, with\n"
+            "     more than one frame the frame number goes before the extension\n"
+            " -f: fast kernel, interior points skipped and mirrored lines reused\n"
+            "     (mandel-render.h), same picture\n"
+            " -m: Mariani-Silver subdivision from tiles of this size (mandel-mariani.h)\n"
+            " -d: deep zoom, perturbation around a double-double reference orbit (-p deep)\n"
+            " -p: precision of the kernels, auto picks the cheapest that resolves\n"
+            "     the pixels of each frame at this -i (default: double, see mandel-prec.h)\n"
+            " -b: hand out square blocks of this size instead of rows\n"
+            " -O: order of the blocks and Mariani-Silver tiles (default: hilbert)\n"
+            " -x, -y: the point the zoom goes to (default: %s + %s i)\n"
+            " -q: only report the timings, do not draw\n", argv0, ZOOM_X, ZOOM_Y);
+    exit(1);
+}
+
+/* The worker that computed a line colors it straight into the mapped file */
+void image_row(struct mandel_render *r, int line, const int iters[]) {
+    mandel_image_put_row(r->arg, line, iters, r->view.max_iter);
+}
+
+/* path for frame i of frames: file.ppm becomes file.i.ppm if there are several */
+char *frame_path(const char *path, int i, int frames) {
+    const char *ext = strrchr(path, '.');
+    char *name = safe_malloc(strlen(path) + 16);
+
+    if (frames == 1)
+        strcpy(name, path);
+    else if (ext == NULL || strchr(ext, '/'))
+        sprintf(name, "%s.%d", path, i);
+    else
+        sprintf(name, "%.*s.%d%s", (int)(ext - path), path, i, ext);
+    return name;
+}
+
+/*
+ * Print a finished frame: iteration counts to colors, as in the renderers,
+ * then the whole frame with a single write (mandel-output.h)
+ */
+void output_frame(int fd, struct mandel_render *r, int color_val[], char *buf) {
+    const struct mandel_view *v = &r->view;
+    size_t len = 0;
+    int line, n, val;
+
+    for (line = 0; line < v->height; line++) {
+        for (n = 0; n < v->width; n++) {
+            val = r->iters[line * v->width + n];
+            if (val > 255)
+                val = 255;
+            color_val[n] = xterm_color(val);
+        }
+        len += mandel_encode_line(buf + len, color_val, v->width);
+    }
+    mandel_write_all(fd, buf, len);
+}
+
+int main(int argc, char *argv[]) {
+    int i, opt, threads = 4, frames = 4, policy = ROW_CHUNKED, chunk = 0, quiet = 0, fast = 0, tile = 0;
+    int precision = MANDEL_PREC_DOUBLE, auto_precision = 0, have_ref = 0, prec, offsets;
+    int block = 0, order = TILE_HILBERT;
+    struct mandel_view view = {
+        .width = 90, .height = 50,
+        .xmin = -1.8, .xmax = 1.0, .ymin = -1.0, .ymax = 1.0,
+        .max_iter = 100000,
+    }, usual;
+    struct mandel_pool pool;
+    struct mandel_render *r;
+    struct mandel_image *im = NULL;
+    char *output = NULL, *name, *zoom_x = ZOOM_X, *zoom_y = ZOOM_Y;
+    struct deep_ref ref;
+    struct dd cx, cy;
+    double zoom = 4, scale = 1, start, wall, busy_max = 0, busy_sum = 0;
+    int *color_val;
+    char *buf;
+
+    while ((opt = getopt(argc, argv, "t:n:z:i:W:H:s:k:o:fm:dp:b:O:x:y:q")) != -1) {
+        if (opt == 't') {
+            if (safe_atoi(optarg, &threads) < 0 || threads <= 0)
+                usage(argv[0]);
+        } else if (opt == 'n') {
+            if (safe_atoi(optarg, &frames) < 0 || frames <= 0)
+                usage(argv[0]);
+        } else if (opt == 'z') {
+            if ((zoom = atof(optarg)) <= 1)
+                usage(argv[0]);
+        } else if (opt == 'i') {
+            if (safe_atoi(optarg, &view.max_iter) < 0 || view.max_iter <= 0)
+                usage(argv[0]);
+        } else if (opt == 'W') {
+            if (safe_atoi(optarg, &view.width) < 0 || view.width <= 0)
+                usage(argv[0]);
+        } else if (opt == 'H') {
+            if (safe_atoi(optarg, &view.height) < 0 || view.height <= 0)
+                usage(argv[0]);
+        } else if (opt == 's') {
+            if ((policy = row_policy_parse(optarg)) < 0 || policy == ROW_STATIC)
+                usage(argv[0]);
+        } else if (opt == 'k') {
+            if (safe_atoi(optarg, &chunk) < 0 || chunk <= 0)
+                usage(argv[0]);
+        } else if (opt == 'o') {
+            output = optarg;
+        } else if (opt == 'f') {
+            fast = 1;
+        } else if (opt == 'm') {
+            if (safe_atoi(optarg, &tile) < 0 || tile <= 0)
+                usage(argv[0]);
+        } else if (opt == 'd') {
+            precision = MANDEL_PREC_PERTURBATION;
+        } else if (opt == 'p') {
+            if (strcmp(optarg, "auto") == 0)
+                auto_precision = 1;
+            else if ((precision = mandel_precision_parse(optarg)) < 0)
+                usage(argv[0]);
+        } else if (opt == 'b') {
+            if (safe_atoi(optarg, &block) < 0 || block <= 0)
+                usage(argv[0]);
+        } else if (opt == 'O') {
+            if ((order = tile_order_parse(optarg)) < 0)
+                usage(argv[0]);
+        } else if (opt == 'x') {
+            zoom_x = optarg;
+        } else if (opt == 'y') {
+            zoom_y = optarg;
+        } else if (opt == 'q') {
+            quiet = 1;
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (optind != argc)
+        usage(argv[0]);
+    if (dd_parse(zoom_x, &cx) < 0 || dd_parse(zoom_y, &cy) < 0)
+        usage(argv[0]);
+
+    usual = view;
+    r = safe_malloc(frames * sizeof(*r));
+    if (output)
+        im = safe_malloc(frames * sizeof(*im));
+    color_val = safe_malloc(view.width * sizeof(*color_val));
+    buf = output || quiet ? NULL : safe_malloc(view.height * MANDEL_LINE_BYTES(view.width));
+
+    mandel_pool_init(&pool, threads);
+    start = now();
+
+    /*
+     * Frame 0 is the usual view, every next one zoom times closer to the
+     * zoom center. Perturbation frames, frame 0 included, are centered on
+     * the reference orbit; they and long double frames are given as
+     * offsets from the center.
+     */
+    for (i = 0; i < frames; i++) {
+        if (i > 0)
+            scale /= zoom;
+        prec = auto_precision ? mandel_precision_for(fmin(2.8 * scale / view.width, 2.0 * scale / view.height),
+                                                   view.max_iter)
+                              : precision;
+        offsets = prec == MANDEL_PREC_PERTURBATION || (i > 0 && prec == MANDEL_PREC_LONG_DOUBLE);
+        if (i == 0 && prec != MANDEL_PREC_PERTURBATION) {
+            view = usual;
+        } else {
+            view.xmin = (offsets ? 0 : cx.hi) - 1.4 * scale;
+            view.xmax = (offsets ? 0 : cx.hi) + 1.4 * scale;
+            view.ymin = (offsets ? 0 : cy.hi) - 1.0 * scale;
+            view.ymax = (offsets ? 0 : cy.hi) + 1.0 * scale;
+        }
+        // The reference orbit is only computed once a frame needs it
+        if (prec == MANDEL_PREC_PERTURBATION && !have_ref) {
+            deep_ref_init(&ref, cx, cy, view.max_iter);
+            have_ref = 1;
+        }
+        if (output) {
+            name = frame_path(output, i, frames);
+            mandel_image_create(&im[i], name, view.width, view.height);
+            free(name);
+            // Tile and block renders need the whole frame in memory, lines go out at the end
+            mandel_render_init(&r[i], &view,
+                               tile || block ? safe_malloc((size_t)view.width * view.height * sizeof(int)) : NULL,
+                               policy, chunk);
+            r[i].row_done = image_row;
+            r[i].arg = &im[i];
+        } else {
+            mandel_render_init(&r[i], &view, safe_malloc((size_t)view.width * view.height * sizeof(int)),
+                               policy, chunk);
+        }
+        r[i].fast = fast;
+        r[i].tile_size = tile;
+        r[i].block_size = block;
+        r[i].order = order;
+        r[i].deep = prec == MANDEL_PREC_PERTURBATION ? &ref : NULL;
+        r[i].precision = prec == MANDEL_PREC_PERTURBATION ? MANDEL_PREC_DOUBLE : prec;
+        if (offsets && prec == MANDEL_PREC_LONG_DOUBLE) {
+            r[i].ox = (long double)cx.hi + cx.lo;
+            r[i].oy = (long double)cy.hi + cy.lo;
+        }
+        mandel_render_submit(&pool, &r[i]);
+    }
+
+    for (i = 0; i < frames; i++) {
+        mandel_render_wait(&pool, &r[i]);
+        if (output) {
+            mandel_image_close(&im[i]);
+        } else if (!quiet) {
+            output_frame(1, &r[i], color_val, buf);
+            reset_xterm_color(1);
+            printf("\n");
+            fflush(stdout);
+        }
+        // Timings on stderr so that the pictures stay intact
+        fprintf(stderr, "frame %d: width %.3g, %s, latency %.3f ms",
+                i, r[i].view.xmax - r[i].view.xmin,
+                mandel_precision_names[r[i].deep ? MANDEL_PREC_PERTURBATION : r[i].precision],
+                (r[i].finished - r[i].submitted) * 1e3);
+        if (r[i].deep)
+            fprintf(stderr, ", %.2f rebases per point",
+                    r[i].rebases / ((double)r[i].view.width * r[i].view.height));
+        if (tile)
+            fprintf(stderr, ", %.1f%% of the points iterated",
+                    100.0 * r[i].iterated / ((double)r[i].view.width * r[i].view.height));
+        fprintf(stderr, "\n");
+    }
+    wall = now() - start;
+
+    for (i = 0; i < threads; i++) {
+        fprintf(stderr, "worker %d: %ld %s, busy %.3f ms\n",
+                i, pool.rows[i], tile ? "tiles" : block ? "blocks" : "rows", pool.busy[i] * 1e3);
+        busy_sum += pool.busy[i];
+        if (pool.busy[i] > busy_max)
+            busy_max = pool.busy[i];
+    }
+    fprintf(stderr, "%d frames of %dx%d, %d threads, %s schedule: wall %.3f ms, %.1f frames/s, "
+            "busy max/mean %.3f\n",
+            frames, view.width, view.height, threads, row_policy_names[policy],
+            wall * 1e3, frames / wall, busy_max / (busy_sum / threads));
+
+    mandel_pool_destroy(&pool);
+    if (have_ref)
+        deep_ref_destroy(&ref);
+    for (i = 0; i < frames; i++)
+        free(r[i].iters);
+    free(r);
+    free(im);
+    free(color_val);
+    free(buf);
+    return 0;
+}
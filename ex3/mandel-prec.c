@@ -0,0 +1,194 @@
+/*
+ * mandel-prec.c
+ *
+ * Float and long double kernels, and the choice of precision. See
+ * mandel-prec.h.
+ */
+#pragma GCC optimize("fp-contract=off")
+
+#include <float.h>
+#include <string.h>
+#include <immintrin.h>
+#include "mandel-prec.h"
+#include "mandel-simd.h"
+
+const char *mandel_precision_names[NR_MANDEL_PRECISIONS] = {
+    [MANDEL_PREC_DOUBLE] = "double",
+    [MANDEL_PREC_FLOAT] = "float",
+    [MANDEL_PREC_LONG_DOUBLE] = "long",
+    [MANDEL_PREC_PERTURBATION] = "deep",
+};
+
+int mandel_precision_parse(const char *name) {
+    int p;
+
+    for (p = 0; p < NR_MANDEL_PRECISIONS; p++)
+        if (strcmp(name, mandel_precision_names[p]) == 0)
+            return p;
+    return -1;
+}
+
+enum mandel_precision mandel_precision_for(double step, int max_iter) {
+    // Error budget of a whole orbit: one rounding of |z| ~ 2 per iteration
+    double budget = 2.0 * max_iter * PRECISION_MARGIN;
+
+    if (step >= FLT_EPSILON * budget)
+        return MANDEL_PREC_FLOAT;
+    if (step >= DBL_EPSILON * budget)
+        return MANDEL_PREC_DOUBLE;
+    if (step >= LDBL_EPSILON * budget)
+        return MANDEL_PREC_LONG_DOUBLE;
+    return MANDEL_PREC_PERTURBATION;
+}
+
+/* mandel_iterations_at_point() for any floating type T */
+#define DEFINE_ITERATIONS(name, T)                                  \
+static int name(T x0, T y0, int max) {                              \
+    T x = x0, y = y0, t;                                            \
+    int i;                                                          \
+                                                                    \
+    for (i = 0; i < max && x * x + y * y <= 4; i++) {               \
+        t = x * x - y * y + x0;                                     \
+        y = 2 * x * y + y0;                                         \
+        x = t;                                                      \
+    }                                                               \
+    return i;                                                       \
+}
+
+DEFINE_ITERATIONS(iterations_float, float)
+DEFINE_ITERATIONS(iterations_ld, long double)
+
+static void float_scalar(const double *xs, const double *ys, int count, int max, int iters[]) {
+    int n;
+
+    for (n = 0; n < count; n++)
+        iters[n] = iterations_float(xs[n], ys[n], max);
+}
+
+/*
+ * Same scheme as the double kernels of mandel-simd.c, in float lanes:
+ * twice as many per vector. Counts are kept in int lanes, where float
+ * would stop being exact above 2^24.
+ */
+__attribute__((target("sse2")))
+static void float_sse2(const double *xs, const double *ys, int count, int max, int iters[]) {
+    const __m128 four = _mm_set1_ps(4.0f), two = _mm_set1_ps(2.0f);
+    __m128 cx, cy, zx, zy, x2, y2, active;
+    __m128i n;
+    int i, base;
+
+    for (base = 0; base + 4 <= count; base += 4) {
+        cx = _mm_movelh_ps(_mm_cvtpd_ps(_mm_loadu_pd(xs + base)), _mm_cvtpd_ps(_mm_loadu_pd(xs + base + 2)));
+        cy = _mm_movelh_ps(_mm_cvtpd_ps(_mm_loadu_pd(ys + base)), _mm_cvtpd_ps(_mm_loadu_pd(ys + base + 2)));
+        zx = cx;
+        zy = cy;
+        n = _mm_setzero_si128();
+        active = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        for (i = 0; i < max; i++) {
+            x2 = _mm_mul_ps(zx, zx);
+            y2 = _mm_mul_ps(zy, zy);
+            active = _mm_and_ps(active, _mm_cmple_ps(_mm_add_ps(x2, y2), four));
+            if (_mm_movemask_ps(active) == 0)
+                break;
+            // Active lanes are all ones, i.e. -1
+            n = _mm_sub_epi32(n, _mm_castps_si128(active));
+            zy = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(two, zx), zy), cy);
+            zx = _mm_add_ps(_mm_sub_ps(x2, y2), cx);
+        }
+        _mm_storeu_si128((__m128i *)(iters + base), n);
+    }
+    float_scalar(xs + base, ys + base, count - base, max, iters + base);
+}
+
+__attribute__((target("avx2")))
+static void float_avx2(const double *xs, const double *ys, int count, int max, int iters[]) {
+    const __m256 four = _mm256_set1_ps(4.0f), two = _mm256_set1_ps(2.0f);
+    __m256 cx, cy, zx, zy, x2, y2, active;
+    __m256i n;
+    int i, base;
+
+    for (base = 0; base + 8 <= count; base += 8) {
+        cx = _mm256_set_m128(_mm256_cvtpd_ps(_mm256_loadu_pd(xs + base + 4)),
+                             _mm256_cvtpd_ps(_mm256_loadu_pd(xs + base)));
+        cy = _mm256_set_m128(_mm256_cvtpd_ps(_mm256_loadu_pd(ys + base + 4)),
+                             _mm256_cvtpd_ps(_mm256_loadu_pd(ys + base)));
+        zx = cx;
+        zy = cy;
+        n = _mm256_setzero_si256();
+        active = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        for (i = 0; i < max; i++) {
+            x2 = _mm256_mul_ps(zx, zx);
+            y2 = _mm256_mul_ps(zy, zy);
+            active = _mm256_and_ps(active, _mm256_cmp_ps(_mm256_add_ps(x2, y2), four, _CMP_LE_OQ));
+            if (_mm256_movemask_ps(active) == 0)
+                break;
+            n = _mm256_sub_epi32(n, _mm256_castps_si256(active));
+            zy = _mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(two, zx), zy), cy);
+            zx = _mm256_add_ps(_mm256_sub_ps(x2, y2), cx);
+        }
+        _mm256_storeu_si256((__m256i *)(iters + base), n);
+    }
+    float_scalar(xs + base, ys + base, count - base, max, iters + base);
+}
+
+/* 16 doubles rounded to float, with AVX-512F alone (no DQ insert) */
+__attribute__((target("avx512f")))
+static inline __m512 load_float16(const double *p) {
+    __m256 lo = _mm512_cvtpd_ps(_mm512_loadu_pd(p)), hi = _mm512_cvtpd_ps(_mm512_loadu_pd(p + 8));
+
+    return _mm512_castpd_ps(_mm512_insertf64x4(_mm512_castps_pd(_mm512_castps256_ps512(lo)),
+                                               _mm256_castps_pd(hi), 1));
+}
+
+__attribute__((target("avx512f")))
+static void float_avx512(const double *xs, const double *ys, int count, int max, int iters[]) {
+    const __m512 four = _mm512_set1_ps(4.0f), two = _mm512_set1_ps(2.0f);
+    const __m512i one = _mm512_set1_epi32(1);
+    __m512 cx, cy, zx, zy, x2, y2;
+    __m512i n;
+    __mmask16 active;
+    int i, base;
+
+    for (base = 0; base + 16 <= count; base += 16) {
+        cx = load_float16(xs + base);
+        cy = load_float16(ys + base);
+        zx = cx;
+        zy = cy;
+        n = _mm512_setzero_si512();
+        active = 0xffff;
+        for (i = 0; i < max; i++) {
+            x2 = _mm512_mul_ps(zx, zx);
+            y2 = _mm512_mul_ps(zy, zy);
+            active = _mm512_mask_cmp_ps_mask(active, _mm512_add_ps(x2, y2), four, _CMP_LE_OQ);
+            if (active == 0)
+                break;
+            n = _mm512_mask_add_epi32(n, active, n, one);
+            zy = _mm512_add_ps(_mm512_mul_ps(_mm512_mul_ps(two, zx), zy), cy);
+            zx = _mm512_add_ps(_mm512_sub_ps(x2, y2), cx);
+        }
+        _mm512_storeu_si512(iters + base, n);
+    }
+    float_avx2(xs + base, ys + base, count - base, max, iters + base);
+}
+
+typedef void float_fn(const double *xs, const double *ys, int count, int max, int iters[]);
+
+static float_fn *float_kernels[NR_MANDEL_SIMD] = {
+    [MANDEL_SIMD_SCALAR] = float_scalar,
+    [MANDEL_SIMD_SSE2] = float_sse2,
+    [MANDEL_SIMD_AVX2] = float_avx2,
+    [MANDEL_SIMD_AVX512] = float_avx512,
+};
+
+void mandel_points_iterations_float(const double xs[], const double ys[], int count, int max, int iters[]) {
+    float_kernels[mandel_simd_variant()](xs, ys, count, max, iters);
+}
+
+void mandel_points_iterations_ld(long double ox, long double oy, const double xs[], const double ys[],
+                                 int count, int max, int iters[]) {
+    int n;
+
+    // x87 has no vector form; the extra precision is the point here
+    for (n = 0; n < count; n++)
+        iters[n] = iterations_ld(ox + xs[n], oy + ys[n], max);
+}
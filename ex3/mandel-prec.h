@@ -0,0 +1,52 @@
+/*
+ * mandel-prec.h
+ *
+ * Line kernels in float and long double, next to the double ones of
+ * mandel-simd.h, and the choice between them. A shallow view does not
+ * need double: float kernels do twice the points per vector (8 with AVX2,
+ * 16 with AVX-512). A deep one needs more than double: the long double
+ * kernel (x87, 64-bit mantissa) takes points as offsets from an origin,
+ * so the view itself can still be given in doubles. Past that, only
+ * perturbation helps (mandel-deep.h).
+ *
+ * Rounding errors pile up over an orbit, so what a kernel can resolve
+ * depends on the iteration limit as well as on the pixel step.
+ * mandel_precision_for() picks the cheapest precision whose rounding
+ * error on |z| <= 2, summed over max_iter iterations, stays
+ * PRECISION_MARGIN times below the pixel step. Summing is still
+ * optimistic for orbits near the boundary, which amplify errors, hence the
+ * large margin. Even then, a few boundary points get different counts in
+ * different precisions, as they would between any two implementations.
+ * Past about 1e-6, perturbation is the most accurate of all; it is only
+ * chosen when the others fail, because it needs the reference orbit.
+ */
+#ifndef MANDEL_PREC_H__
+#define MANDEL_PREC_H__
+
+/* Headroom, in rounding errors of |z| ~ 2 times max_iter, that a pixel step must keep */
+#define PRECISION_MARGIN 1e4
+
+enum mandel_precision {
+    MANDEL_PREC_DOUBLE,            /* mandel-simd.h, the default */
+    MANDEL_PREC_FLOAT,
+    MANDEL_PREC_LONG_DOUBLE,
+    MANDEL_PREC_PERTURBATION,      /* mandel-deep.h */
+    NR_MANDEL_PRECISIONS
+};
+
+extern const char *mandel_precision_names[NR_MANDEL_PRECISIONS];
+
+/* Precision by name, -1 if there is none */
+int mandel_precision_parse(const char *name);
+
+/* The cheapest precision for a view with this pixel step and iteration limit */
+enum mandel_precision mandel_precision_for(double step, int max_iter);
+
+/* mandel_points_iterations(), iterated in float */
+void mandel_points_iterations_float(const double xs[], const double ys[], int count, int max, int iters[]);
+
+/* The same in long double, for the points (ox + xs[n], oy + ys[n]) */
+void mandel_points_iterations_ld(long double ox, long double oy, const double xs[], const double ys[],
+                                 int count, int max, int iters[]);
+
+#endif /* MANDEL_PREC_H__ */
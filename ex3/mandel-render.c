@@ -0,0 +1,387 @@
+/*
+ * mandel-render.c
+ *
+ * Reentrant Mandelbrot rendering and a persistent worker pool. See
+ * mandel-render.h.
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "mandel-render.h"
+#include "mandel-simd.h"
+#include "mandel-mariani.h"
+#include "mandel-deep.h"
+
+#define perror_pthread(ret, msg) \
+do { errno = ret; perror(msg); } while (0)
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* CPU time of the calling thread, which is what a worker's share is */
+static double thread_cpu(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void mandel_view_line(const struct mandel_view *v, int line, int iters[]) {
+    double xstep = (v->xmax - v->xmin) / v->width;
+    double ystep = (v->ymax - v->ymin) / v->height;
+
+    // Same points as compute_mandel_line() in the renderers for the same view
+    mandel_line_iterations(v->xmin, xstep, v->ymax - ystep * line, v->width, v->max_iter, iters);
+}
+
+void mandel_render_init(struct mandel_render *r, const struct mandel_view *v, int iters[],
+                        enum row_policy policy, int chunk) {
+    r->view = *v;
+    r->xstep = (v->xmax - v->xmin) / v->width;
+    r->ystep = (v->ymax - v->ymin) / v->height;
+    r->iters = iters;
+    r->row_done = NULL;
+    r->arg = NULL;
+    r->fast = 0;
+    r->tile_size = 0;
+    r->tiles = NULL;
+    r->iterated = 0;
+    r->deep = NULL;
+    r->rebases = 0;
+    r->precision = MANDEL_PREC_DOUBLE;
+    r->ox = r->oy = 0;
+    r->block_size = 0;
+    r->order = TILE_HILBERT;
+    r->blocks = NULL;
+    r->xs = NULL;
+    r->blocks_left = 0;
+    if (policy == ROW_STATIC)
+        policy = ROW_CHUNKED;
+    // nr_threads only matters to the guided policy, set at submission
+    row_sched_init(&r->sched, policy, v->height, 1, chunk);
+    r->next = NULL;
+    r->queued = r->active = r->done = 0;
+    r->submitted = r->finished = 0;
+}
+
+void mandel_render_points(struct mandel_render *r, const double xs[], const double ys[],
+                          int count, int iters[]) {
+    long rebases = 0;
+
+    if (r->deep) {
+        deep_points_iterations(r->deep, xs, ys, count, iters, &rebases);
+        __sync_add_and_fetch(&r->rebases, rebases);
+    } else if (r->precision == MANDEL_PREC_FLOAT) {
+        mandel_points_iterations_float(xs, ys, count, r->view.max_iter, iters);
+    } else if (r->precision == MANDEL_PREC_LONG_DOUBLE) {
+        mandel_points_iterations_ld(r->ox, r->oy, xs, ys, count, r->view.max_iter, iters);
+    } else if (r->fast) {
+        mandel_points_iterations_fast(xs, ys, count, r->view.max_iter, iters);
+    } else {
+        mandel_points_iterations(xs, ys, count, r->view.max_iter, iters);
+    }
+}
+
+/* Lines of r go through mandel_line_iterations(), no point arrays needed */
+static int plain_lines(const struct mandel_render *r) {
+    return r->deep == NULL && r->precision == MANDEL_PREC_DOUBLE;
+}
+
+/*
+ * Iterations of a whole line, the x accumulated like mandel_line_iterations()
+ * does; points holds 2 * width doubles unless plain_lines(r)
+ */
+static void line_iterations(struct mandel_render *r, int line, int iters[], double *points) {
+    int width = r->view.width, n;
+    double y = r->view.ymax - r->ystep * line, *xs = points, *ys = points + width, x;
+
+    if (plain_lines(r)) {
+        (r->fast ? mandel_line_iterations_fast : mandel_line_iterations)
+            (r->view.xmin, r->xstep, y, width, r->view.max_iter, iters);
+        return;
+    }
+    for (x = r->view.xmin, n = 0; n < width; x += r->xstep, n++) {
+        xs[n] = x;
+        ys[n] = y;
+    }
+    mandel_render_points(r, xs, ys, width, iters);
+}
+
+/* Take r off the queue; called with the lock held, r is the head */
+static void dequeue(struct mandel_pool *p, struct mandel_render *r) {
+    p->head = r->next;
+    if (p->head == NULL)
+        p->tail = NULL;
+    r->next = NULL;
+    r->queued = 0;
+}
+
+/* The line whose y is exactly -y of line, -1 if there is none */
+static int mirror_line(const struct mandel_render *r, int line) {
+    double y = r->view.ymax - r->ystep * line;
+    int m = lround((r->view.ymax + y) / r->ystep);
+
+    if (m < 0 || m >= r->view.height || m == line)
+        return -1;
+    return r->view.ymax - r->ystep * m == -y ? m : -1;
+}
+
+/* Compute line, and its mirror image if it has one */
+static int render_line(struct mandel_render *r, int line, int *line_iters, double *points) {
+    int m = r->fast && r->deep == NULL && r->precision == MANDEL_PREC_DOUBLE ? mirror_line(r, line) : -1;
+    size_t width = r->view.width;
+
+    // The lower of the two lines does the work for both
+    if (m >= 0 && m < line)
+        return 0;
+
+    if (line_iters == NULL)
+        line_iters = r->iters + line * width;
+    line_iterations(r, line, line_iters, points);
+    if (r->row_done)
+        r->row_done(r, line, line_iters);
+
+    if (m >= 0) {
+        if (r->iters)
+            memcpy(r->iters + m * width, line_iters, width * sizeof(*line_iters));
+        if (r->row_done)
+            r->row_done(r, m, line_iters);
+    }
+    return 1;
+}
+
+/* Claim and compute lines of r until there are none left, return how many */
+static long render_lines(struct mandel_render *r, int id) {
+    struct row_cursor cur;
+    long rows = 0;
+    int line, *scratch = NULL;
+    double *points = NULL;
+
+    // Per worker and render, on the heap: lines can be wider than a thread's stack
+    if ((r->iters == NULL && (scratch = malloc(r->view.width * sizeof(*scratch))) == NULL) ||
+        (!plain_lines(r) && (points = malloc(2 * (size_t)r->view.width * sizeof(*points))) == NULL)) {
+        fprintf(stderr, "Out of memory, failed to allocate a line\n");
+        exit(1);
+    }
+
+    row_cursor_init(&cur, id);
+    while ((line = row_sched_next(&r->sched, &cur)) >= 0)
+        rows += render_line(r, line, scratch, points);
+    free(scratch);
+    free(points);
+    return rows;
+}
+
+/* Number the blocks of r in r->order; called at submission */
+static void blocks_start(struct mandel_render *r) {
+    int size = r->block_size, n;
+    int nx = (r->view.width + size - 1) / size, ny = (r->view.height + size - 1) / size;
+    double x;
+
+    if (r->iters == NULL) {
+        fprintf(stderr, "blocks_start: block renders need iters\n");
+        exit(1);
+    }
+    r->blocks = malloc((size_t)nx * ny * sizeof(*r->blocks));
+    r->xs = malloc(r->view.width * sizeof(*r->xs));
+    if (r->blocks == NULL || r->xs == NULL) {
+        fprintf(stderr, "Out of memory, failed to allocate %d blocks\n", nx * ny);
+        exit(1);
+    }
+    tile_order_grid(r->order, nx, ny, r->blocks);
+    // Accumulated like mandel_line_iterations() does, so the points are the same
+    for (x = r->view.xmin, n = 0; n < r->view.width; x += r->xstep, n++)
+        r->xs[n] = x;
+    r->blocks_left = nx * ny;
+    r->sched.nr_rows = nx * ny;
+}
+
+/* Claim and compute blocks of r until there are none left, return how many */
+static long render_blocks(struct mandel_render *r, int id) {
+    int size = r->block_size, width = r->view.width, nx = (width + size - 1) / size;
+    int b, bx, by, w, h, line, n;
+    double y, *ys;
+    struct row_cursor cur;
+    long blocks = 0;
+
+    // On the heap, like the points of render_lines(): a block line can be as wide as the view
+    if ((ys = malloc((size < width ? size : width) * sizeof(*ys))) == NULL) {
+        fprintf(stderr, "Out of memory, failed to allocate a block line\n");
+        exit(1);
+    }
+
+    row_cursor_init(&cur, id);
+    while ((b = row_sched_next(&r->sched, &cur)) >= 0) {
+        bx = r->blocks[b] % nx * size;
+        by = r->blocks[b] / nx * size;
+        w = size < width - bx ? size : width - bx;
+        h = size < r->view.height - by ? size : r->view.height - by;
+        for (line = by; line < by + h; line++) {
+            y = r->view.ymax - r->ystep * line;
+            for (n = 0; n < w; n++)
+                ys[n] = y;
+            mandel_render_points(r, r->xs + bx, ys, w, r->iters + (size_t)line * width + bx);
+        }
+        blocks++;
+
+        // Lines are only complete once every block is
+        if (__sync_sub_and_fetch(&r->blocks_left, 1) == 0 && r->row_done)
+            for (line = 0; line < r->view.height; line++)
+                r->row_done(r, line, r->iters + (size_t)line * width);
+    }
+    free(ys);
+    return blocks;
+}
+
+struct worker_arg {
+    struct mandel_pool *pool;
+    int id;
+};
+
+static void *mandel_worker(void *arg) {
+    struct mandel_pool *p = ((struct worker_arg *)arg)->pool;
+    int id = ((struct worker_arg *)arg)->id;
+    struct mandel_render *r;
+    long rows;
+    double cpu;
+
+    free(arg);
+    pthread_mutex_lock(&p->lock);
+    for (;;) {
+        while (p->head == NULL && !p->shutdown)
+            pthread_cond_wait(&p->work, &p->lock);
+        if (p->head == NULL)
+            break;
+        r = p->head;
+        r->active++;
+        pthread_mutex_unlock(&p->lock);
+
+        // Tile renders hand out tiles instead of lines (mandel-mariani.h), block renders blocks
+        cpu = thread_cpu();
+        if (r->tile_size > 0)
+            rows = mariani_work(r);
+        else if (r->block_size > 0)
+            rows = render_blocks(r, id);
+        else
+            rows = render_lines(r, id);
+        cpu = thread_cpu() - cpu;
+
+        // Nothing left to claim: let the others skip it, the last one out finishes it
+        pthread_mutex_lock(&p->lock);
+        p->rows[id] += rows;
+        p->busy[id] += cpu;
+        if (r->queued)
+            dequeue(p, r);
+        if (--r->active == 0) {
+            if (r->tiles)
+                mariani_finish(r);
+            free(r->blocks);
+            free(r->xs);
+            r->blocks = NULL;
+            r->xs = NULL;
+            r->done = 1;
+            r->finished = now();
+            pthread_cond_broadcast(&p->done);
+        }
+    }
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+void mandel_pool_init(struct mandel_pool *p, int nr_threads) {
+    struct worker_arg *arg;
+    int i, ret;
+
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->work, NULL);
+    pthread_cond_init(&p->done, NULL);
+    p->head = p->tail = NULL;
+    p->nr_threads = nr_threads;
+    p->shutdown = 0;
+    p->threads = malloc(nr_threads * sizeof(*p->threads));
+    p->rows = calloc(nr_threads, sizeof(*p->rows));
+    p->busy = calloc(nr_threads, sizeof(*p->busy));
+    if (p->threads == NULL || p->rows == NULL || p->busy == NULL) {
+        fprintf(stderr, "Out of memory, failed to allocate the worker pool\n");
+        exit(1);
+    }
+
+    for (i = 0; i < nr_threads; i++) {
+        if ((arg = malloc(sizeof(*arg))) == NULL) {
+            fprintf(stderr, "Out of memory, failed to allocate the worker pool\n");
+            exit(1);
+        }
+        arg->pool = p;
+        arg->id = i;
+        ret = pthread_create(&p->threads[i], NULL, mandel_worker, arg);
+        if (ret) {
+            perror_pthread(ret, "pthread_create");
+            exit(1);
+        }
+    }
+}
+
+void mandel_pool_destroy(struct mandel_pool *p) {
+    int i, ret;
+
+    pthread_mutex_lock(&p->lock);
+    p->shutdown = 1;
+    pthread_cond_broadcast(&p->work);
+    pthread_mutex_unlock(&p->lock);
+
+    for (i = 0; i < p->nr_threads; i++) {
+        ret = pthread_join(p->threads[i], NULL);
+        if (ret) {
+            perror_pthread(ret, "pthread_join");
+            exit(1);
+        }
+    }
+    pthread_mutex_destroy(&p->lock);
+    pthread_cond_destroy(&p->work);
+    pthread_cond_destroy(&p->done);
+    free(p->threads);
+    free(p->rows);
+    free(p->busy);
+}
+
+void mandel_render_submit(struct mandel_pool *p, struct mandel_render *r) {
+    // A render can be submitted again once it is done
+    r->sched.nr_threads = p->nr_threads;
+    r->sched.nr_rows = r->view.height;
+    atomic_store_explicit(&r->sched.next, 0, memory_order_relaxed);
+    r->rebases = 0;
+    if (r->tile_size > 0)
+        mariani_start(r);
+    else if (r->block_size > 0)
+        blocks_start(r);
+    r->submitted = now();
+
+    pthread_mutex_lock(&p->lock);
+    r->next = NULL;
+    r->queued = 1;
+    r->active = r->done = 0;
+    if (p->tail)
+        p->tail->next = r;
+    else
+        p->head = r;
+    p->tail = r;
+    pthread_cond_broadcast(&p->work);
+    pthread_mutex_unlock(&p->lock);
+}
+
+void mandel_render_wait(struct mandel_pool *p, struct mandel_render *r) {
+    pthread_mutex_lock(&p->lock);
+    while (!r->done)
+        pthread_cond_wait(&p->done, &p->lock);
+    pthread_mutex_unlock(&p->lock);
+}
+
+void mandel_render(struct mandel_pool *p, struct mandel_render *r) {
+    mandel_render_submit(p, r);
+    mandel_render_wait(p, r);
+}
@@ -0,0 +1,142 @@
+/*
+ * mandel-render.h
+ *
+ * Reentrant Mandelbrot rendering. Everything the renderers keep in globals
+ * (resolution, region, iteration limit) lives in a struct mandel_view, so
+ * any number of renders with different views can run in one process.
+ *
+ * A struct mandel_pool is a set of worker threads that stay around and
+ * serve render after render. Renders are queued in submission order; the
+ * workers share out the rows of the oldest one (mandel-sched.h) and move
+ * on to the next as soon as no rows are left to claim, so a render may
+ * still be finishing while the next is under way.
+ *
+ * With fast set, a render uses mandel_line_iterations_fast(), and a line
+ * whose y is exactly the negation of another line's (the view straddles
+ * the real axis) is not computed but mirrored: the orbit of the conjugate
+ * point is the conjugate orbit, bit for bit, so the counts are the same.
+ *
+ * With deep set, the view's coordinates are offsets from the center of
+ * that reference orbit, and every point is iterated by perturbation
+ * (mandel-deep.h), which keeps working far past the 1e-13 or so where
+ * doubles run out. Mirrored lines are not used then.
+ *
+ * precision picks the kernels of mandel-prec.h instead of the double ones:
+ * float for shallow views, or long double, which adds (ox, oy) to the
+ * view's coordinates so that a view deeper than doubles can resolve can be
+ * given as offsets around a center known more precisely. fast applies to
+ * the double kernels only. mandel_precision_for() on the pixel step and
+ * max_iter picks the cheapest one that will do; deep, when set, takes
+ * precedence.
+ *
+ * With tile_size set, a render is not computed line by line but by
+ * Mariani-Silver subdivision from tiles of that size (mandel-mariani.h),
+ * the workers sharing out the tiles. That needs iters; row_done is called
+ * for every line once the last tile is done.
+ *
+ * With block_size set, a render is handed out in square blocks of that
+ * size instead of lines, in the order of mandel-curve.h: a block mixes
+ * cheap and expensive points less than a line that crosses the whole
+ * frame, and the workers' blocks stay together. The row policy then
+ * decides how many blocks a claim takes. Like tiles, blocks need iters,
+ * and row_done is called for every line once the last block is done.
+ * The order also applies to the root tiles of Mariani-Silver renders.
+ *
+ * Only the shared row policies make sense here (a worker has no fixed
+ * share of a render), ROW_STATIC is treated as ROW_CHUNKED.
+ */
+#ifndef MANDEL_RENDER_H__
+#define MANDEL_RENDER_H__
+
+#include <pthread.h>
+#include "mandel-sched.h"
+#include "mandel-prec.h"
+#include "mandel-curve.h"
+
+struct mariani_state;
+struct deep_ref;
+
+struct mandel_view {
+    int width;                     /* Points per line */
+    int height;                    /* Lines */
+    double xmin, xmax, ymin, ymax; /* Upper left corner is (xmin, ymax) */
+    int max_iter;
+};
+
+struct mandel_render {
+    struct mandel_view view;
+    double xstep, ystep;
+    int *iters;                    /* height lines of width iteration counts, or NULL */
+    struct row_sched sched;
+
+    /*
+     * If set, called by the worker with every line it finishes. With iters
+     * NULL the line is only in a per-worker buffer, valid during the call.
+     */
+    void (*row_done)(struct mandel_render *r, int line, const int iters[]);
+    void *arg;                     /* For row_done */
+    int fast;                      /* Interior-skipping kernel, mirrored lines */
+    int tile_size;                 /* > 0: Mariani-Silver from tiles this big */
+    struct mariani_state *tiles;   /* Their state while the render runs */
+    long iterated;                 /* Points actually iterated, tile renders */
+    const struct deep_ref *deep;   /* Perturbation around this orbit, or NULL */
+    long rebases;                  /* Rebased perturbation iterations */
+    enum mandel_precision precision;
+    long double ox, oy;            /* Origin of the view, long double kernel only */
+    int block_size;                /* > 0: square blocks this big instead of lines */
+    enum tile_order order;         /* Order blocks and Mariani-Silver tiles go out in */
+    int *blocks;                   /* Block numbers in that order, while the render runs */
+    double *xs;                    /* x of every column, block renders */
+    int blocks_left;               /* Blocks not finished yet */
+
+    /* Owned by the pool */
+    struct mandel_render *next;    /* Next render in the queue */
+    int queued;                    /* Still has rows to claim */
+    int active;                    /* Workers computing its rows */
+    int done;
+    double submitted, finished;    /* CLOCK_MONOTONIC seconds */
+};
+
+struct mandel_pool {
+    pthread_mutex_t lock;
+    pthread_cond_t work;           /* Workers wait here for a render */
+    pthread_cond_t done;           /* mandel_render_wait() waits here */
+    struct mandel_render *head, *tail;
+    int nr_threads;
+    int shutdown;
+    pthread_t *threads;
+    long *rows;                    /* Rows (tiles, blocks) computed by each worker, under lock */
+    double *busy;                  /* CPU seconds each worker spent rendering, under lock */
+};
+
+/* Iteration counts of one line of v (0 is the top one) into iters[0..width) */
+void mandel_view_line(const struct mandel_view *v, int line, int iters[]);
+
+/* Iteration counts of the points (xs[n], ys[n]) of r, with r's kernel */
+void mandel_render_points(struct mandel_render *r, const double xs[], const double ys[],
+                          int count, int iters[]);
+
+/* Start nr_threads workers */
+void mandel_pool_init(struct mandel_pool *p, int nr_threads);
+
+/* Wait for the queued renders, then stop the workers */
+void mandel_pool_destroy(struct mandel_pool *p);
+
+/*
+ * Prepare a render of v into iters, which must hold width * height ints
+ * (or be NULL, see row_done). chunk <= 0 picks the mandel-sched.h default
+ * for the policy.
+ */
+void mandel_render_init(struct mandel_render *r, const struct mandel_view *v, int iters[],
+                        enum row_policy policy, int chunk);
+
+/* Queue r; returns at once */
+void mandel_render_submit(struct mandel_pool *p, struct mandel_render *r);
+
+/* Wait until every line of r is in its iters */
+void mandel_render_wait(struct mandel_pool *p, struct mandel_render *r);
+
+/* Submit and wait */
+void mandel_render(struct mandel_pool *p, struct mandel_render *r);
+
+#endif /* MANDEL_RENDER_H__ */
@@ -0,0 +1,105 @@
+/*
+ * mandel-reorder.c
+ *
+ * Ordered output stage for the threaded Mandelbrot renderers. See
+ * mandel-reorder.h.
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mandel-reorder.h"
+
+#define perror_pthread(ret, msg) \
+do { errno = ret; perror(msg); } while (0)
+
+static void *reorder_writer(void *arg) {
+    struct reorder_ring *r = arg;
+    int l, slot;
+
+    for (l = 0; l < r->nr_lines; l++) {
+        slot = l % r->nr_slots;
+
+        pthread_mutex_lock(&r->lock);
+        while (r->line[slot] != l)
+            pthread_cond_wait(&r->line_ready, &r->lock);
+        pthread_mutex_unlock(&r->lock);
+
+        // Nobody else touches the slot until next_out moves past it
+        r->output(r->fd, r->rows + slot * r->width);
+
+        pthread_mutex_lock(&r->lock);
+        r->line[slot] = -1;
+        r->next_out = l + 1;
+        pthread_cond_broadcast(&r->slot_free);
+        pthread_mutex_unlock(&r->lock);
+    }
+    return NULL;
+}
+
+void reorder_start(struct reorder_ring *r, int nr_slots, int width, int nr_lines,
+                   reorder_output_fn *output, int fd) {
+    int i, ret;
+
+    r->nr_slots = nr_slots;
+    r->width = width;
+    r->nr_lines = nr_lines;
+    r->next_out = 0;
+    r->full_waits = 0;
+    r->output = output;
+    r->fd = fd;
+    r->line = malloc(nr_slots * sizeof(*r->line));
+    r->rows = malloc((size_t)nr_slots * width * sizeof(*r->rows));
+    if (r->line == NULL || r->rows == NULL) {
+        fprintf(stderr, "Out of memory, failed to allocate the reorder ring\n");
+        exit(1);
+    }
+    for (i = 0; i < nr_slots; i++)
+        r->line[i] = -1;
+    pthread_mutex_init(&r->lock, NULL);
+    pthread_cond_init(&r->slot_free, NULL);
+    pthread_cond_init(&r->line_ready, NULL);
+
+    ret = pthread_create(&r->writer, NULL, reorder_writer, r);
+    if (ret) {
+        perror_pthread(ret, "pthread_create");
+        exit(1);
+    }
+}
+
+void reorder_put(struct reorder_ring *r, int line, const int color_val[]) {
+    int slot = line % r->nr_slots;
+
+    pthread_mutex_lock(&r->lock);
+    if (line >= r->next_out + r->nr_slots) {
+        r->full_waits++;
+        do
+            pthread_cond_wait(&r->slot_free, &r->lock);
+        while (line >= r->next_out + r->nr_slots);
+    }
+    pthread_mutex_unlock(&r->lock);
+
+    // The slot is ours: the writer is done with its previous line
+    memcpy(r->rows + slot * r->width, color_val, r->width * sizeof(*color_val));
+
+    pthread_mutex_lock(&r->lock);
+    r->line[slot] = line;
+    // Only the line the writer is waiting for needs to wake it
+    if (line == r->next_out)
+        pthread_cond_signal(&r->line_ready);
+    pthread_mutex_unlock(&r->lock);
+}
+
+void reorder_finish(struct reorder_ring *r) {
+    int ret = pthread_join(r->writer, NULL);
+
+    if (ret) {
+        perror_pthread(ret, "pthread_join");
+        exit(1);
+    }
+    pthread_mutex_destroy(&r->lock);
+    pthread_cond_destroy(&r->slot_free);
+    pthread_cond_destroy(&r->line_ready);
+    free(r->line);
+    free(r->rows);
+}
@@ -0,0 +1,46 @@
+/*
+ * mandel-reorder.h
+ *
+ * Ordered output stage for the threaded Mandelbrot renderers. Workers drop
+ * finished lines into a bounded ring (slot = line mod nr_slots) and go on
+ * computing; a dedicated writer thread takes the lines out in order and
+ * prints them. A worker only waits if its line is nr_slots or more ahead
+ * of the line being printed.
+ *
+ * As with mandel-sched.h, every line before one being put must already be
+ * claimed by some worker, so the ring cannot deadlock.
+ */
+#ifndef MANDEL_REORDER_H__
+#define MANDEL_REORDER_H__
+
+#include <pthread.h>
+
+typedef void reorder_output_fn(int fd, int color_val[]);
+
+struct reorder_ring {
+    pthread_mutex_t lock;
+    pthread_cond_t slot_free;    /* Workers wait here when the ring is full */
+    pthread_cond_t line_ready;   /* The writer waits here for the next line */
+    int nr_slots;
+    int width;                   /* Values per line */
+    int nr_lines;
+    int next_out;                /* Next line the writer prints */
+    int *line;                   /* line[s]: the line in slot s, -1 if empty */
+    int *rows;                   /* nr_slots lines of width values */
+    long full_waits;             /* Times a worker found the ring full */
+    reorder_output_fn *output;
+    int fd;
+    pthread_t writer;
+};
+
+/* Set up the ring and start the writer thread */
+void reorder_start(struct reorder_ring *r, int nr_slots, int width, int nr_lines,
+                   reorder_output_fn *output, int fd);
+
+/* Hand line over to the writer, waiting only if the ring is full */
+void reorder_put(struct reorder_ring *r, int line, const int color_val[]);
+
+/* Wait for the writer to print the last line, then free the ring */
+void reorder_finish(struct reorder_ring *r);
+
+#endif /* MANDEL_REORDER_H__ */
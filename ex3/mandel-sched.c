@@ -0,0 +1,79 @@
+/*
+ * mandel-sched.c
+ *
+ * Row scheduling for the threaded Mandelbrot renderers. See mandel-sched.h.
+ */
+#include <string.h>
+#include "mandel-sched.h"
+
+const char *row_policy_names[NR_ROW_POLICIES] = {
+    [ROW_STATIC] = "static",
+    [ROW_CHUNKED] = "chunked",
+    [ROW_GUIDED] = "guided",
+    [ROW_ATOMIC] = "atomic",
+};
+
+void row_sched_init(struct row_sched *s, enum row_policy policy, int nr_rows, int nr_threads, int chunk) {
+    s->policy = policy;
+    s->nr_rows = nr_rows;
+    s->nr_threads = nr_threads;
+    if (chunk <= 0)
+        chunk = policy == ROW_CHUNKED ? 4 : 1;
+    s->chunk = policy == ROW_ATOMIC ? 1 : chunk;
+    atomic_init(&s->next, 0);
+}
+
+int row_policy_parse(const char *name) {
+    int p;
+
+    for (p = 0; p < NR_ROW_POLICIES; p++)
+        if (strcmp(name, row_policy_names[p]) == 0)
+            return p;
+    return -1;
+}
+
+void row_cursor_init(struct row_cursor *c, int thrid) {
+    c->thrid = thrid;
+    c->row = c->end = -1;
+}
+
+/* Claim the next chunk of rows from the shared counter */
+static void claim(struct row_sched *s, struct row_cursor *c) {
+    int start, size;
+
+    if (s->policy != ROW_GUIDED) {
+        start = atomic_fetch_add_explicit(&s->next, s->chunk, memory_order_relaxed);
+        size = s->chunk;
+    } else {
+        start = atomic_load_explicit(&s->next, memory_order_relaxed);
+        do {
+            if (start >= s->nr_rows)
+                break;
+            size = (s->nr_rows - start) / s->nr_threads;
+            if (size < s->chunk)
+                size = s->chunk;
+        } while (!atomic_compare_exchange_weak_explicit(&s->next, &start, start + size,
+                                                        memory_order_relaxed, memory_order_relaxed));
+    }
+
+    if (start >= s->nr_rows) {
+        c->row = c->end = s->nr_rows;
+        return;
+    }
+    c->row = start;
+    c->end = start + size < s->nr_rows ? start + size : s->nr_rows;
+}
+
+int row_sched_next(struct row_sched *s, struct row_cursor *c) {
+    if (s->policy == ROW_STATIC) {
+        c->row = c->row < 0 ? c->thrid : c->row + s->nr_threads;
+        return c->row < s->nr_rows ? c->row : -1;
+    }
+
+    if (c->row >= 0 && c->row + 1 < c->end) {
+        c->row++;
+        return c->row;
+    }
+    claim(s, c);
+    return c->row < c->end ? c->row : -1;
+}
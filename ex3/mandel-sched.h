@@ -0,0 +1,61 @@
+/*
+ * mandel-sched.h
+ *
+ * Row scheduling for the threaded Mandelbrot renderers. Rows crossing the
+ * set cost up to MANDEL_MAX_ITERATION per pixel and rows outside it almost
+ * nothing, so how rows are handed out decides the load balance:
+ *
+ *   static:   row i goes to thread i mod n (the original scheme), no sharing
+ *   chunked:  threads claim the next chunk rows from a shared counter
+ *   guided:   like chunked, but a claim takes remaining / n rows (at least
+ *             chunk), so chunks start big and shrink towards the end
+ *   atomic:   threads claim one row at a time from the shared counter
+ *
+ * Every thread sees its rows in increasing order, and every row before a
+ * claimed one has already been claimed, so waiting for the previous row
+ * before printing never deadlocks.
+ *
+ * The state has no pointers and works from a MAP_SHARED mapping as well.
+ */
+#ifndef MANDEL_SCHED_H__
+#define MANDEL_SCHED_H__
+
+#include <stdatomic.h>
+
+enum row_policy {
+    ROW_STATIC,
+    ROW_CHUNKED,
+    ROW_GUIDED,
+    ROW_ATOMIC,
+    NR_ROW_POLICIES
+};
+
+extern const char *row_policy_names[NR_ROW_POLICIES];
+
+struct row_sched {
+    enum row_policy policy;
+    int nr_rows;
+    int nr_threads;
+    int chunk;
+    atomic_int next;       /* First unclaimed row, shared policies only */
+};
+
+/* A thread's position: the rows [row, end) are claimed and not yet returned */
+struct row_cursor {
+    int thrid;
+    int row;
+    int end;
+};
+
+/* chunk <= 0 picks the default: 4 rows for chunked, 1 for guided */
+void row_sched_init(struct row_sched *s, enum row_policy policy, int nr_rows, int nr_threads, int chunk);
+
+/* Policy by name, -1 if there is none */
+int row_policy_parse(const char *name);
+
+void row_cursor_init(struct row_cursor *c, int thrid);
+
+/* The next row for this thread, -1 when there are no more */
+int row_sched_next(struct row_sched *s, struct row_cursor *c);
+
+#endif /* MANDEL_SCHED_H__ */
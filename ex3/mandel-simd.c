@@ -0,0 +1,419 @@
+/*
+ * mandel-simd.c
+ *
+ * Vectorized Mandelbrot line kernel with runtime dispatch. See mandel-simd.h.
+ */
+// Fusing x*x - y*y + x0 into FMAs would change the results
+#pragma GCC optimize("fp-contract=off")
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <immintrin.h>
+#include "mandel-lib.h"
+#include "mandel-simd.h"
+
+/* How far inside the cardioid and the bulb a point must be to skip it */
+#define INTERIOR_MARGIN 1e-3
+
+/*
+ * Lines are packed into stack buffers this many points at a time, so that
+ * any width fits on a thread's stack; the kernels do not care where a
+ * chunk starts
+ */
+#define LINE_CHUNK 1024
+
+const char *mandel_simd_names[NR_MANDEL_SIMD] = {
+    [MANDEL_SIMD_SCALAR] = "scalar",
+    [MANDEL_SIMD_SSE2] = "sse2",
+    [MANDEL_SIMD_AVX2] = "avx2",
+    [MANDEL_SIMD_AVX512] = "avx512",
+};
+
+typedef void line_fn(const double *xs, const double *ys, int count, int max, int iters[]);
+
+static void line_scalar(const double *xs, const double *ys, int count, int max, int iters[]) {
+    int n;
+
+    for (n = 0; n < count; n++)
+        iters[n] = mandel_iterations_at_point(xs[n], ys[n], max);
+}
+
+/*
+ * Each variant: z starts at c, and a lane counts one more iteration for
+ * every step it starts with |z|^2 <= 4. The lanes left over at the end of
+ * the line go through the scalar kernel.
+ */
+__attribute__((target("sse2")))
+static void line_sse2(const double *xs, const double *ys, int count, int max, int iters[]) {
+    const __m128d four = _mm_set1_pd(4.0), two = _mm_set1_pd(2.0), one = _mm_set1_pd(1.0);
+    __m128d cx, cy, zx, zy, x2, y2, n, active;
+    double out[2];
+    int i, k, base;
+
+    for (base = 0; base + 2 <= count; base += 2) {
+        cx = _mm_loadu_pd(xs + base);
+        cy = _mm_loadu_pd(ys + base);
+        zx = cx;
+        zy = cy;
+        n = _mm_setzero_pd();
+        active = _mm_castsi128_pd(_mm_set1_epi32(-1));
+        for (i = 0; i < max; i++) {
+            x2 = _mm_mul_pd(zx, zx);
+            y2 = _mm_mul_pd(zy, zy);
+            active = _mm_and_pd(active, _mm_cmple_pd(_mm_add_pd(x2, y2), four));
+            if (_mm_movemask_pd(active) == 0)
+                break;
+            n = _mm_add_pd(n, _mm_and_pd(active, one));
+            zy = _mm_add_pd(_mm_mul_pd(_mm_mul_pd(two, zx), zy), cy);
+            zx = _mm_add_pd(_mm_sub_pd(x2, y2), cx);
+        }
+        _mm_storeu_pd(out, n);
+        for (k = 0; k < 2; k++)
+            iters[base + k] = out[k];
+    }
+    line_scalar(xs + base, ys + base, count - base, max, iters + base);
+}
+
+__attribute__((target("avx2")))
+static void line_avx2(const double *xs, const double *ys, int count, int max, int iters[]) {
+    const __m256d four = _mm256_set1_pd(4.0), two = _mm256_set1_pd(2.0), one = _mm256_set1_pd(1.0);
+    __m256d cx, cy, zx, zy, x2, y2, n, active;
+    double out[4];
+    int i, k, base;
+
+    for (base = 0; base + 4 <= count; base += 4) {
+        cx = _mm256_loadu_pd(xs + base);
+        cy = _mm256_loadu_pd(ys + base);
+        zx = cx;
+        zy = cy;
+        n = _mm256_setzero_pd();
+        active = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+        for (i = 0; i < max; i++) {
+            x2 = _mm256_mul_pd(zx, zx);
+            y2 = _mm256_mul_pd(zy, zy);
+            active = _mm256_and_pd(active, _mm256_cmp_pd(_mm256_add_pd(x2, y2), four, _CMP_LE_OQ));
+            if (_mm256_movemask_pd(active) == 0)
+                break;
+            n = _mm256_add_pd(n, _mm256_and_pd(active, one));
+            zy = _mm256_add_pd(_mm256_mul_pd(_mm256_mul_pd(two, zx), zy), cy);
+            zx = _mm256_add_pd(_mm256_sub_pd(x2, y2), cx);
+        }
+        _mm256_storeu_pd(out, n);
+        for (k = 0; k < 4; k++)
+            iters[base + k] = out[k];
+    }
+    line_sse2(xs + base, ys + base, count - base, max, iters + base);
+}
+
+__attribute__((target("avx512f")))
+static void line_avx512(const double *xs, const double *ys, int count, int max, int iters[]) {
+    const __m512d four = _mm512_set1_pd(4.0), two = _mm512_set1_pd(2.0), one = _mm512_set1_pd(1.0);
+    __m512d cx, cy, zx, zy, x2, y2, n;
+    __mmask8 active;
+    double out[8];
+    int i, k, base;
+
+    for (base = 0; base + 8 <= count; base += 8) {
+        cx = _mm512_loadu_pd(xs + base);
+        cy = _mm512_loadu_pd(ys + base);
+        zx = cx;
+        zy = cy;
+        n = _mm512_setzero_pd();
+        active = 0xff;
+        for (i = 0; i < max; i++) {
+            x2 = _mm512_mul_pd(zx, zx);
+            y2 = _mm512_mul_pd(zy, zy);
+            active = _mm512_mask_cmp_pd_mask(active, _mm512_add_pd(x2, y2), four, _CMP_LE_OQ);
+            if (active == 0)
+                break;
+            n = _mm512_mask_add_pd(n, active, n, one);
+            zy = _mm512_add_pd(_mm512_mul_pd(_mm512_mul_pd(two, zx), zy), cy);
+            zx = _mm512_add_pd(_mm512_sub_pd(x2, y2), cx);
+        }
+        _mm512_storeu_pd(out, n);
+        for (k = 0; k < 8; k++)
+            iters[base + k] = out[k];
+    }
+    line_avx2(xs + base, ys + base, count - base, max, iters + base);
+}
+
+/*
+ * The same kernels with Brent's cycle detection: z is saved at iterations
+ * 1, 2, 4, 8, ... and a point whose orbit comes back to the saved value
+ * exactly has run into a cycle of the (deterministic) floating point map.
+ * Every value on the cycle has already passed the |z|^2 <= 4 test, so the
+ * plain kernel would iterate it up to max, and that is what it gets.
+ */
+static int iterations_periodic(double cx, double cy, int max) {
+    double x = cx, y = cy, sx = cx, sy = cy, x2, y2, t;
+    int i, next = 1;
+
+    for (i = 0; i < max; i++) {
+        x2 = x * x;
+        y2 = y * y;
+        if (!(x2 + y2 <= 4.0))
+            return i;
+        t = x2 - y2 + cx;
+        y = 2 * x * y + cy;
+        x = t;
+        if (x == sx && y == sy)
+            return max;
+        if (i == next) {
+            sx = x;
+            sy = y;
+            next *= 2;
+        }
+    }
+    return max;
+}
+
+static void periodic_scalar(const double *xs, const double *ys, int count, int max, int iters[]) {
+    int n;
+
+    for (n = 0; n < count; n++)
+        iters[n] = iterations_periodic(xs[n], ys[n], max);
+}
+
+__attribute__((target("sse2")))
+static void periodic_sse2(const double *xs, const double *ys, int count, int max, int iters[]) {
+    const __m128d four = _mm_set1_pd(4.0), two = _mm_set1_pd(2.0), one = _mm_set1_pd(1.0);
+    const __m128d vmax = _mm_set1_pd(max);
+    __m128d cx, cy, zx, zy, sx, sy, x2, y2, n, active, cyc;
+    double out[2];
+    int i, k, base, next;
+
+    for (base = 0; base + 2 <= count; base += 2) {
+        cx = _mm_loadu_pd(xs + base);
+        cy = _mm_loadu_pd(ys + base);
+        zx = sx = cx;
+        zy = sy = cy;
+        n = _mm_setzero_pd();
+        active = _mm_castsi128_pd(_mm_set1_epi32(-1));
+        for (i = 0, next = 1; i < max; i++) {
+            x2 = _mm_mul_pd(zx, zx);
+            y2 = _mm_mul_pd(zy, zy);
+            active = _mm_and_pd(active, _mm_cmple_pd(_mm_add_pd(x2, y2), four));
+            if (_mm_movemask_pd(active) == 0)
+                break;
+            n = _mm_add_pd(n, _mm_and_pd(active, one));
+            zy = _mm_add_pd(_mm_mul_pd(_mm_mul_pd(two, zx), zy), cy);
+            zx = _mm_add_pd(_mm_sub_pd(x2, y2), cx);
+            cyc = _mm_and_pd(active, _mm_and_pd(_mm_cmpeq_pd(zx, sx), _mm_cmpeq_pd(zy, sy)));
+            n = _mm_or_pd(_mm_and_pd(cyc, vmax), _mm_andnot_pd(cyc, n));
+            active = _mm_andnot_pd(cyc, active);
+            if (i == next) {
+                sx = zx;
+                sy = zy;
+                next *= 2;
+            }
+        }
+        _mm_storeu_pd(out, n);
+        for (k = 0; k < 2; k++)
+            iters[base + k] = out[k];
+    }
+    periodic_scalar(xs + base, ys + base, count - base, max, iters + base);
+}
+
+__attribute__((target("avx2")))
+static void periodic_avx2(const double *xs, const double *ys, int count, int max, int iters[]) {
+    const __m256d four = _mm256_set1_pd(4.0), two = _mm256_set1_pd(2.0), one = _mm256_set1_pd(1.0);
+    const __m256d vmax = _mm256_set1_pd(max);
+    __m256d cx, cy, zx, zy, sx, sy, x2, y2, n, active, cyc;
+    double out[4];
+    int i, k, base, next;
+
+    for (base = 0; base + 4 <= count; base += 4) {
+        cx = _mm256_loadu_pd(xs + base);
+        cy = _mm256_loadu_pd(ys + base);
+        zx = sx = cx;
+        zy = sy = cy;
+        n = _mm256_setzero_pd();
+        active = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+        for (i = 0, next = 1; i < max; i++) {
+            x2 = _mm256_mul_pd(zx, zx);
+            y2 = _mm256_mul_pd(zy, zy);
+            active = _mm256_and_pd(active, _mm256_cmp_pd(_mm256_add_pd(x2, y2), four, _CMP_LE_OQ));
+            if (_mm256_movemask_pd(active) == 0)
+                break;
+            n = _mm256_add_pd(n, _mm256_and_pd(active, one));
+            zy = _mm256_add_pd(_mm256_mul_pd(_mm256_mul_pd(two, zx), zy), cy);
+            zx = _mm256_add_pd(_mm256_sub_pd(x2, y2), cx);
+            cyc = _mm256_and_pd(active, _mm256_and_pd(_mm256_cmp_pd(zx, sx, _CMP_EQ_OQ),
+                                                      _mm256_cmp_pd(zy, sy, _CMP_EQ_OQ)));
+            n = _mm256_blendv_pd(n, vmax, cyc);
+            active = _mm256_andnot_pd(cyc, active);
+            if (i == next) {
+                sx = zx;
+                sy = zy;
+                next *= 2;
+            }
+        }
+        _mm256_storeu_pd(out, n);
+        for (k = 0; k < 4; k++)
+            iters[base + k] = out[k];
+    }
+    periodic_sse2(xs + base, ys + base, count - base, max, iters + base);
+}
+
+__attribute__((target("avx512f")))
+static void periodic_avx512(const double *xs, const double *ys, int count, int max, int iters[]) {
+    const __m512d four = _mm512_set1_pd(4.0), two = _mm512_set1_pd(2.0), one = _mm512_set1_pd(1.0);
+    const __m512d vmax = _mm512_set1_pd(max);
+    __m512d cx, cy, zx, zy, sx, sy, x2, y2, n;
+    __mmask8 active, cyc;
+    double out[8];
+    int i, k, base, next;
+
+    for (base = 0; base + 8 <= count; base += 8) {
+        cx = _mm512_loadu_pd(xs + base);
+        cy = _mm512_loadu_pd(ys + base);
+        zx = sx = cx;
+        zy = sy = cy;
+        n = _mm512_setzero_pd();
+        active = 0xff;
+        for (i = 0, next = 1; i < max; i++) {
+            x2 = _mm512_mul_pd(zx, zx);
+            y2 = _mm512_mul_pd(zy, zy);
+            active = _mm512_mask_cmp_pd_mask(active, _mm512_add_pd(x2, y2), four, _CMP_LE_OQ);
+            if (active == 0)
+                break;
+            n = _mm512_mask_add_pd(n, active, n, one);
+            zy = _mm512_add_pd(_mm512_mul_pd(_mm512_mul_pd(two, zx), zy), cy);
+            zx = _mm512_add_pd(_mm512_sub_pd(x2, y2), cx);
+            cyc = _mm512_mask_cmp_pd_mask(_mm512_mask_cmp_pd_mask(active, zx, sx, _CMP_EQ_OQ),
+                                          zy, sy, _CMP_EQ_OQ);
+            n = _mm512_mask_mov_pd(n, cyc, vmax);
+            active &= ~cyc;
+            if (i == next) {
+                sx = zx;
+                sy = zy;
+                next *= 2;
+            }
+        }
+        _mm512_storeu_pd(out, n);
+        for (k = 0; k < 8; k++)
+            iters[base + k] = out[k];
+    }
+    periodic_avx2(xs + base, ys + base, count - base, max, iters + base);
+}
+
+static line_fn *line_kernels[NR_MANDEL_SIMD] = {
+    [MANDEL_SIMD_SCALAR] = line_scalar,
+    [MANDEL_SIMD_SSE2] = line_sse2,
+    [MANDEL_SIMD_AVX2] = line_avx2,
+    [MANDEL_SIMD_AVX512] = line_avx512,
+};
+
+static line_fn *periodic_kernels[NR_MANDEL_SIMD] = {
+    [MANDEL_SIMD_SCALAR] = periodic_scalar,
+    [MANDEL_SIMD_SSE2] = periodic_sse2,
+    [MANDEL_SIMD_AVX2] = periodic_avx2,
+    [MANDEL_SIMD_AVX512] = periodic_avx512,
+};
+
+static pthread_once_t simd_once = PTHREAD_ONCE_INIT;
+static enum mandel_simd simd_variant;
+static int fast_default;
+
+static void simd_select(void) {
+    enum mandel_simd best = MANDEL_SIMD_SCALAR, v;
+    char *env = getenv("MANDEL_SIMD");
+    char *kernel = getenv("MANDEL_KERNEL");
+
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2"))
+        best = MANDEL_SIMD_SSE2;
+    if (__builtin_cpu_supports("avx2"))
+        best = MANDEL_SIMD_AVX2;
+    if (__builtin_cpu_supports("avx512f"))
+        best = MANDEL_SIMD_AVX512;
+
+    simd_variant = best;
+    if (env != NULL)
+        for (v = 0; v < NR_MANDEL_SIMD; v++)
+            if (strcmp(env, mandel_simd_names[v]) == 0 && v <= best)
+                simd_variant = v;
+    fast_default = kernel != NULL && strcmp(kernel, "fast") == 0;
+}
+
+enum mandel_simd mandel_simd_variant(void) {
+    pthread_once(&simd_once, simd_select);
+    return simd_variant;
+}
+
+void mandel_line_iterations(double x0, double xstep, double y, int count, int max, int iters[]) {
+    enum mandel_simd v = mandel_simd_variant();
+    double xs[LINE_CHUNK], ys[LINE_CHUNK];
+    double x = x0;
+    int base, n;
+
+    // MANDEL_KERNEL=fast: same results, interior points skipped
+    if (fast_default) {
+        mandel_line_iterations_fast(x0, xstep, y, count, max, iters);
+        return;
+    }
+
+    // Accumulate x exactly like the renderers did, across chunks, so the points are bit-identical
+    for (base = 0; base < count; base += LINE_CHUNK) {
+        for (n = 0; n < LINE_CHUNK && base + n < count; x += xstep, n++) {
+            xs[n] = x;
+            ys[n] = y;
+        }
+        line_kernels[v](xs, ys, n, max, iters + base);
+    }
+}
+
+void mandel_points_iterations(const double xs[], const double ys[], int count, int max, int iters[]) {
+    line_kernels[mandel_simd_variant()](xs, ys, count, max, iters);
+}
+
+/*
+ * Inside the main cardioid or the period-2 bulb, with a margin: right at
+ * their boundary the orbits converge so slowly that rounding decides, and
+ * those points are left to the iteration.
+ */
+static int in_cardioid_or_bulb(double x, double y) {
+    double y2 = y * y, q = (x - 0.25) * (x - 0.25) + y2;
+
+    if (q * (q + (x - 0.25)) < 0.25 * y2 - INTERIOR_MARGIN)
+        return 1;
+    return (x + 1) * (x + 1) + y2 < 0.0625 - INTERIOR_MARGIN;
+}
+
+void mandel_points_iterations_fast(const double xs[], const double ys[], int count, int max, int iters[]) {
+    double rest_xs[LINE_CHUNK], rest_ys[LINE_CHUNK];
+    int idx[LINE_CHUNK], rest[LINE_CHUNK];
+    int base, end, n, k;
+
+    // Interior points are settled here, the others are packed for the kernel
+    for (base = 0; base < count; base = end) {
+        end = base + LINE_CHUNK < count ? base + LINE_CHUNK : count;
+        for (n = base, k = 0; n < end; n++) {
+            if (in_cardioid_or_bulb(xs[n], ys[n])) {
+                iters[n] = max;
+            } else {
+                rest_xs[k] = xs[n];
+                rest_ys[k] = ys[n];
+                idx[k++] = n;
+            }
+        }
+        periodic_kernels[mandel_simd_variant()](rest_xs, rest_ys, k, max, rest);
+        for (n = 0; n < k; n++)
+            iters[idx[n]] = rest[n];
+    }
+}
+
+void mandel_line_iterations_fast(double x0, double xstep, double y, int count, int max, int iters[]) {
+    double xs[LINE_CHUNK], ys[LINE_CHUNK];
+    double x = x0;
+    int base, n;
+
+    for (base = 0; base < count; base += LINE_CHUNK) {
+        for (n = 0; n < LINE_CHUNK && base + n < count; x += xstep, n++) {
+            xs[n] = x;
+            ys[n] = y;
+        }
+        mandel_points_iterations_fast(xs, ys, n, max, iters + base);
+    }
+}
@@ -0,0 +1,57 @@
+/*
+ * mandel-simd.h
+ *
+ * Vectorized Mandelbrot line kernel. A line of points with the same y is
+ * iterated 2 (SSE2), 4 (AVX2) or 8 (AVX-512) points at a time; every lane
+ * keeps iterating until all lanes have escaped or hit the limit, and a
+ * per-lane mask decides which lanes still count iterations.
+ *
+ * The variant is picked once, at the first call, from the CPU features, so
+ * the same binary uses AVX-512 where there is one and SSE2 elsewhere.
+ * MANDEL_SIMD=scalar|sse2|avx2|avx512 in the environment overrides it
+ * (falling back to the best supported variant if the CPU lacks it).
+ *
+ * Every variant performs exactly the operations of the scalar
+ * mandel_iterations_at_point(), in the same order and without fused
+ * multiply-adds, so the iteration counts are identical.
+ *
+ * mandel_line_iterations_fast() gets the same counts without iterating
+ * most interior points to the limit: the main cardioid and the period-2
+ * bulb are recognized analytically, and an orbit that repeats itself
+ * exactly is known never to escape (Brent's cycle detection). With
+ * MANDEL_KERNEL=fast in the environment, mandel_line_iterations() uses it.
+ *
+ * Used by the ex3 and ex4 renderers; build with mandel-simd.c (and
+ * -I../ex3 ../ex3/mandel-simd.c from ex4).
+ */
+#ifndef MANDEL_SIMD_H__
+#define MANDEL_SIMD_H__
+
+enum mandel_simd {
+    MANDEL_SIMD_SCALAR,
+    MANDEL_SIMD_SSE2,
+    MANDEL_SIMD_AVX2,
+    MANDEL_SIMD_AVX512,
+    NR_MANDEL_SIMD
+};
+
+extern const char *mandel_simd_names[NR_MANDEL_SIMD];
+
+/* The variant mandel_line_iterations() uses */
+enum mandel_simd mandel_simd_variant(void);
+
+/*
+ * iters[n] = mandel_iterations_at_point(x_n, y, max) for 0 <= n < count,
+ * where x_0 = x0 and x_n+1 = x_n + xstep: the same points, accumulated the
+ * same way, as the loop in compute_mandel_line().
+ */
+void mandel_line_iterations(double x0, double xstep, double y, int count, int max, int iters[]);
+
+/* Same results as mandel_line_iterations(), skipping interior work */
+void mandel_line_iterations_fast(double x0, double xstep, double y, int count, int max, int iters[]);
+
+/* The same for arbitrary points (xs[n], ys[n]), for callers that keep their own */
+void mandel_points_iterations(const double xs[], const double ys[], int count, int max, int iters[]);
+void mandel_points_iterations_fast(const double xs[], const double ys[], int count, int max, int iters[]);
+
+#endif /* MANDEL_SIMD_H__ */
@@ -0,0 +1,166 @@
+/*
+ * perfctr.c
+ *
+ * Per-thread performance counters. See perfctr.h.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "perfctr.h"
+
+static const struct {
+    const char *name;
+    __u32 type;
+    __u64 config;
+} perfctr_events[NR_PERFCTR_EVENTS] = {
+    [PERFCTR_CYCLES] = { "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    [PERFCTR_INSTRUCTIONS] = { "instr", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    [PERFCTR_CACHE_MISSES] = { "cache-miss", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+    [PERFCTR_BRANCH_MISSES] = { "br-miss", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+    [PERFCTR_TASK_CLOCK] = { "task-ms", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK },
+    [PERFCTR_PAGE_FAULTS] = { "faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS },
+    [PERFCTR_CONTEXT_SWITCHES] = { "csw", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES },
+};
+
+/* Only warn once per process about missing hardware counters */
+static pthread_once_t perfctr_warn_once = PTHREAD_ONCE_INIT;
+static int perfctr_hw_errno;
+
+static void perfctr_warn(void) {
+    fprintf(stderr, "perfctr: hardware events unavailable (%s), software events only\n",
+            strerror(perfctr_hw_errno));
+}
+
+static int perfctr_open(enum perfctr_event e) {
+    struct perf_event_attr attr;
+    int fd;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = perfctr_events[e].type;
+    attr.config = perfctr_events[e].config;
+    attr.exclude_hv = 1;
+    // Scale by enabled/running time if the PMU has to multiplex our events
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    // pid 0, cpu -1: the calling thread, wherever it runs
+    fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (fd < 0 && errno == EACCES) {
+        // perf_event_paranoid >= 2: unprivileged users may only count user space
+        attr.exclude_kernel = 1;
+        fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+    return fd;
+}
+
+static unsigned long long perfctr_read(int fd) {
+    unsigned long long v[3];
+
+    if (fd < 0 || read(fd, v, sizeof(v)) != sizeof(v))
+        return 0;
+    if (v[2] == 0)
+        return 0;
+    if (v[2] < v[1])
+        return (unsigned long long)((double)v[0] * v[1] / v[2]);
+    return v[0];
+}
+
+struct perfctr *perfctr_start(void) {
+    struct perfctr *pc;
+    int e, nr_open = 0;
+
+    if (getenv("PERFCTR") == NULL)
+        return NULL;
+
+    if ((pc = calloc(1, sizeof(*pc))) == NULL) {
+        fprintf(stderr, "Out of memory, failed to allocate %zu bytes\n", sizeof(*pc));
+        exit(1);
+    }
+    for (e = 0; e < NR_PERFCTR_EVENTS; e++) {
+        pc->fd[e] = perfctr_open(e);
+        if (pc->fd[e] >= 0) {
+            nr_open++;
+        } else if (perfctr_events[e].type == PERF_TYPE_HARDWARE) {
+            perfctr_hw_errno = errno;
+            pthread_once(&perfctr_warn_once, perfctr_warn);
+        }
+    }
+    if (nr_open == 0) {
+        perror("perfctr: perf_event_open");
+        free(pc);
+        return NULL;
+    }
+    for (e = 0; e < NR_PERFCTR_EVENTS; e++)
+        pc->last[e] = perfctr_read(pc->fd[e]);
+    return pc;
+}
+
+void perfctr_phase(struct perfctr *pc, const char *name) {
+    struct perfctr_phase *ph;
+    unsigned long long v;
+    int e, i;
+
+    if (pc == NULL)
+        return;
+
+    for (i = 0; i < pc->nr_phases; i++)
+        if (strcmp(pc->phase[i].name, name) == 0)
+            break;
+    if (i == PERFCTR_MAX_PHASES)
+        i--;    /* Out of phases, charge the last one */
+    else if (i == pc->nr_phases)
+        pc->phase[pc->nr_phases++].name = name;
+    ph = &pc->phase[i];
+
+    for (e = 0; e < NR_PERFCTR_EVENTS; e++) {
+        v = perfctr_read(pc->fd[e]);
+        ph->count[e] += v - pc->last[e];
+        pc->last[e] = v;
+    }
+}
+
+void perfctr_stop(struct perfctr *pc, const char *label) {
+    char line[512];
+    int e, i, len;
+
+    if (pc == NULL)
+        return;
+
+    for (i = 0; i < pc->nr_phases; i++) {
+        struct perfctr_phase *ph = &pc->phase[i];
+
+        len = snprintf(line, sizeof(line), "perfctr: %s %s:", label, ph->name);
+        for (e = 0; e < NR_PERFCTR_EVENTS && len < (int)sizeof(line); e++) {
+            if (pc->fd[e] < 0)
+                len += snprintf(line + len, sizeof(line) - len, " %s -", perfctr_events[e].name);
+            else if (e == PERFCTR_TASK_CLOCK)
+                len += snprintf(line + len, sizeof(line) - len, " %s %.3f",
+                                perfctr_events[e].name, ph->count[e] / 1e6);
+            else
+                len += snprintf(line + len, sizeof(line) - len, " %s %llu",
+                                perfctr_events[e].name, ph->count[e]);
+        }
+        if (pc->fd[PERFCTR_CYCLES] >= 0 && pc->fd[PERFCTR_INSTRUCTIONS] >= 0 &&
+            ph->count[PERFCTR_CYCLES] && len < (int)sizeof(line))
+            len += snprintf(line + len, sizeof(line) - len, " ipc %.2f",
+                            (double)ph->count[PERFCTR_INSTRUCTIONS] / ph->count[PERFCTR_CYCLES]);
+        if (len >= (int)sizeof(line) - 1)
+            len = sizeof(line) - 2;
+        line[len++] = '\n';
+        // One write per line, so that threads and processes do not interleave
+        if (write(2, line, len) < 0)
+            break;
+    }
+
+    for (e = 0; e < NR_PERFCTR_EVENTS; e++)
+        if (pc->fd[e] >= 0)
+            close(pc->fd[e]);
+    free(pc);
+}
@@ -0,0 +1,59 @@
+/*
+ * perfctr.h
+ *
+ * Per-thread performance counters through perf_event_open(2), switched on
+ * at runtime by setting PERFCTR in the environment (PERFCTR=1 ./mandel 4),
+ * so the binaries behave as before otherwise.
+ *
+ * A thread calls perfctr_start(), then perfctr_phase() at the end of every
+ * phase of its work: the counts since the previous call are added to the
+ * named phase, so a loop alternating compute/output accumulates both.
+ * perfctr_stop() prints one line per phase on stderr and frees everything.
+ *
+ * Counted: cycles, instructions, cache misses and branch misses (hardware),
+ * task clock, page faults and context switches (software). Without a PMU,
+ * as in most VMs, the hardware columns show "-" and the software events are
+ * still reported. Every function is a no-op if PERFCTR is not set or the
+ * kernel refuses even the software events.
+ *
+ * Used by fconc (ex1), the mandel programs (ex3, ex4) and simplesync;
+ * build with -I../ex3 ../ex3/perfctr.c from the other directories.
+ */
+#ifndef PERFCTR_H__
+#define PERFCTR_H__
+
+#define PERFCTR_MAX_PHASES 8
+
+enum perfctr_event {
+    PERFCTR_CYCLES,
+    PERFCTR_INSTRUCTIONS,
+    PERFCTR_CACHE_MISSES,
+    PERFCTR_BRANCH_MISSES,
+    PERFCTR_TASK_CLOCK,
+    PERFCTR_PAGE_FAULTS,
+    PERFCTR_CONTEXT_SWITCHES,
+    NR_PERFCTR_EVENTS
+};
+
+struct perfctr_phase {
+    const char *name;
+    unsigned long long count[NR_PERFCTR_EVENTS];
+};
+
+struct perfctr {
+    int fd[NR_PERFCTR_EVENTS];       /* -1 for events that could not be opened */
+    unsigned long long last[NR_PERFCTR_EVENTS];
+    int nr_phases;
+    struct perfctr_phase phase[PERFCTR_MAX_PHASES];
+};
+
+/* Start counting for the calling thread, NULL when counting is off */
+struct perfctr *perfctr_start(void);
+
+/* Charge everything since the last call (or the start) to phase name */
+void perfctr_phase(struct perfctr *pc, const char *name);
+
+/* Print the phases of this thread, prefixed by label, and stop counting */
+void perfctr_stop(struct perfctr *pc, const char *label);
+
+#endif /* PERFCTR_H__ */
@@ -0,0 +1,239 @@
+/*
+ * simplesync-barrier.c
+ *
+ * Barrier workload for simplesync: n participants go through the same
+ * barrier episodes times in a row, with no work in between, so each
+ * episode costs exactly one barrier. Participants are threads, or with
+ * processes set forked processes sharing the barrier through a MAP_SHARED
+ * mapping.
+ *
+ *   pthread:        pthread_barrier_t (PTHREAD_PROCESS_SHARED for processes)
+ *   central:        centralized sense-reversing barrier
+ *   dissemination:  dissemination barrier
+ *   tournament:     tournament barrier with tree wakeup
+ *
+ * Participant 0 timestamps every exit from the barrier; the time between
+ * two exits is one episode. Reports the mean and the percentiles.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "simplesync.h"
+#include "barriers.h"
+#include "latency-hist.h"
+
+#define BARRIER_EPISODES 1000    /* Default number of timed episodes */
+#define BARRIER_WARMUP 10        /* Untimed episodes before them */
+
+enum b_mode {
+    B_PTHREAD,
+    B_CENTRAL,
+    B_DISSEMINATION,
+    B_TOURNAMENT,
+    NR_B_MODES
+};
+
+const char *b_mode_names[NR_B_MODES] = {
+    [B_PTHREAD] = "pthread",
+    [B_CENTRAL] = "central",
+    [B_DISSEMINATION] = "dissemination",
+    [B_TOURNAMENT] = "tournament",
+};
+
+/* Everything the participants share, in one MAP_SHARED mapping */
+struct barrier_shared {
+    pthread_barrier_t pthread_barrier;
+    struct central_barrier central;
+    struct lat_hist hist;          /* Participant 0's episode times in ns */
+    unsigned long long total_ns;   /* Participant 0, all timed episodes */
+    struct dissemination_barrier *diss;
+    struct tournament_barrier *tour;
+};
+
+struct b_thread {
+    pthread_t tid;
+    struct barrier_shared *sh;
+    enum b_mode mode;
+    int id;
+    long episodes;
+};
+
+void *shared_alloc(size_t size) {
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        perror("mmap");
+        exit(1);
+    }
+    return p;
+}
+
+void b_wait(struct barrier_shared *sh, enum b_mode mode, struct barrier_local *me) {
+    int ret;
+
+    switch (mode) {
+    case B_PTHREAD:
+        ret = pthread_barrier_wait(&sh->pthread_barrier);
+        if (ret && ret != PTHREAD_BARRIER_SERIAL_THREAD) {
+            perror_pthread(ret, "pthread_barrier_wait");
+            exit(1);
+        }
+        break;
+    case B_CENTRAL:
+        central_barrier_wait(&sh->central, me);
+        break;
+    case B_DISSEMINATION:
+        dissemination_barrier_wait(sh->diss, me);
+        break;
+    case B_TOURNAMENT:
+        tournament_barrier_wait(sh->tour, me);
+        break;
+    default:
+        break;
+    }
+}
+
+void barrier_participant(struct barrier_shared *sh, enum b_mode mode, int id, long episodes) {
+    struct barrier_local me;
+    unsigned long long t, prev = 0, first = 0;
+    long i;
+
+    barrier_local_init(&me, id);
+    for (i = -BARRIER_WARMUP; i < episodes; i++) {
+        b_wait(sh, mode, &me);
+        if (id != 0)
+            continue;
+        t = now_ns();
+        if (i >= 0)
+            lat_hist_add(&sh->hist, t - prev);
+        else
+            first = t;
+        prev = t;
+    }
+    if (id == 0)
+        sh->total_ns = prev - first;
+}
+
+void *barrier_fn(void *arg) {
+    struct b_thread *thr = arg;
+
+    barrier_participant(thr->sh, thr->mode, thr->id, thr->episodes);
+    return NULL;
+}
+
+void barrier_bench(enum b_mode mode, int n, long episodes, int processes) {
+    struct barrier_shared *sh;
+    struct b_thread *thr;
+    pthread_barrierattr_t attr;
+    pid_t pid;
+    int i, ret, status;
+
+    sh = shared_alloc(sizeof(*sh));
+    sh->diss = shared_alloc(dissemination_barrier_size(n));
+    sh->tour = shared_alloc(tournament_barrier_size(n));
+    lat_hist_init(&sh->hist);
+    central_barrier_init(&sh->central, n);
+    dissemination_barrier_init(sh->diss, n);
+    tournament_barrier_init(sh->tour, n);
+    pthread_barrierattr_init(&attr);
+    pthread_barrierattr_setpshared(&attr, processes ? PTHREAD_PROCESS_SHARED : PTHREAD_PROCESS_PRIVATE);
+    ret = pthread_barrier_init(&sh->pthread_barrier, &attr, n);
+    if (ret) {
+        perror_pthread(ret, "pthread_barrier_init");
+        exit(1);
+    }
+    pthread_barrierattr_destroy(&attr);
+
+    if (processes) {
+        // The mapping is inherited, so the barriers are at the same address in every child
+        for (i = 0; i < n; i++) {
+            pid = fork();
+            if (pid < 0) {
+                perror("fork");
+                exit(1);
+            }
+            if (pid == 0) {
+                barrier_participant(sh, mode, i, episodes);
+                _exit(0);
+            }
+        }
+        for (i = 0; i < n; i++) {
+            if (wait(&status) < 0) {
+                perror("wait");
+                exit(1);
+            }
+            if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+                fprintf(stderr, "barrier: a participant failed (status %d)\n", status);
+        }
+    } else {
+        thr = safe_malloc(n * sizeof(*thr));
+        for (i = 0; i < n; i++) {
+            thr[i].sh = sh;
+            thr[i].mode = mode;
+            thr[i].id = i;
+            thr[i].episodes = episodes;
+            ret = pthread_create(&thr[i].tid, NULL, barrier_fn, &thr[i]);
+            if (ret) {
+                perror_pthread(ret, "pthread_create");
+                exit(1);
+            }
+        }
+        for (i = 0; i < n; i++) {
+            ret = pthread_join(thr[i].tid, NULL);
+            if (ret)
+                perror_pthread(ret, "pthread_join");
+        }
+        free(thr);
+    }
+
+    printf("%-14s %6d %10.3f %8llu %8llu %8llu %10llu\n", b_mode_names[mode], n,
+           sh->total_ns / 1e3 / episodes, lat_hist_percentile(&sh->hist, 50),
+           lat_hist_percentile(&sh->hist, 90), lat_hist_percentile(&sh->hist, 99), sh->hist.max);
+    fflush(stdout);
+
+    pthread_barrier_destroy(&sh->pthread_barrier);
+    munmap(sh->diss, dissemination_barrier_size(n));
+    munmap(sh->tour, tournament_barrier_size(n));
+    munmap(sh, sizeof(*sh));
+}
+
+int barrier_run(char *modes, int counts[], int nr_counts, long episodes, int processes) {
+    int selected[NR_B_MODES] = { 0 }, any = 0, found;
+    int default_counts[] = { 2, 4, 8, 16, 32, 64, 128, 256 };
+    char *tok, *save;
+    int i, m;
+
+    for (tok = modes ? strtok_r(modes, ",", &save) : NULL; tok != NULL; tok = strtok_r(NULL, ",", &save)) {
+        found = 0;
+        for (m = 0; m < NR_B_MODES; m++)
+            if (strcmp(tok, "all") == 0 || strcmp(tok, b_mode_names[m]) == 0)
+                selected[m] = any = found = 1;
+        if (!found) {
+            fprintf(stderr, "barrier: unknown mode `%s' (pthread, central, dissemination, tournament, all)\n", tok);
+            return -1;
+        }
+    }
+    if (!any)
+        for (m = 0; m < NR_B_MODES; m++)
+            selected[m] = 1;
+    if (counts == NULL) {
+        counts = default_counts;
+        nr_counts = sizeof(default_counts) / sizeof(default_counts[0]);
+    }
+    if (episodes == 0)
+        episodes = BARRIER_EPISODES;
+
+    printf("Barrier: %ld episodes, participants are %s\n", episodes, processes ? "processes" : "threads");
+    printf("%-14s %6s %10s %8s %8s %8s %10s\n", "mode", "n", "us/episode", "p50 ns", "p90 ns", "p99 ns", "max ns");
+    for (m = 0; m < NR_B_MODES; m++) {
+        if (!selected[m])
+            continue;
+        for (i = 0; i < nr_counts; i++)
+            barrier_bench(m, counts[i], episodes, processes);
+    }
+    return 0;
+}
@@ -0,0 +1,577 @@
+/*
+ * simplesync-queue.c
+ *
+ * Producer/consumer workload for simplesync: nr_producers threads each push
+ * nr_ops timestamped items through one shared queue, nr_consumers threads
+ * pop them. Three queues:
+ *
+ *   mutex:    bounded ring under a pthread mutex, with not-empty/not-full
+ *             condition variables, threads sleep when they cannot proceed
+ *   msqueue:  Michael-Scott lock-free linked queue; nodes are malloc'ed per
+ *             item and freed through hazard pointers, so a node is never
+ *             freed while another thread may still dereference it
+ *   vyukov:   Dmitry Vyukov's bounded MPMC ring, one sequence number per
+ *             cell, producers and consumers only contend on their own index
+ *
+ * The lock-free queues never block: a producer on a full ring or a consumer
+ * on an empty queue yields and retries. When the last producer is done it
+ * pushes one end marker per consumer.
+ *
+ * Every item carries its producer and its sequence number in that producer.
+ * Consumers check that each producer's items reach them in order, and the
+ * per-producer counts and sequence sums of all consumers are checked at the
+ * end of the run.
+ *
+ * Reports item throughput and enqueue-to-dequeue latency percentiles.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sched.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "simplesync.h"
+#include "latency-hist.h"
+
+#define CACHE_LINE_SIZE 64
+#define QUEUE_CAPACITY 1024     /* Bounded queues, a power of two */
+#define QUEUE_END 0             /* Item stamp telling a consumer to stop */
+
+/* An item's id: producer in the top 16 bits, sequence number in the rest */
+#define Q_SEQ_BITS 48
+#define Q_ID(producer, seq) ((unsigned long long)(producer) << Q_SEQ_BITS | (seq))
+#define Q_PRODUCER(id) ((int)((id) >> Q_SEQ_BITS))
+#define Q_SEQ(id) ((long)((id) & ((1ULL << Q_SEQ_BITS) - 1)))
+
+struct q_item {
+    unsigned long long stamp;   /* Enqueue time in ns */
+    unsigned long long id;
+};
+
+enum q_mode {
+    Q_MUTEX,
+    Q_MSQUEUE,
+    Q_VYUKOV,
+    NR_Q_MODES
+};
+
+const char *q_mode_names[NR_Q_MODES] = {
+    [Q_MUTEX] = "mutex",
+    [Q_MSQUEUE] = "msqueue",
+    [Q_VYUKOV] = "vyukov",
+};
+
+/*
+ * mutex + condition variables
+ */
+struct mutex_queue {
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    unsigned long head, tail;
+    struct q_item items[QUEUE_CAPACITY];
+};
+
+/*
+ * Michael-Scott queue. head always points to a dummy node, the first item
+ * is in head->next.
+ */
+struct ms_node {
+    struct ms_node *_Atomic next;
+    struct q_item value;
+};
+
+struct ms_queue {
+    struct ms_node *_Atomic head __attribute__((aligned(CACHE_LINE_SIZE)));
+    struct ms_node *_Atomic tail __attribute__((aligned(CACHE_LINE_SIZE)));
+};
+
+/* Hazard pointers: the nodes a thread is about to dereference */
+struct hp_slot {
+    struct ms_node *_Atomic p[2];
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+/*
+ * Vyukov ring: a cell is free for the producer at position pos when
+ * seq == pos, and holds an item for the consumer at pos when seq == pos + 1.
+ */
+struct vy_cell {
+    atomic_ulong seq;
+    struct q_item value;
+};
+
+struct vy_queue {
+    atomic_ulong enq_pos __attribute__((aligned(CACHE_LINE_SIZE)));
+    atomic_ulong deq_pos __attribute__((aligned(CACHE_LINE_SIZE)));
+    struct vy_cell cells[QUEUE_CAPACITY] __attribute__((aligned(CACHE_LINE_SIZE)));
+};
+
+struct q_thread {
+    pthread_t tid;
+    int thrid;
+    int producer;
+    enum q_mode mode;
+    long nr_ops;
+    long items;              /* Items pushed or popped, without end markers */
+    long *count;             /* Consumers, per producer: items popped, */
+    unsigned long long *seq_sum; /* the sum of their sequence numbers */
+    long *last_seq;          /* and the last one, to check the order */
+    long bad_items;          /* Out of order, or from no producer */
+    double start, end;
+    struct lat_hist hist;    /* Consumers: enqueue-to-dequeue latency in ns */
+    struct ms_node **retired;   /* msqueue: nodes waiting to be freed */
+    int nr_retired;
+};
+
+/* Shared state of one run */
+struct mutex_queue mq;
+struct ms_queue msq;
+struct vy_queue *vyq;
+struct hp_slot *hazards;
+int nr_threads, hp_scan_threshold, nr_producers_run, nr_consumers_run;
+atomic_int producers_left;
+pthread_barrier_t q_barrier;
+
+/*
+ * mutex queue
+ */
+void mutex_enqueue(struct q_item v) {
+    pthread_mutex_lock(&mq.lock);
+    while (mq.tail - mq.head == QUEUE_CAPACITY)
+        pthread_cond_wait(&mq.not_full, &mq.lock);
+    mq.items[mq.tail++ % QUEUE_CAPACITY] = v;
+    pthread_cond_signal(&mq.not_empty);
+    pthread_mutex_unlock(&mq.lock);
+}
+
+struct q_item mutex_dequeue(void) {
+    struct q_item v;
+
+    pthread_mutex_lock(&mq.lock);
+    while (mq.tail == mq.head)
+        pthread_cond_wait(&mq.not_empty, &mq.lock);
+    v = mq.items[mq.head++ % QUEUE_CAPACITY];
+    pthread_cond_signal(&mq.not_full);
+    pthread_mutex_unlock(&mq.lock);
+    return v;
+}
+
+/*
+ * msqueue, with hazard pointer reclamation
+ */
+int hp_cmp(const void *a, const void *b) {
+    uintptr_t x = *(const uintptr_t *)a, y = *(const uintptr_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* Free every retired node no thread has a hazard pointer to */
+void hp_scan(struct q_thread *thr) {
+    uintptr_t hp[2 * nr_threads];
+    int i, n = 0, kept = 0;
+
+    for (i = 0; i < nr_threads; i++) {
+        hp[n++] = (uintptr_t)atomic_load(&hazards[i].p[0]);
+        hp[n++] = (uintptr_t)atomic_load(&hazards[i].p[1]);
+    }
+    qsort(hp, n, sizeof(hp[0]), hp_cmp);
+
+    for (i = 0; i < thr->nr_retired; i++) {
+        uintptr_t p = (uintptr_t)thr->retired[i];
+        if (bsearch(&p, hp, n, sizeof(hp[0]), hp_cmp))
+            thr->retired[kept++] = thr->retired[i];
+        else
+            free(thr->retired[i]);
+    }
+    thr->nr_retired = kept;
+}
+
+void hp_retire(struct q_thread *thr, struct ms_node *node) {
+    thr->retired[thr->nr_retired++] = node;
+    if (thr->nr_retired == hp_scan_threshold)
+        hp_scan(thr);
+}
+
+void ms_enqueue(struct q_thread *thr, struct q_item v) {
+    struct hp_slot *hp = &hazards[thr->thrid];
+    struct ms_node *node, *tail, *next;
+
+    node = safe_malloc(sizeof(*node));
+    node->value = v;
+    atomic_init(&node->next, NULL);
+
+    for (;;) {
+        // Publish the hazard, then check tail did not move (and get freed) meanwhile
+        tail = atomic_load(&msq.tail);
+        atomic_store(&hp->p[0], tail);
+        if (tail != atomic_load(&msq.tail))
+            continue;
+        next = atomic_load(&tail->next);
+        if (tail != atomic_load(&msq.tail))
+            continue;
+        if (next != NULL) {
+            // tail is lagging behind, help move it
+            atomic_compare_exchange_strong(&msq.tail, &tail, next);
+            continue;
+        }
+        if (atomic_compare_exchange_strong(&tail->next, &next, node)) {
+            atomic_compare_exchange_strong(&msq.tail, &tail, node);
+            break;
+        }
+    }
+    atomic_store(&hp->p[0], NULL);
+}
+
+/* Returns 0 if the queue was empty */
+int ms_dequeue(struct q_thread *thr, struct q_item *v) {
+    struct hp_slot *hp = &hazards[thr->thrid];
+    struct ms_node *head, *tail, *next;
+
+    for (;;) {
+        head = atomic_load(&msq.head);
+        atomic_store(&hp->p[0], head);
+        if (head != atomic_load(&msq.head))
+            continue;
+        tail = atomic_load(&msq.tail);
+        next = atomic_load(&head->next);
+        atomic_store(&hp->p[1], next);
+        if (head != atomic_load(&msq.head))
+            continue;
+        if (next == NULL) {
+            atomic_store(&hp->p[0], NULL);
+            atomic_store(&hp->p[1], NULL);
+            return 0;
+        }
+        if (head == tail) {
+            atomic_compare_exchange_strong(&msq.tail, &tail, next);
+            continue;
+        }
+        // next is protected by p[1], so its value can be read before the CAS
+        *v = next->value;
+        if (atomic_compare_exchange_strong(&msq.head, &head, next))
+            break;
+    }
+    atomic_store(&hp->p[0], NULL);
+    atomic_store(&hp->p[1], NULL);
+    // The old dummy is unlinked, next is the new dummy
+    hp_retire(thr, head);
+    return 1;
+}
+
+/*
+ * vyukov
+ */
+int vy_enqueue(struct q_item v) {
+    struct vy_cell *cell;
+    unsigned long pos = atomic_load_explicit(&vyq->enq_pos, memory_order_relaxed);
+    long dif;
+
+    for (;;) {
+        cell = &vyq->cells[pos & (QUEUE_CAPACITY - 1)];
+        dif = (long)atomic_load_explicit(&cell->seq, memory_order_acquire) - (long)pos;
+        if (dif == 0) {
+            if (atomic_compare_exchange_weak_explicit(&vyq->enq_pos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed))
+                break;
+        } else if (dif < 0) {
+            return 0;   /* Full */
+        } else {
+            pos = atomic_load_explicit(&vyq->enq_pos, memory_order_relaxed);
+        }
+    }
+    cell->value = v;
+    atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+    return 1;
+}
+
+int vy_dequeue(struct q_item *v) {
+    struct vy_cell *cell;
+    unsigned long pos = atomic_load_explicit(&vyq->deq_pos, memory_order_relaxed);
+    long dif;
+
+    for (;;) {
+        cell = &vyq->cells[pos & (QUEUE_CAPACITY - 1)];
+        dif = (long)atomic_load_explicit(&cell->seq, memory_order_acquire) - (long)(pos + 1);
+        if (dif == 0) {
+            if (atomic_compare_exchange_weak_explicit(&vyq->deq_pos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed))
+                break;
+        } else if (dif < 0) {
+            return 0;   /* Empty */
+        } else {
+            pos = atomic_load_explicit(&vyq->deq_pos, memory_order_relaxed);
+        }
+    }
+    *v = cell->value;
+    atomic_store_explicit(&cell->seq, pos + QUEUE_CAPACITY, memory_order_release);
+    return 1;
+}
+
+void q_push(struct q_thread *thr, struct q_item v) {
+    switch (thr->mode) {
+    case Q_MUTEX:
+        mutex_enqueue(v);
+        break;
+    case Q_MSQUEUE:
+        ms_enqueue(thr, v);
+        break;
+    case Q_VYUKOV:
+        while (!vy_enqueue(v))
+            sched_yield();
+        break;
+    default:
+        break;
+    }
+}
+
+struct q_item q_pop(struct q_thread *thr) {
+    struct q_item v = { QUEUE_END, 0 };
+
+    switch (thr->mode) {
+    case Q_MUTEX:
+        v = mutex_dequeue();
+        break;
+    case Q_MSQUEUE:
+        while (!ms_dequeue(thr, &v))
+            sched_yield();
+        break;
+    case Q_VYUKOV:
+        while (!vy_dequeue(&v))
+            sched_yield();
+        break;
+    default:
+        break;
+    }
+    return v;
+}
+
+void *queue_fn(void *arg) {
+    struct q_thread *thr = arg;
+    struct q_item v;
+    int p;
+    long i, seq;
+
+    barrier_wait(&q_barrier);
+    thr->start = now();
+
+    if (thr->producer) {
+        // The stamp is the enqueue time, never QUEUE_END; producers are threads 0 .. nr_producers - 1
+        for (i = 0; i < thr->nr_ops; i++)
+            q_push(thr, (struct q_item){ now_ns(), Q_ID(thr->thrid, i) });
+        thr->items = thr->nr_ops;
+        if (atomic_fetch_sub(&producers_left, 1) == 1)
+            for (i = 0; i < nr_consumers_run; i++)
+                q_push(thr, (struct q_item){ QUEUE_END, 0 });
+    } else {
+        while ((v = q_pop(thr)).stamp != QUEUE_END) {
+            lat_hist_add(&thr->hist, now_ns() - v.stamp);
+            thr->items++;
+            // The queues are FIFO, so one producer's items reach a consumer in order
+            p = Q_PRODUCER(v.id);
+            seq = Q_SEQ(v.id);
+            if (p >= nr_producers_run || seq <= thr->last_seq[p]) {
+                thr->bad_items++;
+                continue;
+            }
+            thr->last_seq[p] = seq;
+            thr->count[p]++;
+            thr->seq_sum[p] += seq;
+        }
+    }
+
+    thr->end = now();
+    return NULL;
+}
+
+/*
+ * One run. Returns 1 if the items check out: every producer's items reached
+ * each consumer in order, and per producer, the consumers popped nr_ops items
+ * whose sequence numbers add up to 0 + 1 + ... + nr_ops - 1.
+ */
+int queue_bench(enum q_mode mode, int nr_producers, int nr_consumers, long nr_ops) {
+    struct q_thread *thr;
+    struct lat_hist *all;
+    struct ms_node *n, *next;
+    double first_start, last_end;
+    long pushed = 0, popped = 0, bad = 0, *count;
+    unsigned long long *seq_sum;
+    int i, p, ret;
+
+    nr_threads = nr_producers + nr_consumers;
+    nr_producers_run = nr_producers;
+    nr_consumers_run = nr_consumers;
+    atomic_store(&producers_left, nr_producers);
+    // Scanning after R = 2H + 16 retirements frees at least R - 2H nodes (H = hazard pointers)
+    hp_scan_threshold = 4 * nr_threads + 16;
+
+    pthread_mutex_init(&mq.lock, NULL);
+    pthread_cond_init(&mq.not_empty, NULL);
+    pthread_cond_init(&mq.not_full, NULL);
+    mq.head = mq.tail = 0;
+
+    n = safe_malloc(sizeof(*n));
+    atomic_init(&n->next, NULL);
+    atomic_store(&msq.head, n);
+    atomic_store(&msq.tail, n);
+    hazards = aligned_alloc(CACHE_LINE_SIZE, nr_threads * sizeof(*hazards));
+
+    vyq = aligned_alloc(CACHE_LINE_SIZE, sizeof(*vyq));
+    if (hazards == NULL || vyq == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    atomic_init(&vyq->enq_pos, 0);
+    atomic_init(&vyq->deq_pos, 0);
+    for (i = 0; i < QUEUE_CAPACITY; i++)
+        atomic_init(&vyq->cells[i].seq, i);
+
+    thr = safe_malloc(nr_threads * sizeof(*thr));
+    all = safe_malloc(sizeof(*all));
+    lat_hist_init(all);
+
+    ret = pthread_barrier_init(&q_barrier, NULL, nr_threads);
+    if (ret) {
+        perror_pthread(ret, "pthread_barrier_init");
+        exit(1);
+    }
+    for (i = 0; i < nr_threads; i++) {
+        atomic_init(&hazards[i].p[0], NULL);
+        atomic_init(&hazards[i].p[1], NULL);
+        memset(&thr[i], 0, sizeof(thr[i]));
+        thr[i].thrid = i;
+        thr[i].producer = i < nr_producers;
+        thr[i].mode = mode;
+        thr[i].nr_ops = nr_ops;
+        thr[i].retired = safe_malloc(hp_scan_threshold * sizeof(*thr[i].retired));
+        if (!thr[i].producer) {
+            thr[i].count = safe_malloc(nr_producers * sizeof(*thr[i].count));
+            thr[i].seq_sum = safe_malloc(nr_producers * sizeof(*thr[i].seq_sum));
+            thr[i].last_seq = safe_malloc(nr_producers * sizeof(*thr[i].last_seq));
+            for (p = 0; p < nr_producers; p++) {
+                thr[i].count[p] = 0;
+                thr[i].seq_sum[p] = 0;
+                thr[i].last_seq[p] = -1;
+            }
+        }
+        lat_hist_init(&thr[i].hist);
+    }
+    for (i = 0; i < nr_threads; i++) {
+        ret = pthread_create(&thr[i].tid, NULL, queue_fn, &thr[i]);
+        if (ret) {
+            perror_pthread(ret, "pthread_create");
+            exit(1);
+        }
+    }
+    for (i = 0; i < nr_threads; i++) {
+        ret = pthread_join(thr[i].tid, NULL);
+        if (ret)
+            perror_pthread(ret, "pthread_join");
+    }
+
+    // Add up what the consumers saw of every producer
+    count = safe_malloc(nr_producers * sizeof(*count));
+    seq_sum = safe_malloc(nr_producers * sizeof(*seq_sum));
+    for (p = 0; p < nr_producers; p++) {
+        count[p] = 0;
+        seq_sum[p] = 0;
+    }
+    for (i = nr_producers; i < nr_threads; i++) {
+        bad += thr[i].bad_items;
+        for (p = 0; p < nr_producers; p++) {
+            count[p] += thr[i].count[p];
+            seq_sum[p] += thr[i].seq_sum[p];
+        }
+    }
+    for (p = 0; p < nr_producers; p++)
+        if (count[p] != nr_ops || seq_sum[p] != (unsigned long long)nr_ops * (nr_ops - 1) / 2)
+            bad++;
+
+    first_start = thr[0].start;
+    last_end = thr[0].end;
+    for (i = 0; i < nr_threads; i++) {
+        if (thr[i].start < first_start)
+            first_start = thr[i].start;
+        if (thr[i].end > last_end)
+            last_end = thr[i].end;
+        if (thr[i].producer) {
+            pushed += thr[i].items;
+        } else {
+            popped += thr[i].items;
+            lat_hist_merge(all, &thr[i].hist);
+        }
+        if (verbose)
+            fprintf(stderr, "  %s, %s %d: %ld items in %.3f s\n", q_mode_names[mode],
+                    thr[i].producer ? "producer" : "consumer", thr[i].thrid, thr[i].items,
+                    thr[i].end - thr[i].start);
+    }
+
+    printf("%-10s %5d %5d %10.3f %8llu %8llu %8llu %8llu %10llu%s\n",
+           q_mode_names[mode], nr_producers, nr_consumers,
+           popped / (last_end - first_start) / 1e6,
+           lat_hist_percentile(all, 50), lat_hist_percentile(all, 90),
+           lat_hist_percentile(all, 99), lat_hist_percentile(all, 99.9), all->max,
+           bad == 0 && pushed == popped ? "" : "  !");
+    fflush(stdout);
+
+    // Every thread is gone, whatever is still retired or queued can go
+    for (i = 0; i < nr_threads; i++) {
+        while (thr[i].nr_retired)
+            free(thr[i].retired[--thr[i].nr_retired]);
+        free(thr[i].retired);
+        free(thr[i].count);
+        free(thr[i].seq_sum);
+        free(thr[i].last_seq);
+    }
+    for (n = atomic_load(&msq.head); n != NULL; n = next) {
+        next = atomic_load(&n->next);
+        free(n);
+    }
+    pthread_barrier_destroy(&q_barrier);
+    pthread_mutex_destroy(&mq.lock);
+    pthread_cond_destroy(&mq.not_empty);
+    pthread_cond_destroy(&mq.not_full);
+    free(hazards);
+    free(vyq);
+    free(all);
+    free(thr);
+    free(count);
+    free(seq_sum);
+    return bad == 0 && pushed == popped;
+}
+
+int queue_run(char *modes, int nr_producers, int nr_consumers, long nr_ops) {
+    int selected[NR_Q_MODES] = { 0 }, any = 0, found, ok = 1;
+    char *tok, *save;
+    int m;
+
+    for (tok = modes ? strtok_r(modes, ",", &save) : NULL; tok != NULL; tok = strtok_r(NULL, ",", &save)) {
+        found = 0;
+        for (m = 0; m < NR_Q_MODES; m++)
+            if (strcmp(tok, "all") == 0 || strcmp(tok, q_mode_names[m]) == 0)
+                selected[m] = any = found = 1;
+        if (!found) {
+            fprintf(stderr, "queue: unknown mode `%s' (mutex, msqueue, vyukov, all)\n", tok);
+            return -1;
+        }
+    }
+    if (!any)
+        for (m = 0; m < NR_Q_MODES; m++)
+            selected[m] = 1;
+    if (nr_producers >= 1 << (64 - Q_SEQ_BITS) || nr_ops >= 1LL << Q_SEQ_BITS) {
+        fprintf(stderr, "queue: item ids hold at most %d producers and %lld items each\n",
+                (1 << (64 - Q_SEQ_BITS)) - 1, (1LL << Q_SEQ_BITS) - 1);
+        return -1;
+    }
+
+    printf("Queue: %ld items per producer, capacity %d (mutex, vyukov)\n", nr_ops, QUEUE_CAPACITY);
+    printf("%-10s %5s %5s %10s %8s %8s %8s %8s %10s\n", "mode", "prod", "cons",
+           "Mitems/s", "p50 ns", "p90 ns", "p99 ns", "p99.9 ns", "max ns");
+    for (m = 0; m < NR_Q_MODES; m++)
+        if (selected[m])
+            ok &= queue_bench(m, nr_producers, nr_consumers, nr_ops);
+
+    if (!ok)
+        printf("NOT OK: '!' marks runs whose items did not check out (lost, duplicated or out of order).\n");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,351 @@
+/*
+ * simplesync-readmostly.c
+ *
+ * Read-mostly workload for simplesync: a shared record of RECORD_WORDS words
+ * that readers must always see in a consistent state (all words equal) and
+ * that writers update as a whole. Every thread reads read_pct% of the time
+ * and writes otherwise.
+ *
+ *   mutex:    one pthread mutex for everybody (baseline)
+ *   rwlock:   pthread_rwlock_t, readers share the lock
+ *   seqlock:  readers take no lock and retry if a writer was active,
+ *             writers serialize on a mutex and bump a sequence counter
+ *   rcu:      the record is an immutable copy behind a pointer; readers
+ *             announce the current epoch while they use it and writers
+ *             publish a new copy, then wait for a grace period (every
+ *             reader has left or moved past the new epoch) before freeing
+ *             the old one
+ *
+ * Reports reader latency percentiles and writer throughput.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "simplesync.h"
+#include "latency-hist.h"
+
+#define RECORD_WORDS 4
+#define CACHE_LINE_SIZE 64
+
+enum rm_mode {
+    RM_MUTEX,
+    RM_RWLOCK,
+    RM_SEQLOCK,
+    RM_RCU,
+    NR_RM_MODES
+};
+
+const char *rm_mode_names[NR_RM_MODES] = {
+    [RM_MUTEX] = "mutex",
+    [RM_RWLOCK] = "rwlock",
+    [RM_SEQLOCK] = "seqlock",
+    [RM_RCU] = "rcu",
+};
+
+/*
+ * Words are atomics (used with relaxed ordering) so that seqlock readers,
+ * which race with writers by design, are still well-defined C.
+ */
+struct record {
+    atomic_long w[RECORD_WORDS];
+};
+
+/* Per-thread RCU state, one cache line each */
+struct rcu_slot {
+    atomic_ulong epoch;    /* 0 = not reading, else the epoch seen on entry */
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+struct rm_thread {
+    pthread_t tid;
+    int thrid;
+    enum rm_mode mode;
+    long nr_ops;
+    int read_pct;
+    unsigned long long rng;
+    long reads, writes, torn;
+    double start, end;
+    struct lat_hist hist;  /* Reader latencies in ns */
+};
+
+/* Shared state of one run */
+struct record record;                   /* mutex, rwlock, seqlock */
+struct record *_Atomic rcu_record;      /* rcu */
+atomic_uint seq;                        /* seqlock */
+atomic_ulong rcu_epoch;
+struct rcu_slot *rcu_slots;
+int rcu_nr_slots;
+pthread_mutex_t rm_mutex = PTHREAD_MUTEX_INITIALIZER;   /* mutex mode, and writers of seqlock/rcu */
+pthread_rwlock_t rm_rwlock = PTHREAD_RWLOCK_INITIALIZER;
+pthread_barrier_t rm_barrier;
+
+unsigned long long xorshift(unsigned long long *s) {
+    *s ^= *s << 13;
+    *s ^= *s >> 7;
+    *s ^= *s << 17;
+    return *s;
+}
+
+void record_load(struct record *r, long v[RECORD_WORDS]) {
+    int i;
+    for (i = 0; i < RECORD_WORDS; i++)
+        v[i] = atomic_load_explicit(&r->w[i], memory_order_relaxed);
+}
+
+void record_store(struct record *r, long val) {
+    int i;
+    for (i = 0; i < RECORD_WORDS; i++)
+        atomic_store_explicit(&r->w[i], val, memory_order_relaxed);
+}
+
+void seqlock_read(long v[RECORD_WORDS]) {
+    unsigned s1, s2;
+
+    do {
+        while ((s1 = atomic_load_explicit(&seq, memory_order_acquire)) & 1)
+            sched_yield();   /* A writer is in the middle of an update */
+        record_load(&record, v);
+        atomic_thread_fence(memory_order_acquire);
+        s2 = atomic_load_explicit(&seq, memory_order_relaxed);
+    } while (s1 != s2);
+}
+
+void seqlock_write(void) {
+    unsigned s;
+
+    pthread_mutex_lock(&rm_mutex);
+    s = atomic_load_explicit(&seq, memory_order_relaxed);
+    atomic_store_explicit(&seq, s + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    record_store(&record, atomic_load_explicit(&record.w[0], memory_order_relaxed) + 1);
+    atomic_store_explicit(&seq, s + 2, memory_order_release);
+    pthread_mutex_unlock(&rm_mutex);
+}
+
+void rcu_read(int thrid, long v[RECORD_WORDS]) {
+    struct rcu_slot *me = &rcu_slots[thrid];
+
+    // Announce the epoch before looking at the pointer (both seq_cst, pairs with rcu_write())
+    atomic_store(&me->epoch, atomic_load(&rcu_epoch));
+    record_load(atomic_load(&rcu_record), v);
+    atomic_store_explicit(&me->epoch, 0, memory_order_release);
+}
+
+void rcu_write(void) {
+    struct record *old, *new;
+    unsigned long epoch;
+    int i;
+
+    new = safe_malloc(sizeof(*new));
+
+    pthread_mutex_lock(&rm_mutex);
+    old = atomic_load_explicit(&rcu_record, memory_order_relaxed);
+    record_store(new, atomic_load_explicit(&old->w[0], memory_order_relaxed) + 1);
+    atomic_store(&rcu_record, new);
+
+    // Grace period: wait for every reader that may still hold old
+    epoch = atomic_fetch_add(&rcu_epoch, 1) + 1;
+    for (i = 0; i < rcu_nr_slots; i++) {
+        unsigned long e;
+        while ((e = atomic_load(&rcu_slots[i].epoch)) != 0 && e < epoch)
+            sched_yield();
+    }
+    pthread_mutex_unlock(&rm_mutex);
+
+    free(old);
+}
+
+void *readmostly_fn(void *arg) {
+    struct rm_thread *thr = arg;
+    long v[RECORD_WORDS];
+    unsigned long long t0;
+    long i;
+    int k;
+
+    barrier_wait(&rm_barrier);
+    thr->start = now();
+
+    for (i = 0; i < thr->nr_ops; i++) {
+        if ((int)(xorshift(&thr->rng) % 100) >= thr->read_pct) {
+            switch (thr->mode) {
+            case RM_MUTEX:
+                pthread_mutex_lock(&rm_mutex);
+                record_store(&record, atomic_load_explicit(&record.w[0], memory_order_relaxed) + 1);
+                pthread_mutex_unlock(&rm_mutex);
+                break;
+            case RM_RWLOCK:
+                pthread_rwlock_wrlock(&rm_rwlock);
+                record_store(&record, atomic_load_explicit(&record.w[0], memory_order_relaxed) + 1);
+                pthread_rwlock_unlock(&rm_rwlock);
+                break;
+            case RM_SEQLOCK:
+                seqlock_write();
+                break;
+            case RM_RCU:
+                rcu_write();
+                break;
+            default:
+                break;
+            }
+            thr->writes++;
+            continue;
+        }
+
+        t0 = now_ns();
+        switch (thr->mode) {
+        case RM_MUTEX:
+            pthread_mutex_lock(&rm_mutex);
+            record_load(&record, v);
+            pthread_mutex_unlock(&rm_mutex);
+            break;
+        case RM_RWLOCK:
+            pthread_rwlock_rdlock(&rm_rwlock);
+            record_load(&record, v);
+            pthread_rwlock_unlock(&rm_rwlock);
+            break;
+        case RM_SEQLOCK:
+            seqlock_read(v);
+            break;
+        case RM_RCU:
+            rcu_read(thr->thrid, v);
+            break;
+        default:
+            break;
+        }
+        lat_hist_add(&thr->hist, now_ns() - t0);
+        thr->reads++;
+
+        for (k = 1; k < RECORD_WORDS; k++)
+            if (v[k] != v[0]) {
+                thr->torn++;
+                break;
+            }
+    }
+
+    thr->end = now();
+    return NULL;
+}
+
+/*
+ * One run: thrcnt threads of the given mode. Returns the number of torn reads.
+ */
+long readmostly_bench(enum rm_mode mode, int thrcnt, long nr_ops, int read_pct) {
+    struct rm_thread *thr;
+    struct lat_hist *all;
+    struct record *initial;
+    double first_start, last_end;
+    long writes = 0, torn = 0;
+    int i, ret;
+
+    record_store(&record, 0);
+    atomic_store(&seq, 0);
+    initial = safe_malloc(sizeof(*initial));
+    record_store(initial, 0);
+    atomic_store(&rcu_record, initial);
+    atomic_store(&rcu_epoch, 1);
+    rcu_nr_slots = thrcnt;
+    rcu_slots = aligned_alloc(CACHE_LINE_SIZE, thrcnt * sizeof(*rcu_slots));
+    thr = safe_malloc(thrcnt * sizeof(*thr));
+    all = safe_malloc(sizeof(*all));
+    if (rcu_slots == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    lat_hist_init(all);
+
+    ret = pthread_barrier_init(&rm_barrier, NULL, thrcnt);
+    if (ret) {
+        perror_pthread(ret, "pthread_barrier_init");
+        exit(1);
+    }
+    for (i = 0; i < thrcnt; i++) {
+        atomic_init(&rcu_slots[i].epoch, 0);
+        memset(&thr[i], 0, sizeof(thr[i]));
+        thr[i].thrid = i;
+        thr[i].mode = mode;
+        thr[i].nr_ops = nr_ops;
+        thr[i].read_pct = read_pct;
+        thr[i].rng = 0x9e3779b97f4a7c15ULL * (i + 1);
+        lat_hist_init(&thr[i].hist);
+    }
+    for (i = 0; i < thrcnt; i++) {
+        ret = pthread_create(&thr[i].tid, NULL, readmostly_fn, &thr[i]);
+        if (ret) {
+            perror_pthread(ret, "pthread_create");
+            exit(1);
+        }
+    }
+    for (i = 0; i < thrcnt; i++) {
+        ret = pthread_join(thr[i].tid, NULL);
+        if (ret)
+            perror_pthread(ret, "pthread_join");
+    }
+
+    first_start = thr[0].start;
+    last_end = thr[0].end;
+    for (i = 0; i < thrcnt; i++) {
+        if (thr[i].start < first_start)
+            first_start = thr[i].start;
+        if (thr[i].end > last_end)
+            last_end = thr[i].end;
+        writes += thr[i].writes;
+        torn += thr[i].torn;
+        lat_hist_merge(all, &thr[i].hist);
+        if (verbose)
+            fprintf(stderr, "  %s, thread %d/%d: %ld reads, %ld writes, read p99 %llu ns\n",
+                    rm_mode_names[mode], i, thrcnt, thr[i].reads, thr[i].writes,
+                    lat_hist_percentile(&thr[i].hist, 99));
+    }
+
+    printf("%-10s %6d %8llu %8llu %8llu %8llu %10llu %12.1f %6ld\n",
+           rm_mode_names[mode], thrcnt,
+           lat_hist_percentile(all, 50), lat_hist_percentile(all, 90),
+           lat_hist_percentile(all, 99), lat_hist_percentile(all, 99.9), all->max,
+           writes / (last_end - first_start) / 1e3, torn);
+    fflush(stdout);
+
+    pthread_barrier_destroy(&rm_barrier);
+    free(atomic_load(&rcu_record));
+    free(rcu_slots);
+    free(all);
+    free(thr);
+    return torn;
+}
+
+int readmostly_run(char *modes, int counts[], int nr_counts, long nr_ops, int read_pct) {
+    int selected[NR_RM_MODES] = { 0 }, any = 0, found;
+    char *tok, *save;
+    long torn = 0;
+    int i, m;
+
+    for (tok = modes ? strtok_r(modes, ",", &save) : NULL; tok != NULL; tok = strtok_r(NULL, ",", &save)) {
+        found = 0;
+        for (m = 0; m < NR_RM_MODES; m++)
+            if (strcmp(tok, "all") == 0 || strcmp(tok, rm_mode_names[m]) == 0)
+                selected[m] = any = found = 1;
+        if (!found) {
+            fprintf(stderr, "readmostly: unknown mode `%s' (mutex, rwlock, seqlock, rcu, all)\n", tok);
+            return -1;
+        }
+    }
+    if (!any)
+        for (m = 0; m < NR_RM_MODES; m++)
+            selected[m] = 1;
+
+    printf("Read-mostly: %d%% reads, %ld ops per thread, %d-word record\n", read_pct, nr_ops, RECORD_WORDS);
+    printf("%-10s %6s %8s %8s %8s %8s %10s %12s %6s\n", "mode", "thr",
+           "p50 ns", "p90 ns", "p99 ns", "p99.9 ns", "max ns", "writes K/s", "torn");
+    for (m = 0; m < NR_RM_MODES; m++) {
+        if (!selected[m])
+            continue;
+        for (i = 0; i < nr_counts; i++)
+            torn += readmostly_bench(m, counts[i], nr_ops, read_pct);
+    }
+
+    if (torn)
+        printf("NOT OK: readers saw %ld torn records.\n", torn);
+    return torn ? 1 : 0;
+}
@@ -0,0 +1,63 @@
+/*
+ * simplesync.h
+ *
+ * Pieces shared by the simplesync benchmark and its workloads.
+ */
+#ifndef SIMPLESYNC_H__
+#define SIMPLESYNC_H__
+
+#include <errno.h>
+#include <stdio.h>
+#include <pthread.h>
+
+/*
+* POSIX thread functions do not return error numbers in errno,
+* but in the actual return value of the function call instead.
+* This macro helps with error reporting in this case.
+*/
+#define perror_pthread(ret, msg) \
+do { errno = ret; perror(msg); } while (0)
+
+#define MAX_THREAD_COUNTS 32
+
+extern int verbose;
+
+/* Monotonic time in seconds, and in nanoseconds for latencies */
+double now(void);
+unsigned long long now_ns(void);
+
+/* pthread_barrier_wait() that exits on error */
+void barrier_wait(pthread_barrier_t *b);
+
+void *safe_malloc(size_t size);
+
+/*
+ * Read-mostly workload (simplesync-readmostly.c): every thread reads a
+ * multi-word record read_pct% of the time and updates it otherwise.
+ * modes is a comma-separated list of rwlock, seqlock, rcu, mutex or all.
+ * Returns 0 if no reader ever saw a torn record, 1 if one did, -1 on bad
+ * arguments.
+ */
+int readmostly_run(char *modes, int counts[], int nr_counts, long nr_ops, int read_pct);
+
+/*
+ * Producer/consumer workload (simplesync-queue.c): nr_producers threads
+ * push nr_ops items each through a shared queue, nr_consumers pop them.
+ * modes is a comma-separated list of mutex, msqueue, vyukov or all.
+ * Every item carries its producer and sequence number. Returns 0 if each
+ * producer's items reached every consumer in order and, per producer, the
+ * item counts and sequence sums match what was pushed; 1 if not, -1 on bad
+ * arguments.
+ */
+int queue_run(char *modes, int nr_producers, int nr_consumers, long nr_ops);
+
+/*
+ * Barrier workload (simplesync-barrier.c): every participant count in
+ * counts[] (NULL for 2, 4, ..., 256) goes through episodes barrier
+ * episodes (0 for the default), as threads or as forked processes.
+ * modes is a comma-separated list of pthread, central, dissemination,
+ * tournament or all. Returns 0, or -1 on bad arguments.
+ */
+int barrier_run(char *modes, int counts[], int nr_counts, long episodes, int processes);
+
+#endif /* SIMPLESYNC_H__ */
@@ -2,6 +2,9 @@
 * mandel.c
 *
 * A program to draw the Mandelbrot Set on a 256-color xterm. *
+*
+* Build: gcc -Wall -O2 -pthread -I../ex3 -o mandel-shm-sema mandel-shared-memory-with-sema.c
+*        ../ex3/mandel-simd.c ../ex3/mandel-output.c ../ex3/perfctr.c mandel-lib.o -lm
 */
 #include <stdio.h>
 #include <unistd.h>
@@ -18,6 +21,9 @@
 #include <sys/mman.h>
 
 #include "mandel-lib.h"
+#include "perfctr.h"
+#include "mandel-simd.h"
+#include "mandel-output.h"
 
 #define MANDEL_MAX_ITERATION 100000
 
@@ -45,8 +51,19 @@ double ymin = -1.0, ymax = 1.0;
 double xstep;
 double ystep;
 
-// Create the semaphore
-sem_t *sem;
+/*
+* Reorder ring in shared memory: the workers drop finished lines into it and a
+* writer process prints them in order. Line l goes to slot l % nr_slots; with
+* nr_slots a multiple of the number of workers, every slot belongs to a single
+* worker, which fills it in line order. So slot_free[s] and slot_full[s] just
+* alternate, and a worker waits only when its own slots are all still queued.
+*/
+#define RING_LINES 4 /* Default ring size, in lines per worker */
+
+int nr_slots;
+int *ring;           /* nr_slots lines of x_chars color values */
+sem_t *slot_free;    /* slot_free[s]: slot s may be filled */
+sem_t *slot_full;    /* slot_full[s]: slot s holds the next line for it */
 
 /*
 * A (distinct) instance of this structure is passed to each process
@@ -72,14 +89,15 @@ int safe_atoi(char *s, int *val) {
 
 void usage(char *argv0)
 {
-    fprintf(stderr, "Usage: %s thread_count array_size\n\n", argv0);
+    fprintf(stderr, "Usage: %s nprocs [ring_lines]\n\n"
+        "  ring_lines: lines each worker may have queued for output (default %d)\n\n",
+        argv0, RING_LINES);
     exit(1);
 }
 
 /*
-* Exactly two arguments required:
-* thread_count: The number of threads to create.
-* array_size: The size of the array to run with.
+* nprocs: The number of worker processes to create.
+* ring_lines: The ring's size, in lines per worker.
 */
  
 /*
@@ -88,24 +106,23 @@ void usage(char *argv0)
 */
 void compute_mandel_line(int line, int color_val[]) {
     /*
-    * x and y traverse the complex plane.
+    * y traverses the complex plane, x is handled by the line kernel.
     */
-    double x, y;
+    double y;
     int n;
     int val;
 
     /* Find out the y value corresponding to this line */
     y = ymax - ystep * line;
 
-    /* and iterate for all points on this line */
-    for (x = xmin, n = 0; n < x_chars; x += xstep, n++) {
-        /* Compute the point's color value */
-        val = mandel_iterations_at_point(x, y, MANDEL_MAX_ITERATION);
+    /* and iterate for all points on this line, several at once (mandel-simd.h) */
+    mandel_line_iterations(xmin, xstep, y, x_chars, MANDEL_MAX_ITERATION, color_val);
+    for (n = 0; n < x_chars; n++) {
+        /* Turn the point's iteration count into its color value */
+        val = color_val[n];
         if (val > 255)
             val = 255;
-        /* And store it in the color_val[] array */
-        val = xterm_color(val);
-        color_val[n] = val;
+        color_val[n] = xterm_color(val);
     }
 }
 
@@ -113,52 +130,62 @@ void compute_mandel_line(int line, int color_val[]) {
 * This function outputs an array of x_char color values to a 256-color xterm.
 */
 void output_mandel_line(int fd, int color_val[]) {
-    int i;
-    char point = '@';
-    char newline = '\n';
-
-    for (i = 0; i < x_chars; i++) {
-        /* Set the current color, then output the point */
-        set_xterm_color(fd, color_val[i]);
-        if (write(fd, &point, 1) != 1) {
-            perror("compute_and_output_mandel_line: write point");
-            exit(1);
-        }
-    }
+    char buf[MANDEL_LINE_BYTES(x_chars)];
 
-    /* Now that the line is done, output a newline character */
-    if (write(fd, &newline, 1) != 1) {
-        perror("compute_and_output_mandel_line: write newline");
-        exit(1);
-    }
+    /* Encode the whole line, color escapes only where the color changes, and write it at once */
+    mandel_write_all(fd, buf, mandel_encode_line(buf, color_val, x_chars));
 }
 
-void compute_and_output_mandel_line(void *arg)
+void compute_and_put_mandel_line(void *arg)
 {
-    int n;
     struct process_info_struct *pr = arg;
-
-    // The number of processes
-    n = pr->pcnt;
+    char label[32];
+    int slot;
+    // Counters with PERFCTR set in the environment, NULL (and no-ops) otherwise
+    struct perfctr *perf = perfctr_start();
+
+    // Each process takes care of lines i, i + n, i + 2×n, i + 3×n, ..., where
+    // n is the number of processes, and computes them without waiting for the
+    // output, unless all of its slots in the ring are still queued.
     for (int i = pr->mypid; i < y_chars; i += pr->pcnt) {
         /*
         * A temporary array, used to hold color values for the line being drawn
         */
         int color_val[x_chars];
 
-        // Each process takes care of lines i, i + n, i + 2×n, i + 3×n, ..., where
-        // they can all compute in parallel, but the output must be done sequentially.
-        // So we identify the critical section of the code as output_mandel_line(1, color_val);
         compute_mandel_line(i, color_val);
+        perfctr_phase(perf, "compute");
+
+        // Wait for the writer to print the slot's previous line, then queue this one
+        slot = i % nr_slots;
+        sem_wait(&slot_free[slot]);
+        memcpy(ring + slot * x_chars, color_val, sizeof(color_val));
+        sem_post(&slot_full[slot]);
+        perfctr_phase(perf, "wait+put");
+    }
 
-        sem_wait(&sem[pr->mypid]);
-        // I tell the next semaphore to increase its value by 1, and thus allow the wait_sem to pass.
+    snprintf(label, sizeof(label), "process %d", pr->mypid);
+    perfctr_stop(perf, label);
+}
 
-        // We use the mod because when we reach the last process (when i = mypid of the last process),
-        // this (pr->mypid)+1) doesn't exist
-        output_mandel_line(1, color_val);
-        sem_post(&sem[((pr->mypid) + 1) % (pr->pcnt)]); // signal(SIGINT, signal_handler);
+/*
+* The writer process: print the lines in order as they arrive in the ring.
+*/
+void output_mandel_lines(void)
+{
+    int slot;
+    struct perfctr *perf = perfctr_start();
+
+    for (int i = 0; i < y_chars; i++) {
+        slot = i % nr_slots;
+        sem_wait(&slot_full[slot]);
+        perfctr_phase(perf, "wait");
+        output_mandel_line(1, ring + slot * x_chars);
+        sem_post(&slot_free[slot]);
+        perfctr_phase(perf, "output");
     }
+
+    perfctr_stop(perf, "writer");
 }
 
 /*
@@ -219,20 +246,24 @@ void destroy_shared_memory_area(void *addr, unsigned int numbytes) {
 
 int main(int argc, char *argv[])
 {
-    int nprocs, i, status;
+    int nprocs, ring_lines = RING_LINES, i, status;
     struct process_info_struct *pr;
     pid_t p;
 
     /*
     * Parse the command line
     */
-    if (argc != 2) usage(argv[0]);
+    if (argc != 2 && argc != 3) usage(argv[0]);
 
     // nprocs = the number of processes passed as input
     if (safe_atoi(argv[1], &nprocs) < 0 || nprocs <= 0) {
         fprintf(stderr, "`%s' is not valid for `nprocs'\n", argv[1]);
         exit(1);
     }
+    if (argc == 3 && (safe_atoi(argv[2], &ring_lines) < 0 || ring_lines <= 0)) {
+        fprintf(stderr, "`%s' is not valid for `ring_lines'\n", argv[2]);
+        exit(1);
+    }
 
     xstep = (xmax - xmin) / x_chars;
     ystep = (ymax - ymin) / y_chars;
@@ -244,25 +275,28 @@ int main(int argc, char *argv[])
     // Array of structs, sizeof(*pr) calculates the size of a process_info_struct (sizeof(pr) finds the size of a pointer)
     pr = create_shared_memory_area(nprocs * sizeof(*pr));
 
-    // Array of semaphores, which will be as many as the processes
-    sem = create_shared_memory_area(nprocs * sizeof(sem_t));
+    // The ring never needs more slots than there are lines, rounded up to whole rounds of workers
+    if (ring_lines > (y_chars + nprocs - 1) / nprocs)
+        ring_lines = (y_chars + nprocs - 1) / nprocs;
+    nr_slots = nprocs * ring_lines;
+    ring = create_shared_memory_area(nr_slots * x_chars * sizeof(int));
+
+    // Two semaphores per slot, shared by the workers and the writer.
+    // Every slot starts out free and empty.
+    slot_free = create_shared_memory_area(2 * nr_slots * sizeof(sem_t));
+    slot_full = slot_free + nr_slots;
+    for (i = 0; i < nr_slots; i++) {
+        sem_init(&slot_free[i], 1, 1);
+        sem_init(&slot_full[i], 1, 0);
+    }
 
     for (i = 0; i < nprocs; i++) {
         pr[i].mypid = i;
         pr[i].pcnt = nprocs;
-
-        // The first process is the only one that will enter the sem_wait, and
-        // that's why we initialized it with an initial value of 1 (so that wait decrements it by 1)
-
-        // While the rest are initialized in a locked state
-        if (i == 0) {
-            sem_init(&sem[i], 1, 1); // unlocked-state
-        } else {
-            sem_init(&sem[i], 1, 0); // locked-state
-        }
     }
 
-    for (i = 0; i < nprocs; i++) {
+    // nprocs workers, then the writer
+    for (i = 0; i <= nprocs; i++) {
         p = fork();
 
         if (p < 0) {
@@ -271,23 +305,29 @@ int main(int argc, char *argv[])
         }
 
         if (p == 0) {
+            if (i == nprocs) {
+                output_mandel_lines();
+                return 0;
+            }
             pr[i].pid = getpid();
-            compute_and_output_mandel_line(&pr[i]);
+            compute_and_put_mandel_line(&pr[i]);
             return 0;
         }
     }
 
     // We make the parent wait for all of its children to finish
-    for (i = 0; i < nprocs; i++) {
+    for (i = 0; i <= nprocs; i++) {
         p = wait(&status);
     }
 
-    for (i = 0; i < nprocs; i++) {
-        sem_destroy(&sem[i]);
+    for (i = 0; i < nr_slots; i++) {
+        sem_destroy(&slot_free[i]);
+        sem_destroy(&slot_full[i]);
     }
 
     // Free the space we created
-    destroy_shared_memory_area(sem, nprocs * sizeof(sem_t));
+    destroy_shared_memory_area(slot_free, 2 * nr_slots * sizeof(sem_t));
+    destroy_shared_memory_area(ring, nr_slots * x_chars * sizeof(int));
     destroy_shared_memory_area(pr, nprocs * sizeof(*pr));
     reset_xterm_color(1);
 
@@ -1,6 +1,10 @@
 /*
  * mandel.c
  * A program to draw the Mandelbrot Set on a 256-color xterm.
+ *
+ * Build: gcc -Wall -O2 -pthread -I../ex3 -o mandel-shm mandel-shared-memory-without-sema.c
+ *        ../ex3/mandel-simd.c ../ex3/mandel-output.c ../ex3/mandel-image.c
+ *        ../ex3/perfctr.c mandel-lib.o -lm
  */
 
 #include <stdio.h>
@@ -15,6 +19,10 @@
 #include <semaphore.h>
 #include <sys/mman.h>
 #include "mandel-lib.h"
+#include "perfctr.h"
+#include "mandel-simd.h"
+#include "mandel-output.h"
+#include "mandel-image.h"
 
 #define MANDEL_MAX_ITERATION 100000
 
@@ -28,6 +36,17 @@
 int y_chars = 50;
 int x_chars = 90;
 
+/* Iteration limit, -i overrides it */
+int max_iteration = MANDEL_MAX_ITERATION;
+
+/*
+ * With -o, the picture goes to this image file instead, x_chars by y_chars
+ * pixels. It is mapped before the fork, so the children write their lines
+ * straight into the file (mandel-image.h) and the parent outputs nothing.
+ */
+char *image_path = NULL;
+struct mandel_image image;
+
 /*
  * The part of the complex plane to be drawn:
  * upper left corner is (xmin, ymax), lower right corner is (xmax, ymin)
@@ -67,11 +86,12 @@ int safe_atoi(char *s, int *val) {
 
 void usage(char *argv0) {
     fprintf(stderr,
-        "Usage: %s thread_count array_size\n\n"
-        "Exactly two arguments required:\n"
-        "  thread_count: The number of threads to create.\n"
-        "  array_size: The size of the array to run with.\n",
-        argv0);
+        "Usage: %s [-o file.ppm|file.pam] [-W width] [-H height] [-i max_iter] nprocs\n\n"
+        "  nprocs: The number of processes to create.\n"
+        "  -o: write the picture to this image file instead of the terminal\n"
+        "  -W, -H: size of the picture (default: 90x50)\n"
+        "  -i: iteration limit (default: %d)\n",
+        argv0, MANDEL_MAX_ITERATION);
     exit(1);
 }
 
@@ -81,23 +101,23 @@ void usage(char *argv0) {
  */
 void compute_mandel_line(int line, int color_val[]) {
     /*
-     * x and y traverse the complex plane.
+     * y traverses the complex plane, x is handled by the line kernel.
      */
-    double x, y;
-    int n, val;
+    double y;
+    int n;
+    int val;
 
     /* Find out the y value corresponding to this line */
     y = ymax - ystep * line;
 
-    /* And iterate for all points on this line */
-    for (x = xmin, n = 0; n < x_chars; x += xstep, n++) {
-        /* Compute the point's color value */
-        val = mandel_iterations_at_point(x, y, MANDEL_MAX_ITERATION);
-        if (val > 255) val = 255;
-
-        /* And store it in the color_val[] array */
-        val = xterm_color(val);
-        color_val[n] = val; // Array of x_chars cells for each line
+    /* and iterate for all points on this line, several at once (mandel-simd.h) */
+    mandel_line_iterations(xmin, xstep, y, x_chars, max_iteration, color_val);
+    for (n = 0; n < x_chars; n++) {
+        /* Turn the point's iteration count into its color value */
+        val = color_val[n];
+        if (val > 255)
+            val = 255;
+        color_val[n] = xterm_color(val);
     }
 }
 
@@ -106,42 +126,45 @@ void compute_mandel_line(int line, int color_val[]) {
  * to a 256-color xterm.
  */
 void output_mandel_line(int fd, int *buffer) {
-    int i, j;
-    char point = '@';
-    char newline = '\n';
+    size_t len = 0;
+    char *frame;
+    int i;
 
     // In previous exercises, this function printed line-by-line.
-    // Now all data to be saved is in the "2D" buffer, so we just print its contents
-    // using a double for-loop.
+    // Now all data to be saved is in the "2D" buffer, so we encode the whole frame
+    // in memory (mandel-output.h) and hand it to the kernel with a single write.
     // There's no problem with print order (and thus no need for synchronization),
     // since this function is called by the parent process after all its children have terminated.
-    for (i = 0; i < y_chars; i++) {
-        for (j = 0; j < x_chars; j++) {
-            /* Set the current color, then output the point */
-            set_xterm_color(fd, buffer[(i * x_chars) + j]);
-            if (write(fd, &point, 1) != 1) {
-                perror("compute_and_output_mandel_line: write point");
-                exit(1);
-            }
-        }
-        // Add the newline
-        printf("%c", newline);
-    }
-
-    /* Now that the line is done, output a newline character */
-    if (write(fd, &newline, 1) != 1) {
-        perror("compute_and_output_mandel_line: write newline");
+    frame = malloc((size_t)y_chars * MANDEL_LINE_BYTES(x_chars) + 1);
+    if (frame == NULL) {
+        perror("output_mandel_line: malloc");
         exit(1);
     }
+    for (i = 0; i < y_chars; i++)
+        len += mandel_encode_line(frame + len, buffer + (size_t)i * x_chars, x_chars);
+
+    /* Now that the frame is done, end it with an empty line */
+    frame[len++] = '\n';
+    mandel_write_all(fd, frame, len);
+    free(frame);
 }
 
 void compute_and_store_mandel_line(void *arg, int *buffer) {
     /*
      * A temporary array, used to hold color values for the line being drawn.
+     * On the heap: with -W a line can be wider than the stack.
      */
-    int color_val[x_chars];
+    int *color_val = malloc(x_chars * sizeof(*color_val));
     struct process_info_struct *pr = arg;
     int i, j;
+    char label[32];
+    // Counters with PERFCTR set in the environment, NULL (and no-ops) otherwise
+    struct perfctr *perf = perfctr_start();
+
+    if (color_val == NULL) {
+        perror("compute_and_store_mandel_line: malloc");
+        exit(1);
+    }
 
     // This function now computes each line and stores it in the correct position
     // in the shared buffer between processes.
@@ -149,18 +172,29 @@ void compute_and_store_mandel_line(void *arg, int *buffer) {
     // "part" of the buffer.
     // This way, there's no risk of a process overwriting another's calculations.
     for (i = pr->mypid; i < y_chars; i += pr->pcnt) {
+        if (image_path) {
+            // Raw iteration counts, colored right into the line's place in the file
+            mandel_line_iterations(xmin, xstep, ymax - ystep * i, x_chars, max_iteration, color_val);
+            mandel_image_put_row(&image, i, color_val, max_iteration);
+            continue;
+        }
         compute_mandel_line(i, color_val);
         for (j = 0; j < x_chars; j++) {
-            buffer[(i * x_chars) + j] = color_val[j];
+            buffer[((size_t)i * x_chars) + j] = color_val[j];
         }
     }
+    perfctr_phase(perf, "compute");
+
+    snprintf(label, sizeof(label), "process %d", pr->mypid);
+    perfctr_stop(perf, label);
+    free(color_val);
 }
 
 /*
  * Create a shared memory area, usable by all descendants of the calling process.
  */
-void *create_shared_memory_area(unsigned int numbytes) {
-    int pages;
+void *create_shared_memory_area(size_t numbytes) {
+    size_t pages;
     void *addr;
 
     if (numbytes == 0) {
@@ -184,8 +218,8 @@ void *create_shared_memory_area(unsigned int numbytes) {
     return addr;
 }
 
-void destroy_shared_memory_area(void *addr, unsigned int numbytes) {
-    int pages;
+void destroy_shared_memory_area(void *addr, size_t numbytes) {
+    size_t pages;
 
     if (numbytes == 0) {
         fprintf(stderr, "%s: internal error: called for numbytes == 0\n", __func__);
@@ -204,17 +238,32 @@ void destroy_shared_memory_area(void *addr, unsigned int numbytes) {
 }
 
 int main(int argc, char *argv[]) {
-    int line, nprocs, i, status;
+    int line, nprocs, i, status, opt, failed = 0;
     struct process_info_struct *pr;
     pid_t p;
-    int *buf;
+    int *buf = NULL;
+    struct perfctr *perf;
+
+    while ((opt = getopt(argc, argv, "o:W:H:i:")) != -1) {
+        if (opt == 'o') {
+            image_path = optarg;
+        } else if (opt == 'W') {
+            if (safe_atoi(optarg, &x_chars) < 0 || x_chars <= 0) usage(argv[0]);
+        } else if (opt == 'H') {
+            if (safe_atoi(optarg, &y_chars) < 0 || y_chars <= 0) usage(argv[0]);
+        } else if (opt == 'i') {
+            if (safe_atoi(optarg, &max_iteration) < 0 || max_iteration <= 0) usage(argv[0]);
+        } else {
+            usage(argv[0]);
+        }
+    }
 
     // Check for incorrect number of arguments
-    if (argc != 2) usage(argv[0]);
+    if (argc - optind != 1) usage(argv[0]);
 
     // nprocs = the number of processes passed as input
-    if (safe_atoi(argv[1], &nprocs) < 0 || nprocs <= 0) {
-        fprintf(stderr, "`%s' is not valid for `nprocs'\n", argv[1]);
+    if (safe_atoi(argv[optind], &nprocs) < 0 || nprocs <= 0) {
+        fprintf(stderr, "`%s' is not valid for `nprocs'\n", argv[optind]);
         exit(1);
     }
 
@@ -224,8 +273,11 @@ int main(int argc, char *argv[]) {
     // Array of structs, sizeof(*pr) calculates the size of one process_info_struct (sizeof(pr) gives the size of a pointer)
     pr = create_shared_memory_area(nprocs * sizeof(*pr));
 
-    // Shared buffer between processes
-    buf = create_shared_memory_area(y_chars * x_chars * sizeof(int));
+    // Shared buffer between processes, or the shared file mapping with -o
+    if (image_path)
+        mandel_image_create(&image, image_path, x_chars, y_chars);
+    else
+        buf = create_shared_memory_area((size_t)y_chars * x_chars * sizeof(int));
 
     for (i = 0; i < nprocs; i++) {
         pr[i].mypid = i;
@@ -247,16 +299,40 @@ int main(int argc, char *argv[]) {
     }
 
     // Make the parent wait for all its children to terminate
+    // A child that failed left its lines unwritten (black, like the interior), so that is an error
     for (i = 0; i < nprocs; i++) {
         p = wait(&status);
+        if (WIFSIGNALED(status)) {
+            fprintf(stderr, "Child %ld was killed by signal %d\n", (long)p, WTERMSIG(status));
+            failed = 1;
+        } else if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            fprintf(stderr, "Child %ld failed with status %d\n", (long)p, WEXITSTATUS(status));
+            failed = 1;
+        }
+    }
+    if (failed) {
+        if (image_path)
+            mandel_image_close(&image);
+        exit(1);
+    }
+
+    // With -o the children have already written everything into the file
+    if (image_path) {
+        mandel_image_close(&image);
+        destroy_shared_memory_area(pr, nprocs * sizeof(*pr));
+        return 0;
     }
 
     // Print the buffer after it has been created
+    // The parent only prints, once every child is done
+    perf = perfctr_start();
     output_mandel_line(1, buf);
+    perfctr_phase(perf, "output");
+    perfctr_stop(perf, "parent");
 
     // Free the memory we created
     destroy_shared_memory_area(pr, nprocs * sizeof(*pr));
-    destroy_shared_memory_area(buf, y_chars * x_chars * sizeof(int));
+    destroy_shared_memory_area(buf, (size_t)y_chars * x_chars * sizeof(int));
 
     reset_xterm_color(1);
     return 0;